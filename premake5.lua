@@ -1,3 +1,102 @@
+-- Vulkan SDK location, the installer sets VULKAN_SDK
+local vulkanSdk = os.getenv("VULKAN_SDK") or "C:/VulkanSDK/1.2.198.1"
+local repoRoot = _SCRIPT_DIR
+
+-- compiles shaders/*.vert|frag|comp with glslc and embeds the SPIR-V in src/generated/EmbeddedShaders.h,
+-- run as a pre-build step so the executable never has to find shader files at runtime
+newaction {
+    trigger = "embed-shaders",
+    description = "Compile shaders/ to SPIR-V and generate src/generated/EmbeddedShaders.h",
+    execute = function()
+        local glslc = path.join(vulkanSdk, "Bin/glslc")
+        local spvDir = path.join(repoRoot, "bin/shaders")        -- the .spv files double as a --shader-dir for development
+        local headerPath = path.join(repoRoot, "src/generated/EmbeddedShaders.h")
+        os.mkdir(spvDir)
+        os.mkdir(path.getdirectory(headerPath))
+
+        local sources = {}
+        for _, pattern in ipairs({"shaders/*.vert", "shaders/*.frag", "shaders/*.comp"}) do
+            for _, source in ipairs(os.matchfiles(path.join(repoRoot, pattern))) do
+                table.insert(sources, source)
+            end
+        end
+        table.sort(sources)
+
+        local lines = {
+            "// generated by `premake5 embed-shaders` from shaders/, do not edit",
+            "#pragma once",
+            "#include <cstddef>",
+            "#include <cstdint>",
+            "",
+            "namespace EmbeddedShaders {",
+            ""
+        }
+        local entries = {}
+
+        for _, source in ipairs(sources) do
+            local name = path.getname(source)
+            local spvPath = path.join(spvDir, name .. ".spv")
+            local command = string.format('"%s" -O --target-env=vulkan1.0 "%s" -o "%s"', glslc, source, spvPath)
+            if os.ishost("windows") then
+                command = '"' .. command .. '"'        -- cmd strips the outer quotes of a command line that starts with one
+            end
+            if not os.execute(command) then
+                error("failed to compile " .. source)
+            end
+
+            local file = io.open(spvPath, "rb")
+            local spv = file:read("a")
+            file:close()
+            if #spv % 4 ~= 0 then
+                error(spvPath .. " is not a whole number of SPIR-V words")
+            end
+
+            local symbol = name:gsub("[^%w]", "_")
+            table.insert(lines, string.format("constexpr uint32_t %s[] = {", symbol))
+            for i = 1, #spv, 32 do
+                local words = {}
+                for j = i, math.min(i + 31, #spv), 4 do
+                    table.insert(words, string.format("0x%08x", string.unpack("<I4", spv, j)))
+                end
+                table.insert(lines, "\t" .. table.concat(words, ", ") .. ",")
+            end
+            table.insert(lines, "};")
+            table.insert(lines, "")
+            table.insert(entries, string.format('\t{"%s", %s, sizeof(%s)},', name, symbol, symbol))
+        end
+
+        table.insert(lines, "struct Entry {")
+        table.insert(lines, "\tconst char* name;\t\t// source file name, e.g. \"shader.vert\"")
+        table.insert(lines, "\tconst uint32_t* code;")
+        table.insert(lines, "\tsize_t size;\t\t\t// in bytes")
+        table.insert(lines, "};")
+        table.insert(lines, "")
+        table.insert(lines, "constexpr Entry entries[] = {")
+        for _, entry in ipairs(entries) do
+            table.insert(lines, entry)
+        end
+        table.insert(lines, "};")
+        table.insert(lines, "")
+        table.insert(lines, "}")
+        local header = table.concat(lines, "\n") .. "\n"
+
+        -- leave the header alone when nothing changed so it doesn't trigger a rebuild of its includers
+        local existing = io.open(headerPath, "rb")
+        if existing then
+            local old = existing:read("a")
+            existing:close()
+            if old == header then
+                return
+            end
+        end
+
+        local out = io.open(headerPath, "wb")
+        out:write(header)
+        out:close()
+        print("embedded " .. #sources .. " shader(s) into " .. headerPath)
+    end
+}
+
 workspace "VulkanTutorial"
     configurations {"Debug", "Release"}
     platforms {"Win64"}
@@ -8,12 +107,12 @@ project "VulkanTutorial"
     cppdialect "C++17"
     targetdir "bin/%{cfg.buildcfg}"
     includedirs {
-        "C:/VulkanSDK/1.2.198.1/Include",
+        vulkanSdk .. "/Include",
         "lib/glm",
         "lib/glfw-3.3.6.bin.WIN64/include"
     }
     libdirs {
-        "C:/VulkanSDK/1.2.198.1/Lib",
+        vulkanSdk .. "/Lib",
         "lib/glfw-3.3.6.bin.WIN64/lib-vc2022"
     }
 
@@ -24,6 +123,12 @@ project "VulkanTutorial"
 
     files {"src/*.h", "src/*.cpp"}
 
+    -- regenerate the embedded SPIR-V before every build
+    prebuildmessage "Embedding shaders"
+    prebuildcommands {
+        '"%{wks.location}/premake5.exe" --file="%{wks.location}/premake5.lua" embed-shaders'
+    }
+
     filter "configurations:Debug"
         defines {"DEBUG"}
         symbols "On"
@@ -34,4 +139,4 @@ project "VulkanTutorial"
 
     filter "platforms:Win64"
         system "Windows"
-        architecture "x64"
\ No newline at end of file
+        architecture "x64"
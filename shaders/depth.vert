@@ -0,0 +1,15 @@
+#version 450
+
+// depth prepass: positions only, no color output. Has to compute gl_Position exactly like shader.vert,
+// the main pass tests against the prepass depth with EQUAL
+layout(set = 0, binding = 0) uniform DrawConstants {
+    mat4 transform;
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = draw.transform * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,28 @@
+#version 450
+
+// GPU-driven draws: each indirect command's firstInstance is its object's index, so the transform comes
+// from the object buffer instead of per-draw constants. Same outputs as shader.vert, pairs with shader.frag
+struct Object {
+    mat4 transform;
+    vec4 bounds;
+    uint batch;
+    uint drawBase;
+    uint indexCount;
+    uint padding;
+};
+
+layout(set = 0, binding = 0) readonly buffer Objects {
+    Object objects[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = objects[gl_InstanceIndex].transform * vec4(inPosition, 1.0);
+    fragColor = inColor;
+}
@@ -0,0 +1,25 @@
+#version 450
+
+// instanced draws: the transform and material index come from the per-instance stream at binding 1
+// (see InstanceData), so one draw covers every object sharing a mesh and material
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in mat4 inTransform;
+layout(location = 6) in uint inMaterial;
+
+layout(location = 0) out vec3 fragColor;
+
+// stand-in for real material parameters
+const vec3 materialTints[4] = vec3[](
+    vec3(1.0, 1.0, 1.0),
+    vec3(1.0, 0.6, 0.6),
+    vec3(0.6, 1.0, 0.6),
+    vec3(0.6, 0.6, 1.0)
+);
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = inTransform * vec4(inPosition, 1.0);
+    fragColor = inColor * materialTints[inMaterial % 4];
+}
@@ -0,0 +1,50 @@
+#version 450
+
+// Material shader with a few feature switches. With SPECIALIZED set they come from the specialization constants
+// below, so the driver folds the branches and unrolls the loop for this one permutation. Without it they're read
+// from the push constants at runtime, one shader for every material but with real branches.
+layout(constant_id = 0) const bool SPECIALIZED = false;
+layout(constant_id = 1) const uint LIGHTING_MODEL = 0;		// 0 unlit, 1 lambert, 2 lambert plus specular
+layout(constant_id = 2) const bool ALPHA_TEST = false;
+layout(constant_id = 3) const uint SHADING_LOOPS = 1;		// lights summed, stands in for a heavier material
+
+// the same switches for the unspecialized path (MaterialConstants)
+layout(push_constant) uniform Material {
+    uint lightingModel;
+    uint alphaTest;
+    uint shadingLoops;
+    float alphaCutoff;
+} material;
+
+layout(location = 0) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    uint lightingModel = SPECIALIZED ? LIGHTING_MODEL : material.lightingModel;
+    bool alphaTest = SPECIALIZED ? ALPHA_TEST : material.alphaTest != 0;
+    uint shadingLoops = SPECIALIZED ? SHADING_LOOPS : material.shadingLoops;
+
+    // no real normals in the test scenes, the vertex color makes a plausible one
+    vec3 normal = normalize(fragColor * 2.0 - 1.0 + vec3(0.0, 0.0, 0.5));
+    vec3 color = fragColor;
+    if (lightingModel != 0) {
+        vec3 lit = vec3(0.0);
+        for (uint i = 0; i < shadingLoops; i++) {
+            float angle = float(i) * 0.7;
+            vec3 lightDirection = normalize(vec3(cos(angle), sin(angle), 1.0));
+            float diffuse = max(dot(normal, lightDirection), 0.0);
+            lit += fragColor * diffuse;
+            if (lightingModel == 2) {
+                vec3 halfVector = normalize(lightDirection + vec3(0.0, 0.0, 1.0));
+                lit += vec3(pow(max(dot(normal, halfVector), 0.0), 32.0));
+            }
+        }
+        color = lit / float(max(shadingLoops, 1u));
+    }
+
+    if (alphaTest && dot(fragColor, vec3(0.299, 0.587, 0.114)) < material.alphaCutoff) {
+        discard;
+    }
+    outColor = vec4(color, 1.0);
+}
@@ -1,20 +1,18 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(set = 0, binding = 0) uniform DrawConstants {
+    mat4 transform;
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) out vec3 fragColor;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// bit-identical to depth.vert, so the EQUAL depth test after a prepass passes
+invariant gl_Position;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    gl_Position = draw.transform * vec4(inPosition, 1.0);
+    fragColor = inColor;
+}
@@ -0,0 +1,233 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+
+SampleStats computeStats(std::vector<double> samples) {
+	SampleStats stats;
+	if (samples.empty()) {
+		return stats;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	// nearest-rank percentile on the sorted samples
+	auto percentile = [&samples](double p) {
+		size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+		return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+	};
+
+	stats.min = samples.front();
+	stats.max = samples.back();
+	stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+	stats.p50 = percentile(50.0);
+	stats.p95 = percentile(95.0);
+	stats.p99 = percentile(99.0);
+	return stats;
+}
+
+void JsonWriter::prefix(const char* key) {
+	if (!firstInScope.empty()) {
+		if (!firstInScope.back()) {
+			out << ",";
+		}
+		firstInScope.back() = false;
+		out << "\n" << std::string(firstInScope.size() * 2, ' ');
+	}
+
+	if (key != nullptr) {
+		out << "\"" << key << "\": ";
+	}
+}
+
+void JsonWriter::beginObject(const char* key) {
+	prefix(key);
+	out << "{";
+	firstInScope.push_back(true);
+}
+
+void JsonWriter::endObject() {
+	firstInScope.pop_back();
+	out << "\n" << std::string(firstInScope.size() * 2, ' ') << "}";
+	if (firstInScope.empty()) {
+		out << "\n";
+	}
+}
+
+void JsonWriter::beginArray(const char* key) {
+	prefix(key);
+	out << "[";
+	firstInScope.push_back(true);
+}
+
+void JsonWriter::endArray() {
+	firstInScope.pop_back();
+	out << "\n" << std::string(firstInScope.size() * 2, ' ') << "]";
+}
+
+void JsonWriter::value(const char* key, double v) {
+	prefix(key);
+	if (std::isfinite(v)) {
+		// enough significant digits for microsecond timestamps in long traces
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.12g", v);
+		out << buffer;
+	} else {
+		out << "null";
+	}
+}
+
+void JsonWriter::value(const char* key, uint64_t v) {
+	prefix(key);
+	out << v;
+}
+
+void JsonWriter::value(const char* key, int64_t v) {
+	prefix(key);
+	out << v;
+}
+
+void JsonWriter::value(const char* key, bool v) {
+	prefix(key);
+	out << (v ? "true" : "false");
+}
+
+void JsonWriter::value(const char* key, const std::string& v) {
+	prefix(key);
+	out << "\"";
+	for (char c : v) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			// control characters are not allowed raw inside JSON strings
+			char buffer[8];
+			snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(c));
+			out << buffer;
+		} else {
+			out << c;
+		}
+	}
+	out << "\"";
+}
+
+void JsonWriter::stats(const char* key, const SampleStats& s) {
+	beginObject(key);
+	value("min", s.min);
+	value("mean", s.mean);
+	value("p50", s.p50);
+	value("p95", s.p95);
+	value("p99", s.p99);
+	value("max", s.max);
+	endObject();
+}
+
+void PresentPolicyStats::addFrame(const std::string& policy, const std::string& presentMode, uint32_t imageCount, const FrameTimings& timings) {
+	auto now = BenchClock::now();
+
+	size_t index = 0;
+	while (index < profiles.size() && profiles[index].policy != policy) {
+		index++;
+	}
+	if (index == profiles.size()) {
+		Profile profile;
+		profile.policy = policy;
+		profiles.push_back(profile);
+	}
+
+	Profile& profile = profiles[index];
+	profile.presentMode = presentMode;
+	profile.imageCount = imageCount;
+	profile.acquireToPresentMs.push_back(timings.acquireToPresentMs);
+
+	// the interval across a policy switch includes the swap chain rebuild, so it belongs to neither policy
+	if (index == lastProfile) {
+		profile.frameIntervalMs.push_back(elapsedMs(lastFrameEnd, now));
+	}
+	lastProfile = index;
+	lastFrameEnd = now;
+}
+
+void PresentPolicyStats::writeJson(JsonWriter& json) const {
+	for (const auto& profile : profiles) {
+		SampleStats interval = computeStats(profile.frameIntervalMs);
+
+		json.beginObject();
+		json.value("policy", profile.policy);
+		json.value("present_mode", profile.presentMode);
+		json.value("image_count", profile.imageCount);
+		json.value("frames", static_cast<uint64_t>(profile.acquireToPresentMs.size()));
+		json.value("fps", interval.mean > 0.0 ? 1000.0 / interval.mean : 0.0);
+		json.stats("frame_interval_ms", interval);
+		json.stats("acquire_to_present_ms", computeStats(profile.acquireToPresentMs));
+		json.endObject();
+	}
+}
+
+FrameBenchmark::FrameBenchmark(uint64_t warmupFrames, uint64_t measuredFrames)
+	: warmupFrames(warmupFrames), measuredFrames(measuredFrames),
+	  measureStart(BenchClock::now()), measureEnd(measureStart) {
+	cpuMs.reserve(measuredFrames);
+	acquireWaitMs.reserve(measuredFrames);
+	submitMs.reserve(measuredFrames);
+	presentMs.reserve(measuredFrames);
+	recordMs.reserve(measuredFrames);
+	graphBarriers.reserve(measuredFrames);
+	drawCalls.reserve(measuredFrames);
+	cullMs.reserve(measuredFrames);
+	prepareMs.reserve(measuredFrames);
+}
+
+void FrameBenchmark::addFrame(const FrameTimings& timings) {
+	if (isDone()) {
+		return;
+	}
+	frameCount++;
+
+	// the wall clock restarts after every warmup frame, so it ends up starting at the first measured frame
+	if (frameCount <= warmupFrames) {
+		measureStart = BenchClock::now();
+		return;
+	}
+
+	cpuMs.push_back(timings.cpuMs);
+	acquireWaitMs.push_back(timings.acquireWaitMs);
+	submitMs.push_back(timings.submitMs);
+	presentMs.push_back(timings.presentMs);
+	recordMs.push_back(timings.recordMs);
+	secondariesRecorded += timings.secondariesRecorded;
+	secondariesReused += timings.secondariesReused;
+	graphBarriers.push_back(timings.graphBarriers);
+	drawCalls.push_back(timings.drawCalls);
+	cullMs.push_back(timings.cullMs);
+	prepareMs.push_back(timings.prepareMs);
+	graphAliasedBytesSaved = std::max(graphAliasedBytesSaved, timings.graphAliasedBytesSaved);
+	if (timings.recreateMs > 0.0) {
+		recreateMs.push_back(timings.recreateMs);
+	}
+	measureEnd = BenchClock::now();
+}
+
+void FrameBenchmark::writeJson(JsonWriter& json) const {
+	double totalSeconds = elapsedMs(measureStart, measureEnd) / 1000.0;
+
+	json.value("warmup_frames", warmupFrames);
+	json.value("frames", static_cast<uint64_t>(cpuMs.size()));
+	json.value("total_s", totalSeconds);
+	json.value("fps", totalSeconds > 0.0 ? cpuMs.size() / totalSeconds : 0.0);
+	json.stats("cpu_ms", computeStats(cpuMs));
+	json.stats("acquire_wait_ms", computeStats(acquireWaitMs));
+	json.stats("submit_ms", computeStats(submitMs));
+	json.stats("present_ms", computeStats(presentMs));
+	json.stats("record_ms", computeStats(recordMs));
+	json.value("secondaries_recorded", secondariesRecorded);
+	json.value("secondaries_reused", secondariesReused);
+	json.stats("graph_barriers", computeStats(graphBarriers));
+	json.value("graph_aliased_bytes_saved", graphAliasedBytesSaved);
+	json.stats("draw_calls", computeStats(drawCalls));
+	json.stats("cull_ms", computeStats(cullMs));
+	json.stats("prepare_ms", computeStats(prepareMs));
+	json.value("swapchain_recreates", static_cast<uint64_t>(recreateMs.size()));
+	json.stats("swapchain_recreate_ms", computeStats(recreateMs));
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using BenchClock = std::chrono::high_resolution_clock;
+
+// milliseconds elapsed between two clock readings
+inline double elapsedMs(BenchClock::time_point start, BenchClock::time_point end) {
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// CPU-side timings of a single drawFrame call, filled in by the renderer
+struct FrameTimings {
+	double cpuMs = 0.0;				// whole drawFrame call
+	double acquireWaitMs = 0.0;		// waiting on the slot fence plus vkAcquireNextImageKHR
+	double submitMs = 0.0;			// vkQueueSubmit
+	double presentMs = 0.0;			// vkQueuePresentKHR (0 in headless mode)
+	double acquireToPresentMs = 0.0;	// from vkAcquireNextImageKHR until vkQueuePresentKHR returned (or submit, headless)
+	double recordMs = 0.0;			// command buffer recording, part of cpuMs
+	uint32_t secondariesRecorded = 0;
+	uint32_t secondariesReused = 0;		// secondaries submitted again without re-recording (incremental recording)
+	uint32_t graphBarriers = 0;			// pipeline barrier commands the render graph recorded
+	uint64_t graphAliasedBytesSaved = 0;	// transient memory the render graph saved by aliasing
+	double recreateMs = 0.0;			// swap chain rebuilds since the previous frame (resizes), 0 for most frames
+	uint32_t drawCalls = 0;				// draw commands recorded, an instanced or indirect draw counts once
+	double cullMs = 0.0;				// CPU frustum culling of the draw list, 0 unless it is on
+	double prepareMs = 0.0;				// scene updates between the slot fence and acquire, culling included
+	uint32_t pendingPipelineDraws = 0;	// draws whose material pipeline was still compiling (or failed), skipped or drawn with the fallback
+};
+
+// how long renderer start-up took and how much the pipeline cache helped
+struct StartupTimings {
+	double initMs = 0.0;				// whole initVulkan call
+	double pipelineMs = 0.0;			// pipeline creation only
+	double shaderMs = 0.0;				// getting the SPIR-V and creating the shader modules (part of pipelineMs)
+	bool shadersFromDisk = false;		// a shader override directory was used instead of the embedded SPIR-V
+	bool pipelineCacheWarm = false;		// a valid cache blob was loaded from disk
+	uint64_t pipelineCacheBytes = 0;
+	bool creationFeedback = false;		// VK_EXT_pipeline_creation_feedback was available
+	uint32_t cacheHits = 0;
+	uint32_t cacheMisses = 0;
+};
+
+// summary of a series of samples
+struct SampleStats {
+	double min = 0.0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+SampleStats computeStats(std::vector<double> samples);
+
+// minimal streaming JSON writer, handles commas and nesting so callers only emit keys and values
+class JsonWriter {
+public:
+	explicit JsonWriter(std::ostream& out) : out(out) {}
+
+	void beginObject(const char* key = nullptr);
+	void endObject();
+	void beginArray(const char* key = nullptr);
+	void endArray();
+
+	void value(const char* key, double v);
+	void value(const char* key, uint64_t v);
+	void value(const char* key, int64_t v);
+	void value(const char* key, uint32_t v) { value(key, static_cast<uint64_t>(v)); }
+	void value(const char* key, int v) { value(key, static_cast<int64_t>(v)); }
+	void value(const char* key, bool v);
+	void value(const char* key, const std::string& v);
+	void value(const char* key, const char* v) { value(key, std::string(v)); }
+	void stats(const char* key, const SampleStats& s);
+
+private:
+	std::ostream& out;
+	std::vector<bool> firstInScope;
+
+	void prefix(const char* key);
+};
+
+// latency and frame rate per present policy, so policies switched at runtime can be compared within one run
+class PresentPolicyStats {
+public:
+	void addFrame(const std::string& policy, const std::string& presentMode, uint32_t imageCount, const FrameTimings& timings);
+
+	// writes one object per policy into the currently open JSON array
+	void writeJson(JsonWriter& json) const;
+
+private:
+	struct Profile {
+		std::string policy;
+		std::string presentMode;
+		uint32_t imageCount = 0;
+		std::vector<double> acquireToPresentMs;
+		std::vector<double> frameIntervalMs;
+	};
+
+	std::vector<Profile> profiles;
+	size_t lastProfile = SIZE_MAX;
+	BenchClock::time_point lastFrameEnd;
+};
+
+// collects per-frame timings after a warmup and reports percentiles as JSON
+class FrameBenchmark {
+public:
+	FrameBenchmark(uint64_t warmupFrames, uint64_t measuredFrames);
+
+	void addFrame(const FrameTimings& timings);
+	bool isDone() const { return frameCount >= warmupFrames + measuredFrames; }
+
+	// writes the frame statistics as members of the currently open JSON object
+	void writeJson(JsonWriter& json) const;
+
+private:
+	uint64_t warmupFrames;
+	uint64_t measuredFrames;
+	uint64_t frameCount = 0;
+	BenchClock::time_point measureStart;
+	BenchClock::time_point measureEnd;
+
+	std::vector<double> cpuMs;
+	std::vector<double> acquireWaitMs;
+	std::vector<double> submitMs;
+	std::vector<double> presentMs;
+	std::vector<double> recordMs;
+	uint64_t secondariesRecorded = 0;
+	uint64_t secondariesReused = 0;
+	std::vector<double> graphBarriers;
+	std::vector<double> drawCalls;
+	std::vector<double> cullMs;
+	std::vector<double> prepareMs;
+	uint64_t graphAliasedBytesSaved = 0;
+	std::vector<double> recreateMs;		// only frames that rebuilt the swap chain
+};
@@ -0,0 +1,204 @@
+#include "BufferUploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void BufferUploader::init(VkDevice newDevice, DeviceAllocator& newAllocator, const QueueFamilyIndices& queueFamilies,
+                          VkQueue newTransferQueue, VkQueue newGraphicsQueue) {
+	device = newDevice;
+	allocator = &newAllocator;
+	graphicsFamily = queueFamilies.graphicsFamily.value();
+	transferFamily = queueFamilies.transferFamily.value_or(graphicsFamily);
+	transferQueue = newTransferQueue;
+	graphicsQueue = newGraphicsQueue;
+
+	allocator->createBuffer(STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	                        stagingBuffer, stagingAllocation);
+
+	transferPool = createPool(transferFamily);
+	for (auto& half : halves) {
+		half.commandBuffer = allocateCommandBuffer(transferPool);
+		half.fence = createFence();
+	}
+
+	if (usesTransferQueue()) {
+		graphicsPool = createPool(graphicsFamily);
+		acquireCommandBuffer = allocateCommandBuffer(graphicsPool);
+		acquireFence = createFence();
+
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &releaseSemaphore) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create upload semaphore");
+		}
+	}
+}
+
+void BufferUploader::destroy() {
+	for (auto& half : halves) {
+		vkWaitForFences(device, 1, &half.fence, VK_TRUE, UINT64_MAX);
+		vkDestroyFence(device, half.fence, nullptr);
+	}
+	vkDestroyCommandPool(device, transferPool, nullptr);
+
+	if (usesTransferQueue()) {
+		vkDestroyFence(device, acquireFence, nullptr);
+		vkDestroySemaphore(device, releaseSemaphore, nullptr);
+		vkDestroyCommandPool(device, graphicsPool, nullptr);
+	}
+
+	allocator->destroyBuffer(stagingBuffer, stagingAllocation);
+}
+
+void BufferUploader::uploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& allocation) {
+	if (size == 0) {
+		throw std::runtime_error("Failed to upload buffer: size is 0");
+	}
+
+	allocator->createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, allocation);
+
+	// the buffer is handed to the graphics family in one piece at the end, or made visible to every later read
+	// when there's only one family (later submissions on the queue are covered by the barrier too)
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = usesTransferQueue() ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+	barrier.srcQueueFamilyIndex = usesTransferQueue() ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = usesTransferQueue() ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	const VkDeviceSize halfSize = STAGING_SIZE / 2;
+	const char* source = static_cast<const char*>(data);
+	VkDeviceSize offset = 0;
+	uint32_t current = 0;
+
+	// large buffers go through in chunks, alternating staging halves so memcpy and the DMA copy overlap
+	while (offset < size) {
+		VkDeviceSize chunk = std::min(halfSize, size - offset);
+		bool last = offset + chunk == size;
+		StagingHalf& half = halves[current];
+
+		vkWaitForFences(device, 1, &half.fence, VK_TRUE, UINT64_MAX);
+		vkResetFences(device, 1, &half.fence);
+
+		VkDeviceSize stagingOffset = current * halfSize;
+		memcpy(static_cast<char*>(stagingAllocation.mapped) + stagingOffset, source + offset, static_cast<size_t>(chunk));
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(half.commandBuffer, &beginInfo);
+
+		VkBufferCopy region{};
+		region.srcOffset = stagingOffset;
+		region.dstOffset = offset;
+		region.size = chunk;
+		vkCmdCopyBuffer(half.commandBuffer, stagingBuffer, buffer, 1, &region);
+
+		if (last) {
+			// release: nothing on this queue reads the buffer afterwards, so the destination stage is irrelevant
+			VkPipelineStageFlags dstStage = usesTransferQueue() ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			vkCmdPipelineBarrier(half.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+
+		if (vkEndCommandBuffer(half.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record upload command buffer");
+		}
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &half.commandBuffer;
+		if (last && usesTransferQueue()) {
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &releaseSemaphore;
+		}
+
+		if (vkQueueSubmit(transferQueue, 1, &submitInfo, half.fence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to submit upload");
+		}
+
+		offset += chunk;
+		current ^= 1;
+	}
+
+	if (usesTransferQueue()) {
+		// acquire on the graphics queue, with a barrier matching the release exactly
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(acquireCommandBuffer, &beginInfo);
+		vkCmdPipelineBarrier(acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		                     0, 0, nullptr, 1, &barrier, 0, nullptr);
+		if (vkEndCommandBuffer(acquireCommandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record ownership acquire");
+		}
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &releaseSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &acquireCommandBuffer;
+
+		vkResetFences(device, 1, &acquireFence);
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, acquireFence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to submit ownership acquire");
+		}
+		vkWaitForFences(device, 1, &acquireFence, VK_TRUE, UINT64_MAX);
+	}
+
+	// everything this upload submitted has finished once both halves are idle
+	for (auto& half : halves) {
+		vkWaitForFences(device, 1, &half.fence, VK_TRUE, UINT64_MAX);
+	}
+}
+
+VkCommandPool BufferUploader::createPool(uint32_t queueFamily) {
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create upload command pool");
+	}
+	return pool;
+}
+
+VkCommandBuffer BufferUploader::allocateCommandBuffer(VkCommandPool pool) {
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = pool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate upload command buffer");
+	}
+	return commandBuffer;
+}
+
+VkFence BufferUploader::createFence() {
+	// signalled so the first wait on it returns immediately
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	VkFence fence;
+	if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create upload fence");
+	}
+	return fence;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+#include "DeviceAllocator.h"
+#include "Utilities.h"
+
+// Fills device local buffers through a host visible staging buffer.
+// Copies go to the transfer-only queue family when the device has one (DMA engine, runs next to graphics work);
+// the buffer is then released by the transfer family and acquired by the graphics family before it's handed back.
+class BufferUploader {
+public:
+	void init(VkDevice device, DeviceAllocator& allocator, const QueueFamilyIndices& queueFamilies,
+	          VkQueue transferQueue, VkQueue graphicsQueue);
+	void destroy();
+
+	// creates a device local buffer with usage | TRANSFER_DST and uploads data into it,
+	// returns once the data is on the device and the buffer is usable from the graphics queue
+	void uploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& allocation);
+
+	bool usesTransferQueue() const { return transferFamily != graphicsFamily; }
+
+	// staging memory is split in two halves so the CPU fills one while the GPU copies the other
+	static const VkDeviceSize STAGING_SIZE = 32ULL << 20;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	DeviceAllocator* allocator = nullptr;
+	uint32_t transferFamily = 0;
+	uint32_t graphicsFamily = 0;
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	Allocation stagingAllocation;
+
+	struct StagingHalf {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+	};
+	StagingHalf halves[2];
+	VkCommandPool transferPool = VK_NULL_HANDLE;
+
+	// only needed for the ownership acquire when the families differ
+	VkCommandPool graphicsPool = VK_NULL_HANDLE;
+	VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+	VkSemaphore releaseSemaphore = VK_NULL_HANDLE;
+	VkFence acquireFence = VK_NULL_HANDLE;
+
+	VkCommandPool createPool(uint32_t queueFamily);
+	VkCommandBuffer allocateCommandBuffer(VkCommandPool pool);
+	VkFence createFence();
+};
@@ -0,0 +1,322 @@
+#include "DeviceAllocator.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static VkDeviceSize nextPowerOfTwo(VkDeviceSize value) {
+	VkDeviceSize result = 1;
+	while (result < value) {
+		result <<= 1;
+	}
+	return result;
+}
+
+static uint32_t log2Exact(VkDeviceSize powerOfTwo) {
+	uint32_t result = 0;
+	while ((1ULL << result) < powerOfTwo) {
+		result++;
+	}
+	return result;
+}
+
+void DeviceAllocator::init(VkDevice newDevice, VkPhysicalDevice physicalDevice) {
+	device = newDevice;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	pools.resize(memoryProperties.memoryTypeCount * 2);
+	for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+		// small heaps (e.g. the 256MB host visible device local one) get smaller blocks so one block can't eat it
+		VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[type].heapIndex].size;
+		VkDeviceSize blockSize = MAX_BLOCK_SIZE;
+		while (blockSize > (1ULL << 20) && blockSize > heapSize / 8) {
+			blockSize >>= 1;
+		}
+
+		for (uint32_t kind = 0; kind < 2; kind++) {
+			pools[type * 2 + kind].memoryType = type;
+			pools[type * 2 + kind].blockSize = blockSize;
+		}
+	}
+}
+
+void DeviceAllocator::destroy() {
+	for (auto& pool : pools) {
+		for (auto& block : pool.blocks) {
+			if (block->allocationCount > 0) {
+				std::cerr << "device allocator: " << block->allocationCount << " allocation(s) leaked" << std::endl;
+			}
+			vkFreeMemory(device, block->memory, nullptr);
+		}
+	}
+	pools.clear();
+
+	if (dedicatedCount > 0) {
+		std::cerr << "device allocator: " << dedicatedCount << " dedicated allocation(s) leaked" << std::endl;
+	}
+}
+
+Allocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind) {
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	Pool& pool = pools[memoryType * 2 + static_cast<uint32_t>(kind)];
+
+	// buddy ranges are aligned to their own size, so rounding up to the alignment covers it
+	VkDeviceSize rounded = nextPowerOfTwo(std::max({requirements.size, requirements.alignment, MIN_ALLOCATION}));
+	// lazily allocated memory is committed per VkDeviceMemory, sharing a block would commit it for everyone
+	bool lazy = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+	if (rounded > pool.blockSize / 2 || lazy) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return allocateDedicated(requirements.size, memoryType);
+	}
+	uint32_t order = log2Exact(rounded / MIN_ALLOCATION);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// first block with a free range big enough
+	MemoryBlock* block = nullptr;
+	uint32_t foundOrder = 0;
+	for (auto& candidate : pool.blocks) {
+		for (uint32_t o = order; o <= candidate->maxOrder; o++) {
+			if (!candidate->freeLists[o].empty()) {
+				block = candidate.get();
+				foundOrder = o;
+				break;
+			}
+		}
+		if (block != nullptr) {
+			break;
+		}
+	}
+	if (block == nullptr) {
+		block = createBlock(pool);
+		foundOrder = block->maxOrder;
+	}
+
+	auto first = block->freeLists[foundOrder].begin();
+	VkDeviceSize offset = *first;
+	block->freeLists[foundOrder].erase(first);
+
+	// split down to the requested order, the upper halves go back on the free lists
+	for (uint32_t o = foundOrder; o > order; o--) {
+		block->freeLists[o - 1].insert(offset + (MIN_ALLOCATION << (o - 1)));
+	}
+
+	block->usedBytes += requirements.size;
+	block->allocatedBytes += rounded;
+	block->allocationCount++;
+
+	Allocation allocation;
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.size = requirements.size;
+	allocation.mapped = block->mapped != nullptr ? static_cast<char*>(block->mapped) + offset : nullptr;
+	allocation.block = block;
+	allocation.order = order;
+	return allocation;
+}
+
+void DeviceAllocator::free(Allocation& allocation) {
+	if (allocation.memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (allocation.block == nullptr) {
+		vkFreeMemory(device, allocation.memory, nullptr);
+		dedicatedCount--;
+		dedicatedBytes -= allocation.size;
+		allocation = Allocation();
+		return;
+	}
+
+	MemoryBlock* block = allocation.block;
+	block->usedBytes -= allocation.size;
+	block->allocatedBytes -= MIN_ALLOCATION << allocation.order;
+	block->allocationCount--;
+
+	// merge with free buddies as far up as possible
+	VkDeviceSize offset = allocation.offset;
+	uint32_t order = allocation.order;
+	while (order < block->maxOrder) {
+		VkDeviceSize buddy = offset ^ (MIN_ALLOCATION << order);
+		auto it = block->freeLists[order].find(buddy);
+		if (it == block->freeLists[order].end()) {
+			break;
+		}
+		block->freeLists[order].erase(it);
+		offset = std::min(offset, buddy);
+		order++;
+	}
+	block->freeLists[order].insert(offset);
+
+	// keep one empty block per pool around so alloc/free at a block boundary doesn't hit vkAllocateMemory every time
+	if (block->allocationCount == 0) {
+		Pool& pool = pools[block->poolIndex];
+		bool otherEmpty = std::any_of(pool.blocks.begin(), pool.blocks.end(),
+		                              [block](const auto& b) { return b.get() != block && b->allocationCount == 0; });
+		if (otherEmpty) {
+			vkFreeMemory(device, block->memory, nullptr);
+			pool.blocks.erase(std::find_if(pool.blocks.begin(), pool.blocks.end(), [block](const auto& b) { return b.get() == block; }));
+		}
+	}
+
+	allocation = Allocation();
+}
+
+void DeviceAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                                   VkBuffer& buffer, Allocation& allocation) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create buffer");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &requirements);
+	allocation = allocate(requirements, properties, ResourceKind::Linear);
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+}
+
+void DeviceAllocator::destroyBuffer(VkBuffer buffer, Allocation& allocation) {
+	vkDestroyBuffer(device, buffer, nullptr);
+	free(allocation);
+}
+
+void DeviceAllocator::createImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, VkImage& image, Allocation& allocation) {
+	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create image");
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(device, image, &requirements);
+	ResourceKind kind = imageInfo.tiling == VK_IMAGE_TILING_LINEAR ? ResourceKind::Linear : ResourceKind::Optimal;
+	allocation = allocate(requirements, properties, kind);
+	vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+}
+
+void DeviceAllocator::destroyImage(VkImage image, Allocation& allocation) {
+	vkDestroyImage(device, image, nullptr);
+	free(allocation);
+}
+
+AllocatorStats DeviceAllocator::getStats() const {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	AllocatorStats stats;
+	stats.dedicatedCount = dedicatedCount;
+	stats.dedicatedBytes = dedicatedBytes;
+	stats.allocationCount = dedicatedCount;
+
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestRangeSum = 0;
+	for (const auto& pool : pools) {
+		for (const auto& block : pool.blocks) {
+			stats.blockCount++;
+			stats.blockBytes += block->size;
+			stats.usedBytes += block->usedBytes;
+			stats.allocatedBytes += block->allocatedBytes;
+			stats.allocationCount += block->allocationCount;
+			freeBytes += block->size - block->allocatedBytes;
+
+			for (uint32_t o = block->maxOrder + 1; o-- > 0;) {
+				if (!block->freeLists[o].empty()) {
+					stats.largestFreeRange = std::max(stats.largestFreeRange, MIN_ALLOCATION << o);
+					largestRangeSum += MIN_ALLOCATION << o;
+					break;
+				}
+			}
+		}
+	}
+
+	// free space can't be contiguous across blocks, so each block only counts against its own largest range
+	stats.fragmentation = freeBytes > 0 ? 1.0 - static_cast<double>(largestRangeSum) / freeBytes : 0.0;
+	return stats;
+}
+
+void AllocatorStats::writeJson(JsonWriter& json) const {
+	json.value("block_count", blockCount);
+	json.value("block_bytes", blockBytes);
+	json.value("dedicated_count", dedicatedCount);
+	json.value("dedicated_bytes", dedicatedBytes);
+	json.value("allocation_count", allocationCount);
+	json.value("used_bytes", usedBytes);
+	json.value("allocated_bytes", allocatedBytes);
+	json.value("largest_free_range", largestFreeRange);
+	json.value("fragmentation", fragmentation);
+}
+
+VkDeviceSize DeviceAllocator::getBlockSize(uint32_t memoryType) const {
+	return pools[memoryType * 2].blockSize;
+}
+
+bool DeviceAllocator::hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type");
+}
+
+Allocation DeviceAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryType) {
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	Allocation allocation;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &allocation.memory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate dedicated device memory");
+	}
+	allocation.size = size;
+
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped);
+	}
+
+	dedicatedCount++;
+	dedicatedBytes += size;
+	return allocation;
+}
+
+MemoryBlock* DeviceAllocator::createBlock(Pool& pool) {
+	auto block = std::make_unique<MemoryBlock>();
+	block->poolIndex = static_cast<uint32_t>(&pool - pools.data());
+	block->size = pool.blockSize;
+	block->maxOrder = log2Exact(pool.blockSize / MIN_ALLOCATION);
+	block->freeLists.resize(block->maxOrder + 1);
+	block->freeLists[block->maxOrder].insert(0);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = pool.blockSize;
+	allocInfo.memoryTypeIndex = pool.memoryType;
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate device memory block");
+	}
+
+	// host visible blocks stay mapped for their whole life, mapping per allocation isn't allowed to overlap anyway
+	if (memoryProperties.memoryTypes[pool.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+	}
+
+	pool.blocks.push_back(std::move(block));
+	return pool.blocks.back().get();
+}
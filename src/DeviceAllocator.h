@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class JsonWriter;
+
+// one VkDeviceMemory split with a buddy allocator: a free range of order k is MIN_ALLOCATION << k bytes
+// and starts at a multiple of its own size, so its buddy is found by flipping a single offset bit
+struct MemoryBlock {
+	uint32_t poolIndex = 0;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	void* mapped = nullptr;
+	VkDeviceSize size = 0;
+	uint32_t maxOrder = 0;
+	std::vector<std::unordered_set<VkDeviceSize>> freeLists;	// free offsets per order
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize allocatedBytes = 0;
+	uint32_t allocationCount = 0;
+};
+
+// what a sub-allocation will be bound to. Linear (buffers, linear images) and optimal (tiled images) resources
+// come from separate blocks, so neighbours can never violate bufferImageGranularity
+enum class ResourceKind {
+	Linear,
+	Optimal
+};
+
+// a range of device memory handed out by DeviceAllocator, bind resources with memory + offset
+struct Allocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;				// size that was asked for
+	void* mapped = nullptr;				// host pointer to offset when the memory is host visible (kept mapped)
+
+	// bookkeeping for free()
+	MemoryBlock* block = nullptr;		// nullptr for dedicated allocations
+	uint32_t order = 0;
+};
+
+struct AllocatorStats {
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;		// live sub-allocations + dedicated allocations
+	VkDeviceSize blockBytes = 0;		// device memory reserved in blocks
+	VkDeviceSize dedicatedBytes = 0;
+	VkDeviceSize usedBytes = 0;			// bytes requested by live allocations
+	VkDeviceSize allocatedBytes = 0;	// bytes taken from blocks (requests rounded up to a power of two)
+	VkDeviceSize largestFreeRange = 0;
+	double fragmentation = 0.0;			// share of free block bytes outside each block's largest free range
+
+	// writes the fields as members of the currently open JSON object
+	void writeJson(JsonWriter& json) const;
+};
+
+// Device memory allocator: each memory type gets large blocks that are split up with a buddy allocator,
+// resources bigger than half a block get their own dedicated VkDeviceMemory.
+// One vkAllocateMemory per block keeps us far below maxMemoryAllocationCount and off the slow driver path.
+class DeviceAllocator {
+public:
+	void init(VkDevice device, VkPhysicalDevice physicalDevice);
+	// frees all blocks, every allocation must have been freed already
+	void destroy();
+
+	Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind);
+	void free(Allocation& allocation);
+
+	// - helpers that create the resource, allocate and bind in one go
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+	                  VkBuffer& buffer, Allocation& allocation);
+	void destroyBuffer(VkBuffer buffer, Allocation& allocation);
+	void createImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, VkImage& image, Allocation& allocation);
+	void destroyImage(VkImage image, Allocation& allocation);
+
+	AllocatorStats getStats() const;
+	VkDeviceSize getBlockSize(uint32_t memoryType) const;
+	// whether one of the memory types in typeFilter has all of properties, e.g. to fall back when there's no lazy memory
+	bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	// the smallest piece a block is split into, smaller requests are rounded up to this
+	static const VkDeviceSize MIN_ALLOCATION = 256;
+	static const VkDeviceSize MAX_BLOCK_SIZE = 64ULL << 20;
+
+private:
+	// blocks of one memory type for one resource kind
+	struct Pool {
+		uint32_t memoryType = 0;
+		VkDeviceSize blockSize = 0;
+		std::vector<std::unique_ptr<MemoryBlock>> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	std::vector<Pool> pools;		// index memoryType * 2 + kind
+
+	uint32_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	mutable std::mutex mutex;
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryType);
+	MemoryBlock* createBlock(Pool& pool);
+};
@@ -0,0 +1,281 @@
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <glm/geometric.hpp>
+
+// the SIMD kernels are x64 only (SSE2 is baseline there, AVX2 is checked at runtime). glm's own simd helpers
+// would need GLM_FORCE_INTRINSICS, which changes the layout of every glm type in the project, so the kernels use
+// the intrinsics directly and other architectures get the plain glm kernel
+#if defined(_M_X64) || defined(__x86_64__)
+#define CULL_X64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CULL_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CULL_X64 0
+#endif
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjection) {
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];		// left
+	frustum.planes[1] = rows[3] - rows[0];		// right
+	frustum.planes[2] = rows[3] + rows[1];		// top (y points down)
+	frustum.planes[3] = rows[3] - rows[1];		// bottom
+	frustum.planes[4] = rows[2];				// near, clip space z starts at 0
+	frustum.planes[5] = rows[3] - rows[2];		// far
+	for (auto& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+const char* cullKernelName(CullKernel kernel) {
+	switch (kernel) {
+	case CullKernel::Scalar: return "scalar";
+	case CullKernel::Sse: return "sse";
+	case CullKernel::Avx2: return "avx2";
+	}
+	return "unknown";
+}
+
+static uint32_t cullScalar(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r,
+                           uint32_t begin, uint32_t end, uint32_t* out) {
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i++) {
+		glm::vec3 center(x[i], y[i], z[i]);
+		bool inside = true;
+		for (const auto& plane : frustum.planes) {
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -r[i]) {
+				inside = false;
+				break;
+			}
+		}
+		out[written] = i;
+		written += inside;
+	}
+	return written;
+}
+
+#if CULL_X64
+// offsets of the set bits of every 4 bit mask, packed to the front
+struct PackTable4 {
+	alignas(16) uint32_t offsets[16][4] = {};
+	uint32_t counts[16] = {};
+
+	PackTable4() {
+		for (uint32_t mask = 0; mask < 16; mask++) {
+			for (uint32_t bit = 0; bit < 4; bit++) {
+				if (mask & (1u << bit)) {
+					offsets[mask][counts[mask]++] = bit;
+				}
+			}
+		}
+	}
+};
+
+// the same for 8 bit masks
+struct PackTable8 {
+	alignas(32) uint32_t offsets[256][8] = {};
+	uint32_t counts[256] = {};
+
+	PackTable8() {
+		for (uint32_t mask = 0; mask < 256; mask++) {
+			for (uint32_t bit = 0; bit < 8; bit++) {
+				if (mask & (1u << bit)) {
+					offsets[mask][counts[mask]++] = bit;
+				}
+			}
+		}
+	}
+};
+
+static const PackTable4 packTable4;
+static const PackTable8 packTable8;
+
+// each group stores a full vector of indices but only advances by its visible count. The store never passes the
+// end of the range: after g groups at most 4g indices were kept
+static uint32_t cullSse(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r,
+                        uint32_t begin, uint32_t end, uint32_t* out) {
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 4) {
+		__m128 cx = _mm_loadu_ps(x + i);
+		__m128 cy = _mm_loadu_ps(y + i);
+		__m128 cz = _mm_loadu_ps(z + i);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+			                             _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		__m128i offsets = _mm_load_si128(reinterpret_cast<const __m128i*>(packTable4.offsets[mask]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), offsets));
+		written += packTable4.counts[mask];
+	}
+	return written;
+}
+
+CULL_TARGET_AVX2
+static uint32_t cullAvx2(const Frustum& frustum, const float* x, const float* y, const float* z, const float* r,
+                         uint32_t begin, uint32_t end, uint32_t* out) {
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+
+	// no FMA, so every kernel rounds the same way and they agree on spheres touching a plane
+	uint32_t written = 0;
+	for (uint32_t i = begin; i < end; i += 8) {
+		__m256 cx = _mm256_loadu_ps(x + i);
+		__m256 cy = _mm256_loadu_ps(y + i);
+		__m256 cz = _mm256_loadu_ps(z + i);
+		__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy)),
+			                                _mm256_add_ps(_mm256_mul_ps(planeZ[p], cz), planeW[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		__m256i offsets = _mm256_load_si256(reinterpret_cast<const __m256i*>(packTable8.offsets[mask]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), offsets));
+		written += packTable8.counts[mask];
+	}
+	return written;
+}
+
+// AVX2 needs the CPU to have it and the OS to save the upper halves of the registers
+static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+bool FrustumCuller::isSupported(CullKernel kernel) {
+#if CULL_X64
+	static const bool avx2 = cpuHasAvx2();
+	return kernel != CullKernel::Avx2 || avx2;
+#else
+	return kernel == CullKernel::Scalar;
+#endif
+}
+
+CullKernel FrustumCuller::getBestKernel() {
+	if (isSupported(CullKernel::Avx2)) {
+		return CullKernel::Avx2;
+	}
+	return isSupported(CullKernel::Sse) ? CullKernel::Sse : CullKernel::Scalar;
+}
+
+void FrustumCuller::resize(uint32_t newCount) {
+	// a negative radius puts the padding outside every plane
+	uint32_t padded = (newCount + 7) / 8 * 8;
+	centerX.resize(padded, 0.0f);
+	centerY.resize(padded, 0.0f);
+	centerZ.resize(padded, 0.0f);
+	radius.resize(padded, -FLT_MAX);
+	std::fill(radius.begin() + std::min(count, newCount), radius.end(), -FLT_MAX);
+	count = newCount;
+}
+
+void FrustumCuller::setSphere(uint32_t index, const glm::vec3& center, float sphereRadius) {
+	centerX[index] = center.x;
+	centerY[index] = center.y;
+	centerZ[index] = center.z;
+	radius[index] = sphereRadius;
+}
+
+uint32_t FrustumCuller::cullRange(const Frustum& frustum, CullKernel kernel, uint32_t begin, uint32_t end, uint32_t* out) const {
+	if (!isSupported(kernel)) {
+		kernel = CullKernel::Scalar;
+	}
+#if CULL_X64
+	if (kernel == CullKernel::Avx2) {
+		return cullAvx2(frustum, centerX.data(), centerY.data(), centerZ.data(), radius.data(), begin, end, out);
+	}
+	if (kernel == CullKernel::Sse) {
+		return cullSse(frustum, centerX.data(), centerY.data(), centerZ.data(), radius.data(), begin, end, out);
+	}
+#endif
+	return cullScalar(frustum, centerX.data(), centerY.data(), centerZ.data(), radius.data(), begin, end, out);
+}
+
+void FrustumCuller::cull(const Frustum& frustum, CullKernel kernel, std::vector<uint32_t>& visible) {
+	// room for everything, the kernels write whole vectors
+	visible.resize(getPaddedCount());
+	visible.resize(cullRange(frustum, kernel, 0, getPaddedCount(), visible.data()));
+}
+
+void FrustumCuller::cullParallel(const Frustum& frustum, CullKernel kernel, JobSystem& jobs, std::vector<uint32_t>& visible) {
+	uint32_t padded = getPaddedCount();
+	uint32_t chunkCount = (padded + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	chunkVisible.resize(padded);
+	chunkCounts.assign(chunkCount, 0);
+
+	jobs.parallelFor(chunkCount, 1, [&](uint32_t first, uint32_t last) {
+		for (uint32_t chunk = first; chunk < last; chunk++) {
+			uint32_t begin = chunk * CHUNK_SIZE;
+			uint32_t end = std::min(begin + CHUNK_SIZE, padded);
+			chunkCounts[chunk] = cullRange(frustum, kernel, begin, end, chunkVisible.data() + begin);
+		}
+	});
+
+	// exclusive prefix sum, then each chunk copies its indices to where they belong in the compact list
+	std::vector<uint32_t> chunkOffsets(chunkCount);
+	uint32_t total = 0;
+	for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+		chunkOffsets[chunk] = total;
+		total += chunkCounts[chunk];
+	}
+
+	visible.resize(total);
+	jobs.parallelFor(chunkCount, 1, [&](uint32_t first, uint32_t last) {
+		for (uint32_t chunk = first; chunk < last; chunk++) {
+			memcpy(visible.data() + chunkOffsets[chunk], chunkVisible.data() + chunk * CHUNK_SIZE, sizeof(uint32_t) * chunkCounts[chunk]);
+		}
+	});
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "JobSystem.h"
+
+// view frustum as six inward facing planes, xyz normalized: a point p is inside when dot(xyz, p) + w >= 0 for all
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// planes of a projection * view matrix with Vulkan's 0..1 clip space depth (Gribb/Hartmann)
+	static Frustum fromMatrix(const glm::mat4& viewProjection);
+};
+
+// which kernel tests the spheres, Sse takes 4 per iteration and Avx2 8
+enum class CullKernel {
+	Scalar,
+	Sse,
+	Avx2
+};
+
+const char* cullKernelName(CullKernel kernel);
+
+// CPU frustum culling of bounding spheres kept in structure-of-arrays layout, so the SIMD kernels load
+// 4 or 8 objects' x, y, z and radius with one instruction each and test them against a plane at a time.
+// Culling writes the indices of the visible spheres, in order, into a compact list.
+class FrustumCuller {
+public:
+	// keeps the first min(count, old count) spheres, new ones are never visible until set
+	void resize(uint32_t count);
+	void setSphere(uint32_t index, const glm::vec3& center, float radius);
+	uint32_t getCount() const { return count; }
+
+	// Sse needs an x86 CPU, Avx2 one that has it too. Everything else (ARM, NEON) runs the scalar kernel
+	static bool isSupported(CullKernel kernel);
+	static CullKernel getBestKernel();
+
+	// on the calling thread
+	void cull(const Frustum& frustum, CullKernel kernel, std::vector<uint32_t>& visible);
+	// in chunks of CHUNK_SIZE spread over the job system, same result as cull
+	void cullParallel(const Frustum& frustum, CullKernel kernel, JobSystem& jobs, std::vector<uint32_t>& visible);
+
+	// objects per job, a multiple of the widest kernel
+	static const uint32_t CHUNK_SIZE = 16384;
+
+private:
+	// padded to a multiple of 8 with spheres that are outside every frustum, so the kernels never need a tail loop
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+	uint32_t count = 0;
+
+	// every chunk compacts into its own range first, then the ranges are packed together
+	std::vector<uint32_t> chunkVisible;
+	std::vector<uint32_t> chunkCounts;
+
+	// culls [begin, end), both multiples of 8, writing visible indices to out. Returns how many it wrote
+	uint32_t cullRange(const Frustum& frustum, CullKernel kernel, uint32_t begin, uint32_t end, uint32_t* out) const;
+	uint32_t getPaddedCount() const { return static_cast<uint32_t>(radius.size()); }
+};
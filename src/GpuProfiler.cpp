@@ -0,0 +1,208 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+void GpuProfiler::init(VkDevice newDevice, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight) {
+	device = newDevice;
+	enabled = true;
+	epoch = BenchClock::now();
+
+	// timestamps need a non-zero valid bit count on the queue family we submit to
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	timestampsSupported = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+	timestampPeriodNs = properties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+
+	slots.resize(framesInFlight);
+	if (!timestampsSupported) {
+		return;
+	}
+
+	for (auto& slot : slots) {
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = MAX_ZONES_PER_FRAME * 2;
+
+		if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &slot.queryPool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create timestamp query pool");
+		}
+	}
+}
+
+void GpuProfiler::destroy() {
+	for (auto& slot : slots) {
+		if (slot.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, slot.queryPool, nullptr);
+		}
+	}
+	slots.clear();
+	enabled = false;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t slot, uint64_t frameIndex) {
+	if (!enabled) {
+		return;
+	}
+
+	currentSlot = slot;
+	currentFrameIndex = frameIndex;
+
+	SlotData& data = slots[slot];
+	collect(data);
+
+	data.zones.clear();
+	data.depth = 0;
+	data.frameIndex = frameIndex;
+	data.pending = true;
+
+	if (timestampsSupported) {
+		vkCmdResetQueryPool(commandBuffer, data.queryPool, 0, MAX_ZONES_PER_FRAME * 2);
+	}
+}
+
+uint32_t GpuProfiler::beginZone(VkCommandBuffer commandBuffer, const char* name) {
+	if (!enabled || !timestampsSupported) {
+		return UINT32_MAX;
+	}
+
+	SlotData& data = slots[currentSlot];
+	if (data.zones.size() >= MAX_ZONES_PER_FRAME) {
+		return UINT32_MAX;
+	}
+
+	uint32_t zone = static_cast<uint32_t>(data.zones.size());
+	data.zones.push_back({name, data.depth++});
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, data.queryPool, zone * 2);
+	return zone;
+}
+
+void GpuProfiler::endZone(VkCommandBuffer commandBuffer, uint32_t zone) {
+	if (zone == UINT32_MAX) {
+		return;
+	}
+
+	SlotData& data = slots[currentSlot];
+	data.depth--;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, data.queryPool, zone * 2 + 1);
+}
+
+void GpuProfiler::markSubmit(uint32_t slot) {
+	if (!enabled) {
+		return;
+	}
+	slots[slot].submitUs = toUs(BenchClock::now());
+}
+
+void GpuProfiler::addCpuZone(const char* name, BenchClock::time_point start, BenchClock::time_point end) {
+	if (!enabled || events.size() >= MAX_EVENTS) {
+		return;
+	}
+	events.push_back({name, currentFrameIndex, toUs(start), elapsedMs(start, end) * 1000.0, 0, false});
+}
+
+void GpuProfiler::flush() {
+	for (auto& slot : slots) {
+		collect(slot);
+	}
+}
+
+double GpuProfiler::toUs(BenchClock::time_point t) const {
+	return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+void GpuProfiler::collect(SlotData& slot) {
+	if (!slot.pending) {
+		return;
+	}
+	slot.pending = false;
+
+	if (slot.zones.empty() || !timestampsSupported) {
+		return;
+	}
+
+	// value + availability word per query; no WAIT bit, anything not finished yet is just dropped
+	uint32_t queryCount = static_cast<uint32_t>(slot.zones.size()) * 2;
+	std::vector<uint64_t> results(queryCount * 2);
+	vkGetQueryPoolResults(device, slot.queryPool, 0, queryCount, results.size() * sizeof(uint64_t), results.data(),
+	                      2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	double frameGpuStartUs = -1.0;
+	for (size_t i = 0; i < slot.zones.size() && events.size() < MAX_EVENTS; i++) {
+		const uint64_t* begin = &results[i * 4];
+		const uint64_t* end = &results[i * 4 + 2];
+		if (begin[1] == 0 || end[1] == 0) {
+			continue;
+		}
+
+		double startUs = (begin[0] & timestampMask) * timestampPeriodNs / 1000.0;
+		double endUs = (end[0] & timestampMask) * timestampPeriodNs / 1000.0;
+		events.push_back({slot.zones[i].name, slot.frameIndex, startUs, std::max(endUs - startUs, 0.0), slot.zones[i].depth, true});
+
+		if (frameGpuStartUs < 0.0 || startUs < frameGpuStartUs) {
+			frameGpuStartUs = startUs;
+		}
+	}
+
+	if (frameGpuStartUs >= 0.0) {
+		double offset = frameGpuStartUs - slot.submitUs;
+		gpuToCpuOffsetUs = haveOffset ? std::min(gpuToCpuOffsetUs, offset) : offset;
+		haveOffset = true;
+	}
+}
+
+void GpuProfiler::writeChromeTrace(const std::string& path) const {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	JsonWriter json(file);
+	json.beginObject();
+	json.value("displayTimeUnit", "ms");
+	json.beginArray("traceEvents");
+
+	// name the two tracks
+	const char* trackNames[] = {"CPU", "GPU"};
+	for (uint32_t tid = 0; tid < 2; tid++) {
+		json.beginObject();
+		json.value("name", "thread_name");
+		json.value("ph", "M");
+		json.value("pid", 1);
+		json.value("tid", tid + 1);
+		json.beginObject("args");
+		json.value("name", trackNames[tid]);
+		json.endObject();
+		json.endObject();
+	}
+
+	// GPU timestamps are moved onto the CPU clock with the tightest submit-to-start offset observed,
+	// which is an approximation but good enough to see how far the GPU trails the CPU
+	for (const auto& event : events) {
+		json.beginObject();
+		json.value("name", event.name);
+		json.value("ph", "X");
+		json.value("pid", 1);
+		json.value("tid", event.gpu ? 2 : 1);
+		json.value("ts", event.gpu ? event.startUs - gpuToCpuOffsetUs : event.startUs);
+		json.value("dur", event.durationUs);
+		json.beginObject("args");
+		json.value("frame", event.frameIndex);
+		json.value("depth", event.depth);
+		json.endObject();
+		json.endObject();
+	}
+
+	json.endArray();
+	json.endObject();
+}
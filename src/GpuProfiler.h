@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "Benchmark.h"
+
+// Timestamp-query profiler. Every frame slot owns a VkQueryPool; zones recorded into a slot's command buffer
+// are read back the next time that slot comes around (its fence has already been waited on, so the results
+// are there without stalling). GPU zones and CPU zones are exported together as a Chrome trace.
+class GpuProfiler {
+public:
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t framesInFlight);
+	void destroy();
+
+	bool isEnabled() const { return enabled; }
+	bool hasGpuTimestamps() const { return timestampsSupported; }
+
+	// - GPU side, all called while recording the given slot's command buffer
+	// collects the slot's previous results and resets its queries, must be recorded outside a render pass
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t slot, uint64_t frameIndex);
+	// zone names must outlive the profiler (string literals)
+	uint32_t beginZone(VkCommandBuffer commandBuffer, const char* name);
+	void endZone(VkCommandBuffer commandBuffer, uint32_t zone);
+	// CPU time the slot was handed to vkQueueSubmit, used to line the GPU clock up with the CPU clock
+	void markSubmit(uint32_t slot);
+
+	// - CPU side
+	// frame number CPU zones are tagged with from here on
+	void beginCpuFrame(uint64_t frameIndex) { currentFrameIndex = frameIndex; }
+	void addCpuZone(const char* name, BenchClock::time_point start, BenchClock::time_point end);
+
+	// reads back everything still pending, the device must be idle
+	void flush();
+	void writeChromeTrace(const std::string& path) const;
+
+private:
+	static const uint32_t MAX_ZONES_PER_FRAME = 64;
+	static const size_t MAX_EVENTS = 1 << 20;		// stop recording rather than grow without bound on long runs
+
+	struct Zone {
+		const char* name;
+		uint32_t depth;
+	};
+
+	struct SlotData {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		uint64_t frameIndex = 0;
+		double submitUs = 0.0;
+		std::vector<Zone> zones;	// zone i uses queries 2i (begin) and 2i+1 (end)
+		uint32_t depth = 0;
+		bool pending = false;
+	};
+
+	struct TraceEvent {
+		const char* name;
+		uint64_t frameIndex;
+		double startUs;
+		double durationUs;
+		uint32_t depth;
+		bool gpu;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	bool enabled = false;
+	bool timestampsSupported = false;
+	double timestampPeriodNs = 1.0;
+	uint64_t timestampMask = ~0ULL;
+	BenchClock::time_point epoch;
+
+	std::vector<SlotData> slots;
+	uint32_t currentSlot = 0;
+	uint64_t currentFrameIndex = 0;
+	std::vector<TraceEvent> events;
+
+	// smallest (GPU start - CPU submit) seen so far, GPU work can't start before it's submitted
+	double gpuToCpuOffsetUs = 0.0;
+	bool haveOffset = false;
+
+	double toUs(BenchClock::time_point t) const;
+	void collect(SlotData& slot);
+};
+
+// RAII helpers so zones close on every path out of a scope
+class GpuZone {
+public:
+	GpuZone(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name)
+		: profiler(profiler), commandBuffer(commandBuffer), zone(profiler.beginZone(commandBuffer, name)) {}
+	~GpuZone() { profiler.endZone(commandBuffer, zone); }
+
+	GpuZone(const GpuZone&) = delete;
+	GpuZone& operator=(const GpuZone&) = delete;
+
+private:
+	GpuProfiler& profiler;
+	VkCommandBuffer commandBuffer;
+	uint32_t zone;
+};
+
+class CpuZone {
+public:
+	CpuZone(GpuProfiler& profiler, const char* name) : profiler(profiler), name(name), start(BenchClock::now()) {}
+	~CpuZone() { profiler.addCpuZone(name, start, BenchClock::now()); }
+
+	CpuZone(const CpuZone&) = delete;
+	CpuZone& operator=(const CpuZone&) = delete;
+
+private:
+	GpuProfiler& profiler;
+	const char* name;
+	BenchClock::time_point start;
+};
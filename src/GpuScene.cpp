@@ -0,0 +1,259 @@
+#include "GpuScene.h"
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+void GpuScene::init(VkDevice newDevice, DeviceAllocator& newAllocator, BufferUploader& newUploader, uint32_t framesInFlight,
+                    const ShaderCode& cullShader, VkPipelineCache pipelineCache, bool drawIndirectCount) {
+	device = newDevice;
+	allocator = &newAllocator;
+	uploader = &newUploader;
+	frames.resize(framesInFlight);
+
+	// extension commands aren't exported by the loader
+	cmdDrawIndexedIndirectCount = nullptr;
+	if (drawIndirectCount) {
+		cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
+
+	// objects are read by the cull pass and the vertex shader, draws and counts only written by the cull pass
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	for (uint32_t i = 0; i < std::size(bindings); i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(std::size(bindings));
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU scene descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = static_cast<uint32_t>(std::size(bindings)) * framesInFlight;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = framesInFlight;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU scene descriptor pool");
+	}
+
+	std::vector<VkDescriptorSetLayout> setLayouts(framesInFlight, setLayout);
+	std::vector<VkDescriptorSet> sets(framesInFlight);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = framesInFlight;
+	allocInfo.pSetLayouts = setLayouts.data();
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate GPU scene descriptor sets");
+	}
+	for (uint32_t i = 0; i < framesInFlight; i++) {
+		frames[i].set = sets[i];
+	}
+
+	VkPushConstantRange cullRange{};
+	cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	cullRange.offset = 0;
+	cullRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &cullRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create cull pipeline layout");
+	}
+
+	// the same set without push constants, so graphics pipelines don't have to declare the cull pass' range
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &drawLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU scene draw pipeline layout");
+	}
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = cullShader.size;
+	moduleInfo.pCode = cullShader.code;
+
+	VkShaderModule cullModule;
+	if (vkCreateShaderModule(device, &moduleInfo, nullptr, &cullModule) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create shader module");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = cullModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = cullLayout;
+
+	VkResult result = vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &cullPipeline);
+	vkDestroyShaderModule(device, cullModule, nullptr);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create cull pipeline");
+	}
+
+	// an empty scene still has buffers, so the descriptors and the render graph always have something to point at
+	setObjects({});
+}
+
+void GpuScene::destroy() {
+	destroyBuffers();
+	vkDestroyPipeline(device, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(device, drawLayout, nullptr);
+	vkDestroyPipelineLayout(device, cullLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	frames.clear();
+}
+
+void GpuScene::destroyBuffers() {
+	if (objectBuffer != VK_NULL_HANDLE) {
+		allocator->destroyBuffer(objectBuffer, objectAllocation);
+		objectBuffer = VK_NULL_HANDLE;
+	}
+	for (auto& frame : frames) {
+		if (frame.drawBuffer != VK_NULL_HANDLE) {
+			allocator->destroyBuffer(frame.drawBuffer, frame.drawAllocation);
+			allocator->destroyBuffer(frame.countBuffer, frame.countAllocation);
+			frame.drawBuffer = VK_NULL_HANDLE;
+			frame.countBuffer = VK_NULL_HANDLE;
+		}
+	}
+}
+
+void GpuScene::setObjects(const std::vector<DrawItem>& items) {
+	if (objectBuffer != VK_NULL_HANDLE) {
+		vkDeviceWaitIdle(device);
+		destroyBuffers();
+	}
+
+	// batches in order of each mesh's first appearance, then a counting sort of the objects into them
+	batches.clear();
+	std::unordered_map<const Mesh*, uint32_t> batchOfMesh;
+	std::vector<uint32_t> itemBatch(items.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		auto inserted = batchOfMesh.emplace(items[i].mesh, static_cast<uint32_t>(batches.size()));
+		if (inserted.second) {
+			Batch batch;
+			batch.mesh = items[i].mesh;
+			batches.push_back(batch);
+		}
+		itemBatch[i] = inserted.first->second;
+		batches[itemBatch[i]].objectCount++;
+	}
+
+	uint32_t first = 0;
+	for (auto& batch : batches) {
+		batch.firstObject = first;
+		first += batch.objectCount;
+	}
+
+	objectCount = static_cast<uint32_t>(items.size());
+	std::vector<GpuObject> objects(std::max(objectCount, 1u));
+	std::vector<uint32_t> nextInBatch(batches.size(), 0);
+	for (size_t i = 0; i < items.size(); i++) {
+		const Batch& batch = batches[itemBatch[i]];
+		GpuObject& object = objects[batch.firstObject + nextInBatch[itemBatch[i]]++];
+		object.transform = items[i].transform;
+		object.bounds = items[i].mesh->bounds;
+		object.batch = itemBatch[i];
+		object.drawBase = batch.firstObject;
+		object.indexCount = items[i].mesh->indexCount;
+	}
+
+	uploader->uploadBuffer(objects.data(), sizeof(GpuObject) * objects.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	                       objectBuffer, objectAllocation);
+
+	// room for every object to be visible, the counts are cleared with vkCmdFillBuffer every frame
+	VkDeviceSize drawBytes = sizeof(VkDrawIndexedIndirectCommand) * objects.size();
+	VkDeviceSize countBytes = sizeof(uint32_t) * std::max<size_t>(batches.size(), 1);
+	for (auto& frame : frames) {
+		allocator->createBuffer(drawBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.drawBuffer, frame.drawAllocation);
+		allocator->createBuffer(countBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.countBuffer, frame.countAllocation);
+	}
+	writeDescriptors();
+}
+
+void GpuScene::writeDescriptors() {
+	for (auto& frame : frames) {
+		VkDescriptorBufferInfo bufferInfos[3]{};
+		bufferInfos[0].buffer = objectBuffer;
+		bufferInfos[1].buffer = frame.drawBuffer;
+		bufferInfos[2].buffer = frame.countBuffer;
+
+		VkWriteDescriptorSet writes[3]{};
+		for (uint32_t i = 0; i < std::size(writes); i++) {
+			bufferInfos[i].offset = 0;
+			bufferInfos[i].range = VK_WHOLE_SIZE;
+
+			writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[i].dstSet = frame.set;
+			writes[i].dstBinding = i;
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].descriptorCount = 1;
+			writes[i].pBufferInfo = &bufferInfos[i];
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(std::size(writes)), writes, 0, nullptr);
+	}
+}
+
+void GpuScene::recordClearCounts(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+	vkCmdFillBuffer(commandBuffer, frames[frameSlot].countBuffer, 0, VK_WHOLE_SIZE, 0);
+}
+
+void GpuScene::recordCull(VkCommandBuffer commandBuffer, uint32_t frameSlot, const glm::mat4& viewProjection) {
+	if (objectCount == 0) {
+		return;
+	}
+
+	CullConstants constants{};
+	Frustum frustum = Frustum::fromMatrix(viewProjection);
+	std::copy(std::begin(frustum.planes), std::end(frustum.planes), constants.planes);
+	constants.objectCount = objectCount;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout, 0, 1, &frames[frameSlot].set, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+}
+
+void GpuScene::recordDraws(VkCommandBuffer commandBuffer, uint32_t frameSlot) {
+	const FrameResources& frame = frames[frameSlot];
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawLayout, 0, 1, &frame.set, 0, nullptr);
+
+	// the cull pass decides how many of each batch's commands are real, the CPU only knows the upper bound
+	const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+	for (uint32_t i = 0; i < batches.size(); i++) {
+		const Batch& batch = batches[i];
+		VkDeviceSize vertexOffset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &batch.mesh->vertexBuffer, &vertexOffset);
+		vkCmdBindIndexBuffer(commandBuffer, batch.mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		cmdDrawIndexedIndirectCount(commandBuffer, frame.drawBuffer, stride * batch.firstObject, frame.countBuffer,
+		                            sizeof(uint32_t) * i, batch.objectCount, static_cast<uint32_t>(stride));
+	}
+}
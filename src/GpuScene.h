@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include "DeviceAllocator.h"
+#include "BufferUploader.h"
+#include "ShaderLibrary.h"
+#include "Mesh.h"
+
+// one object of the scene as cull.comp and indirect.vert see it (std430)
+struct GpuObject {
+	glm::mat4 transform;
+	glm::vec4 bounds;			// object space bounding sphere, center and radius
+	uint32_t batch = 0;			// the mesh's batch, indexes the draw counts
+	uint32_t drawBase = 0;		// first draw command of the batch
+	uint32_t indexCount = 0;
+	uint32_t padding = 0;
+};
+
+// GPU-driven drawing: the scene lives in a storage buffer, a compute pass culls every object against the frustum
+// and appends the visible ones as indirect draw commands, grouped per mesh. The graphics pass then issues one
+// vkCmdDrawIndexedIndirectCountKHR per mesh, so what the CPU records doesn't depend on the object count.
+// Needs VK_KHR_draw_indirect_count plus the multiDrawIndirect and drawIndirectFirstInstance features.
+class GpuScene {
+public:
+	// drawIndirectCount is whether the device has the extension and features enabled, nothing can be drawn without them
+	void init(VkDevice device, DeviceAllocator& allocator, BufferUploader& uploader, uint32_t framesInFlight,
+	          const ShaderCode& cullShader, VkPipelineCache pipelineCache, bool drawIndirectCount);
+	// the GPU must be done with every frame that used the scene
+	void destroy();
+
+	bool isSupported() const { return cmdDrawIndexedIndirectCount != nullptr; }
+
+	// uploads the objects, grouped into one batch per mesh. Waits for the device when it replaces a scene,
+	// scenes are meant to change rarely (or be updated on the GPU)
+	void setObjects(const std::vector<DrawItem>& items);
+	uint32_t getObjectCount() const { return objectCount; }
+	uint32_t getBatchCount() const { return static_cast<uint32_t>(batches.size()); }
+
+	// graphics pipelines drawing the scene use this layout, the object buffer is set 0 binding 0
+	VkPipelineLayout getDrawLayout() const { return drawLayout; }
+
+	// - per frame slot, each slot has its own draw commands and counts
+	VkBuffer getDrawBuffer(uint32_t frameSlot) const { return frames[frameSlot].drawBuffer; }
+	VkBuffer getCountBuffer(uint32_t frameSlot) const { return frames[frameSlot].countBuffer; }
+
+	// zeroes the slot's draw counts (transfer)
+	void recordClearCounts(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+	// culls against the frustum of viewProjection and writes the slot's draw commands and counts (compute)
+	void recordCull(VkCommandBuffer commandBuffer, uint32_t frameSlot, const glm::mat4& viewProjection);
+	// one indirect count draw per mesh, the pipeline, viewport and scissor have to be set already
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t frameSlot);
+
+	static const uint32_t CULL_GROUP_SIZE = 64;		// local_size_x of cull.comp
+
+private:
+	// objects sharing a mesh, their draws are one contiguous range of the draw buffer
+	struct Batch {
+		const Mesh* mesh = nullptr;
+		uint32_t firstObject = 0;
+		uint32_t objectCount = 0;
+	};
+
+	struct FrameResources {
+		VkBuffer drawBuffer = VK_NULL_HANDLE;		// VkDrawIndexedIndirectCommand per object, compacted per batch
+		Allocation drawAllocation;
+		VkBuffer countBuffer = VK_NULL_HANDLE;		// visible objects per batch
+		Allocation countAllocation;
+		VkDescriptorSet set = VK_NULL_HANDLE;
+	};
+
+	// what cull.comp gets as push constants
+	struct CullConstants {
+		glm::vec4 planes[6];		// inward facing, xyz normalized
+		uint32_t objectCount;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	DeviceAllocator* allocator = nullptr;
+	BufferUploader* uploader = nullptr;
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkPipelineLayout cullLayout = VK_NULL_HANDLE;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout drawLayout = VK_NULL_HANDLE;
+
+	VkBuffer objectBuffer = VK_NULL_HANDLE;
+	Allocation objectAllocation;
+	uint32_t objectCount = 0;
+	std::vector<Batch> batches;
+	std::vector<FrameResources> frames;
+
+	void destroyBuffers();
+	void writeDescriptors();
+};
@@ -0,0 +1,64 @@
+#include "InstanceBatcher.h"
+
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
+// what makes two draw items instanceable together
+struct BatchKey {
+	const Mesh* mesh;
+	uint32_t material;
+
+	bool operator==(const BatchKey& other) const { return mesh == other.mesh && material == other.material; }
+};
+
+struct BatchKeyHash {
+	size_t operator()(const BatchKey& key) const {
+		return std::hash<const Mesh*>()(key.mesh) ^ (std::hash<uint32_t>()(key.material) * 0x9E3779B97F4A7C15ULL);
+	}
+};
+
+void InstanceBatcher::build(const std::vector<DrawItem>& items) {
+	batches.clear();
+
+	// a pass to find the batches and count their instances, then a counting sort of the items into them
+	std::unordered_map<BatchKey, uint32_t, BatchKeyHash> batchOfKey;
+	std::vector<uint32_t> itemBatch(items.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		auto inserted = batchOfKey.emplace(BatchKey{items[i].mesh, items[i].material}, static_cast<uint32_t>(batches.size()));
+		if (inserted.second) {
+			InstanceBatch batch;
+			batch.mesh = items[i].mesh;
+			batch.material = items[i].material;
+			batches.push_back(batch);
+		}
+		itemBatch[i] = inserted.first->second;
+		batches[itemBatch[i]].instanceCount++;
+	}
+
+	uint32_t first = 0;
+	for (auto& batch : batches) {
+		batch.firstInstance = first;
+		first += batch.instanceCount;
+	}
+
+	itemOfInstance.resize(items.size());
+	std::vector<uint32_t> nextInBatch(batches.size(), 0);
+	for (size_t i = 0; i < items.size(); i++) {
+		const InstanceBatch& batch = batches[itemBatch[i]];
+		itemOfInstance[batch.firstInstance + nextInBatch[itemBatch[i]]++] = static_cast<uint32_t>(i);
+	}
+}
+
+void InstanceBatcher::writeInstances(const std::vector<DrawItem>& items, InstanceData* instances, JobSystem& jobs) const {
+	// straight into the streaming memory, each job writes one contiguous range
+	jobs.parallelFor(getInstanceCount(), 16384, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t instance = begin; instance < end; instance++) {
+			const DrawItem& item = items[itemOfInstance[instance]];
+			InstanceData data{};
+			data.transform = item.transform;
+			data.material = item.material;
+			memcpy(&instances[instance], &data, sizeof(data));
+		}
+	});
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+#include "JobSystem.h"
+
+// one instanced draw, every instance shares the mesh and the material
+struct InstanceBatch {
+	const Mesh* mesh = nullptr;
+	uint32_t material = 0;
+	uint32_t firstInstance = 0;		// into the frame's instance stream
+	uint32_t instanceCount = 0;
+};
+
+// Groups draw items that share a mesh and material into instanced draws, so the draw count follows the number
+// of unique pairs instead of the number of objects. The grouping is only rebuilt when the scene changes;
+// every frame just writes the instance data, batch by batch, into the per-instance vertex stream.
+class InstanceBatcher {
+public:
+	// O(items), batches are in the order each pair first shows up in
+	void build(const std::vector<DrawItem>& items);
+
+	// one InstanceData per item in batch order, split into jobs. instances needs room for getInstanceCount()
+	void writeInstances(const std::vector<DrawItem>& items, InstanceData* instances, JobSystem& jobs) const;
+
+	const std::vector<InstanceBatch>& getBatches() const { return batches; }
+	uint32_t getInstanceCount() const { return static_cast<uint32_t>(itemOfInstance.size()); }
+
+private:
+	std::vector<InstanceBatch> batches;
+	std::vector<uint32_t> itemOfInstance;	// draw item each slot of the instance stream is filled from
+};
@@ -0,0 +1,343 @@
+#include "JobSystem.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// which job system (if any) owns the current thread, and as which worker
+static thread_local const JobSystem* currentSystem = nullptr;
+static thread_local uint32_t currentWorker = 0;
+
+static void pinCurrentThread(uint32_t core) {
+#ifdef _WIN32
+	SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void JobStats::writeJson(JsonWriter& json) const {
+	json.value("executed", executed);
+	json.value("stolen", stolen);
+	json.value("steal_attempts", stealAttempts);
+	json.value("steal_conflicts", stealConflicts);
+	json.value("pop_conflicts", popConflicts);
+	json.value("sleeps", sleeps);
+}
+
+bool JobSystem::WorkDeque::push(Job* job) {
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= static_cast<int64_t>(MAX_JOBS_PER_WORKER)) {
+		return false;
+	}
+
+	buffer[b & (MAX_JOBS_PER_WORKER - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Job* JobSystem::WorkDeque::pop(bool& conflict) {
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b) {
+		// empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job* job = buffer[b & (MAX_JOBS_PER_WORKER - 1)].load(std::memory_order_relaxed);
+	if (t == b) {
+		// last job, thieves may be going for it too
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			job = nullptr;
+			conflict = true;
+		}
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+Job* JobSystem::WorkDeque::steal(bool& conflict) {
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b) {
+		return nullptr;
+	}
+
+	Job* job = buffer[t & (MAX_JOBS_PER_WORKER - 1)].load(std::memory_order_relaxed);
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		conflict = true;
+		return nullptr;
+	}
+	return job;
+}
+
+void JobSystem::init(uint32_t workerCount, bool pinThreads) {
+	destroy();
+
+	if (workerCount == 0) {
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	ownerThread = std::this_thread::get_id();
+	stopping = false;
+	queuedJobs = 0;
+
+	for (uint32_t i = 0; i < workerCount; i++) {
+		auto worker = std::make_unique<Worker>();
+		worker->jobs.reset(new Job[MAX_JOBS_PER_WORKER]);
+		worker->random = 0x9E3779B9u * (i + 1);
+		workers.push_back(std::move(worker));
+	}
+
+	if (pinThreads) {
+		pinCurrentThread(0);
+	}
+	for (uint32_t i = 1; i < workerCount; i++) {
+		threads.emplace_back([this, i, pinThreads]() {
+			if (pinThreads) {
+				pinCurrentThread(i);
+			}
+			threadMain(i);
+		});
+	}
+}
+
+void JobSystem::destroy() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+	workers.clear();
+}
+
+uint32_t JobSystem::getCurrentWorker() const {
+	if (currentSystem == this) {
+		return currentWorker;
+	}
+	if (std::this_thread::get_id() == ownerThread) {
+		return 0;
+	}
+	throw std::runtime_error("Failed to find job worker: called from a thread the job system doesn't own");
+}
+
+void JobSystem::run(JobCounter& counter, std::function<void()> task) {
+	uint32_t worker = getCurrentWorker();
+	submit(worker, allocateJob(worker, counter, std::move(task)));
+}
+
+void JobSystem::runAfter(JobCounter& dependency, JobCounter& counter, std::function<void()> task) {
+	if (dependency.isDone()) {
+		run(counter, std::move(task));
+		return;
+	}
+
+	run(counter, [this, &dependency, task = std::move(task)]() {
+		wait(dependency);
+		task();
+	});
+}
+
+void JobSystem::wait(JobCounter& counter) {
+	uint32_t worker = getCurrentWorker();
+
+	while (!counter.isDone()) {
+		if (Job* job = findJob(worker)) {
+			execute(worker, job);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+
+	if (counter.failed.load(std::memory_order_relaxed)) {
+		std::exception_ptr error = counter.error;
+		counter.error = nullptr;
+		counter.failed = false;
+		std::rethrow_exception(error);
+	}
+}
+
+void JobSystem::parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& body) {
+	if (count == 0) {
+		return;
+	}
+
+	JobCounter counter;
+	spawnRange(counter, 0, count, std::max(grainSize, 1u), &body);
+	wait(counter);
+}
+
+void JobSystem::spawnRange(JobCounter& counter, uint32_t begin, uint32_t end, uint32_t grainSize,
+                           const std::function<void(uint32_t, uint32_t)>* body) {
+	// each job keeps halving its range and hands the upper half off, so thieves always grab big pieces
+	// and a split costs O(log n) jobs on the critical path
+	run(counter, [this, &counter, begin, end, grainSize, body]() {
+		uint32_t last = end;
+		while (last - begin > grainSize) {
+			uint32_t middle = begin + (last - begin) / 2;
+			spawnRange(counter, middle, last, grainSize, body);
+			last = middle;
+		}
+		(*body)(begin, last);
+	});
+}
+
+JobStats JobSystem::getStats() const {
+	JobStats total;
+	for (const auto& worker : workers) {
+		total.executed += worker->stats.executed;
+		total.stolen += worker->stats.stolen;
+		total.stealAttempts += worker->stats.stealAttempts;
+		total.stealConflicts += worker->stats.stealConflicts;
+		total.popConflicts += worker->stats.popConflicts;
+		total.sleeps += worker->stats.sleeps;
+	}
+	return total;
+}
+
+void JobSystem::resetStats() {
+	for (auto& worker : workers) {
+		worker->stats = JobStats();
+	}
+}
+
+Job* JobSystem::allocateJob(uint32_t worker, JobCounter& counter, std::function<void()>&& task) {
+	// jobs finish roughly in order, so the next slot is almost always free; long-running ones (the upper
+	// halves of a parallelFor split) are simply skipped over
+	Worker& owner = *workers[worker];
+	Job* job = nullptr;
+	for (uint32_t probe = 0; probe < MAX_JOBS_PER_WORKER && job == nullptr; probe++) {
+		Job* candidate = &owner.jobs[owner.nextJob++ & (MAX_JOBS_PER_WORKER - 1)];
+		if (!candidate->inUse.load(std::memory_order_acquire)) {
+			job = candidate;
+		}
+	}
+	if (job == nullptr) {
+		throw std::runtime_error("Failed to allocate job: too many jobs outstanding on one worker");
+	}
+
+	job->inUse.store(true, std::memory_order_relaxed);
+	job->task = std::move(task);
+	job->counter = &counter;
+	counter.pending.fetch_add(1, std::memory_order_relaxed);
+	return job;
+}
+
+void JobSystem::submit(uint32_t worker, Job* job) {
+	// a full deque means plenty of queued work already, just do this one now
+	if (!workers[worker]->deque.push(job)) {
+		execute(worker, job);
+		return;
+	}
+
+	queuedJobs.fetch_add(1);
+	if (sleepingWorkers.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+Job* JobSystem::findJob(uint32_t worker) {
+	Worker& self = *workers[worker];
+
+	bool conflict = false;
+	Job* job = self.deque.pop(conflict);
+	self.stats.popConflicts += conflict;
+
+	// own deque is empty, try everyone else starting at a random victim
+	uint32_t count = getWorkerCount();
+	for (uint32_t i = 0; job == nullptr && i + 1 < count; i++) {
+		self.random ^= self.random << 13;
+		self.random ^= self.random >> 17;
+		self.random ^= self.random << 5;
+		uint32_t victim = self.random % count;
+		if (victim == worker) {
+			continue;
+		}
+
+		conflict = false;
+		job = workers[victim]->deque.steal(conflict);
+		self.stats.stealAttempts++;
+		self.stats.stealConflicts += conflict;
+		self.stats.stolen += job != nullptr;
+	}
+
+	if (job != nullptr) {
+		queuedJobs.fetch_sub(1);
+	}
+	return job;
+}
+
+void JobSystem::execute(uint32_t worker, Job* job) {
+	try {
+		job->task();
+	}
+	catch (...) {
+		// only the first one is kept, the counter's pending count publishes it to the waiter
+		bool expected = false;
+		if (job->counter->failed.compare_exchange_strong(expected, true)) {
+			job->counter->error = std::current_exception();
+		}
+	}
+	workers[worker]->stats.executed++;
+
+	// the job goes back to its owner's ring before the counter drops, so a waiter that wakes up and submits
+	// again never finds it still in use. The counter may be gone as soon as it drops to zero
+	JobCounter* counter = job->counter;
+	job->task = nullptr;
+	job->inUse.store(false, std::memory_order_release);
+	counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void JobSystem::threadMain(uint32_t worker) {
+	currentSystem = this;
+	currentWorker = worker;
+
+	uint32_t idleSpins = 0;
+	while (!stopping.load(std::memory_order_relaxed)) {
+		if (Job* job = findJob(worker)) {
+			execute(worker, job);
+			idleSpins = 0;
+			continue;
+		}
+
+		// spin briefly before sleeping, work usually arrives in bursts
+		if (++idleSpins < 64) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		sleepingWorkers++;
+		workers[worker]->stats.sleeps++;
+		wake.wait(lock, [this]() { return stopping.load() || queuedJobs.load() > 0; });
+		sleepingWorkers--;
+		idleSpins = 0;
+	}
+
+	currentSystem = nullptr;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JsonWriter;
+
+class JobCounter;
+
+// slot in a worker's job ring, only used by JobSystem
+struct Job {
+	std::function<void()> task;
+	JobCounter* counter = nullptr;
+	std::atomic<bool> inUse{false};
+};
+
+// counts the jobs that still have to finish, wait on it or chain jobs after it with runAfter.
+// Must outlive every job counted by it and every runAfter depending on it
+class JobCounter {
+public:
+	bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<uint32_t> pending{0};
+
+	// first exception thrown by a counted job, rethrown by wait
+	std::atomic<bool> failed{false};
+	std::exception_ptr error;
+};
+
+struct JobStats {
+	uint64_t executed = 0;
+	uint64_t stolen = 0;			// jobs taken from another worker's deque
+	uint64_t stealAttempts = 0;		// looked at a victim's deque
+	uint64_t stealConflicts = 0;	// lost the race for a job to its owner or another thief
+	uint64_t popConflicts = 0;		// owner lost the last job in its deque to a thief
+	uint64_t sleeps = 0;			// went idle on the condition variable
+
+	// writes the fields as members of the currently open JSON object
+	void writeJson(JsonWriter& json) const;
+};
+
+// Work-stealing job scheduler. Every worker owns a Chase-Lev deque: it pushes and pops at the bottom (LIFO,
+// cache friendly), idle workers steal from the top of others' deques (FIFO, takes the biggest pieces of split work).
+// The thread that calls init is worker 0 and only runs jobs while it waits; jobs may only be submitted
+// from it or from inside jobs.
+class JobSystem {
+public:
+	// workerCount 0 means one per hardware thread, pinThreads binds worker i to core i
+	void init(uint32_t workerCount, bool pinThreads = false);
+	void destroy();
+	~JobSystem() { destroy(); }
+
+	void run(JobCounter& counter, std::function<void()> task);
+	// task only starts once dependency has finished, counter tracks it like run.
+	// The job helps with other work until then rather than blocking its worker
+	void runAfter(JobCounter& dependency, JobCounter& counter, std::function<void()> task);
+	// runs other jobs until counter is done, then rethrows the first exception one of its jobs threw
+	void wait(JobCounter& counter);
+
+	// body(begin, end) over [0, count), ranges are split in half until they're at most grainSize long
+	void parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& body);
+
+	uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+	// index of the calling worker, for per-worker scratch data
+	uint32_t getCurrentWorker() const;
+
+	// summed over all workers, only exact while no jobs are running
+	JobStats getStats() const;
+	void resetStats();
+
+	// per worker, so one spawner can have this many jobs outstanding
+	static const uint32_t MAX_JOBS_PER_WORKER = 4096;
+
+private:
+	// fixed size Chase-Lev deque ("Correct and Efficient Work-Stealing for Weak Memory Models", Le et al. 2013)
+	class WorkDeque {
+	public:
+		bool push(Job* job);
+		Job* pop(bool& conflict);
+		Job* steal(bool& conflict);
+
+	private:
+		alignas(64) std::atomic<int64_t> top{0};
+		alignas(64) std::atomic<int64_t> bottom{0};
+		std::atomic<Job*> buffer[MAX_JOBS_PER_WORKER];
+	};
+
+	// everything one worker owns, on its own cache lines
+	struct alignas(64) Worker {
+		WorkDeque deque;
+		std::unique_ptr<Job[]> jobs;	// ring the worker allocates its jobs from, freed by whoever ran them
+		uint32_t nextJob = 0;
+		uint32_t random = 0;			// xorshift state for picking steal victims
+		JobStats stats;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::thread::id ownerThread;
+
+	// idle workers sleep here until something is queued
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<uint32_t> queuedJobs{0};
+	std::atomic<uint32_t> sleepingWorkers{0};
+	std::atomic<bool> stopping{false};
+
+	Job* allocateJob(uint32_t worker, JobCounter& counter, std::function<void()>&& task);
+	void submit(uint32_t worker, Job* job);
+	Job* findJob(uint32_t worker);
+	void execute(uint32_t worker, Job* job);
+	void threadMain(uint32_t worker);
+	void spawnRange(JobCounter& counter, uint32_t begin, uint32_t end, uint32_t grainSize,
+	                const std::function<void(uint32_t, uint32_t)>* body);
+};
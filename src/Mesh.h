@@ -0,0 +1,131 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include "DeviceAllocator.h"
+
+struct Vertex {
+	glm::vec3 position;
+	glm::vec3 color;
+
+	// one interleaved vertex buffer at binding 0
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(Vertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	// locations match shader.vert
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(Vertex, position);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(Vertex, color);
+		return attributeDescriptions;
+	}
+
+	// - position-only stream (Mesh::positionBuffer), all the depth prepass fetches
+	static VkVertexInputBindingDescription getPositionBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(glm::vec3);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	// location matches depth.vert
+	static VkVertexInputAttributeDescription getPositionAttributeDescription() {
+		VkVertexInputAttributeDescription attributeDescription{};
+		attributeDescription.binding = 0;
+		attributeDescription.location = 0;
+		attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescription.offset = 0;
+		return attributeDescription;
+	}
+};
+
+// per-instance vertex stream of instanced draws, one per object, streamed every frame (binding 1 in instanced.vert)
+struct InstanceData {
+	glm::mat4 transform;
+	uint32_t material;
+	uint32_t padding[3];		// keeps the stride a multiple of 16
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return bindingDescription;
+	}
+
+	// the matrix takes a location per column (2-5), the material index follows at 6
+	static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions{};
+		for (uint32_t column = 0; column < 4; column++) {
+			attributeDescriptions[column].binding = 1;
+			attributeDescriptions[column].location = 2 + column;
+			attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[column].offset = offsetof(InstanceData, transform) + sizeof(glm::vec4) * column;
+		}
+
+		attributeDescriptions[4].binding = 1;
+		attributeDescriptions[4].location = 6;
+		attributeDescriptions[4].format = VK_FORMAT_R32_UINT;
+		attributeDescriptions[4].offset = offsetof(InstanceData, material);
+		return attributeDescriptions;
+	}
+};
+
+// per-draw uniform data, streamed every frame (set 0, binding 0 in shader.vert)
+struct DrawConstants {
+	glm::mat4 transform;
+};
+
+// per-material switches of material.frag, pushed (fragment stage, offset 0) before its draws. Pipelines built
+// with the MaterialConstant specialization constants have them compiled in and ignore the pushed switches
+struct MaterialConstants {
+	uint32_t lightingModel = 0;		// 0 unlit, 1 lambert, 2 lambert plus specular
+	uint32_t alphaTest = 0;
+	uint32_t shadingLoops = 1;
+	float alphaCutoff = 0.5f;		// always read from here, it's a value rather than a switch
+};
+
+// constant_ids in material.frag
+enum class MaterialConstant : uint32_t {
+	Specialized,		// the switches below replace MaterialConstants' when set
+	LightingModel,
+	AlphaTest,
+	ShadingLoops
+};
+
+// device local vertex + index buffers of one piece of geometry
+struct Mesh {
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	Allocation vertexAllocation;
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	Allocation indexAllocation;
+	VkBuffer positionBuffer = VK_NULL_HANDLE;	// positions only, for the depth prepass
+	Allocation positionAllocation;
+	uint32_t indexCount = 0;
+	glm::vec4 bounds = glm::vec4(0.0f);		// bounding sphere in object space, center and radius
+};
+
+// one draw of the scene
+struct DrawItem {
+	const Mesh* mesh = nullptr;
+	glm::mat4 transform = glm::mat4(1.0f);
+	uint32_t material = 0;		// picks the tint in instanced.vert, items sharing mesh and material are instanced together
+};
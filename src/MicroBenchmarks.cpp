@@ -0,0 +1,1349 @@
+#include "VulkanRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <stdexcept>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "TransformHierarchy.h"
+
+// --microbench <name> runs one of these after initialisation instead of the render loop
+
+// 1, 2, 4, ... below count, then count itself
+static std::vector<uint32_t> powersOfTwoUpTo(uint32_t count) {
+	std::vector<uint32_t> counts;
+	for (uint32_t n = 1; n < count; n *= 2) {
+		counts.push_back(n);
+	}
+	counts.push_back(count);
+	return counts;
+}
+
+VulkanRenderer::ScopedBenchmarkState::ScopedBenchmarkState(VulkanRenderer& renderer)
+	: renderer(renderer), drawItems(renderer.drawItems),
+	  gpuDriven(renderer.settings.gpuDriven), instancing(renderer.settings.instancing),
+	  depthPrepass(renderer.settings.depthPrepass), frustumCulling(renderer.settings.frustumCulling),
+	  asyncPipelines(renderer.settings.asyncPipelines), incrementalRecording(renderer.settings.incrementalRecording),
+	  gpuSceneVersion(renderer.gpuSceneVersion),
+	  materialDescs(renderer.materialPipelineDescs), materialConstants(renderer.materialConstants) {
+}
+
+VulkanRenderer::ScopedBenchmarkState::~ScopedBenchmarkState() {
+	// destructors are noexcept, so a failed restore is reported rather than terminating the run
+	try {
+		// benchmarks that record without submitting leave nothing in flight, the rest drain before they return
+		renderer.pipelineRegistry.waitIdle();
+		renderer.clearMaterialPipelines();
+		renderer.drawItems = drawItems;
+		renderer.invalidateScene();
+		renderer.setGpuDriven(gpuDriven);
+		renderer.setInstancing(instancing);
+		renderer.setDepthPrepass(depthPrepass);
+		renderer.setFrustumCulling(frustumCulling);
+		renderer.setAsyncPipelines(asyncPipelines);
+		renderer.settings.incrementalRecording = incrementalRecording;
+		for (uint32_t material = 0; material < materialDescs.size(); material++) {
+			if (!materialDescs[material].vertexShader.empty()) {
+				renderer.setMaterialPipeline(material, materialDescs[material], materialConstants[material]);
+			}
+		}
+
+		// a benchmark's GPU scene can be far bigger than the real one, shrink it back right away rather than on the
+		// next GPU-driven frame
+		if (renderer.supportsGpuDriven() && renderer.gpuSceneVersion != gpuSceneVersion) {
+			renderer.gpuScene.setObjects(renderer.drawItems);
+			renderer.gpuSceneVersion = renderer.sceneVersion;
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "benchmark: failed to restore renderer state: " << e.what() << std::endl;
+	}
+}
+
+void VulkanRenderer::measureFrames(uint32_t warmupFrames, uint32_t measuredFrames, FrameSample& sample) {
+	for (uint32_t i = 0; i < warmupFrames; i++) {
+		drawFrame();
+	}
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	std::vector<double> frameRecordMs;
+	auto start = BenchClock::now();
+	for (uint32_t i = 0; i < measuredFrames; i++) {
+		drawFrame();
+		frameRecordMs.push_back(lastFrameTimings.recordMs);
+	}
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	sample.frameMs = elapsedMs(start, BenchClock::now()) / measuredFrames;
+	sample.recordMs = computeStats(frameRecordMs).p50;
+	sample.drawCalls = lastFrameTimings.drawCalls;
+}
+
+void VulkanRenderer::runMicroBenchmark(const std::string& name, JsonWriter& json) {
+	json.value("benchmark", name);
+
+	if (name == "allocator") {
+		benchmarkAllocator(json);
+	} else if (name == "upload") {
+		benchmarkUpload(json);
+	} else if (name == "streaming") {
+		benchmarkStreaming(json);
+	} else if (name == "recording") {
+		benchmarkRecording(json);
+	} else if (name == "jobs") {
+		benchmarkJobs(json);
+	} else if (name == "rendergraph") {
+		benchmarkRenderGraph(json);
+	} else if (name == "rendering") {
+		benchmarkRendering(json);
+	} else if (name == "depthprepass") {
+		benchmarkDepthPrepass(json);
+	} else if (name == "gpudriven") {
+		benchmarkGpuDriven(json);
+	} else if (name == "instancing") {
+		benchmarkInstancing(json);
+	} else if (name == "culling") {
+		benchmarkCulling(json);
+	} else if (name == "transforms") {
+		benchmarkTransforms(json);
+	} else if (name == "pipelines") {
+		benchmarkPipelines(json);
+	} else if (name == "asyncpipelines") {
+		benchmarkAsyncPipelines(json);
+	} else if (name == "specialization") {
+		benchmarkSpecialization(json);
+	} else {
+		throw std::runtime_error("Unknown micro benchmark " + name);
+	}
+}
+
+void VulkanRenderer::benchmarkAllocator(JsonWriter& json) {
+	const uint32_t operations = 200000;
+	const size_t maxLive = 4096;
+
+	// same request stream for every run: sizes log-uniform from 256B to 2MB, mixed alignments and resource kinds
+	struct Request {
+		VkMemoryRequirements requirements;
+		ResourceKind kind;
+	};
+	std::mt19937 rng(42);
+	auto makeRequest = [&rng]() {
+		Request request;
+		request.requirements.size = 256ULL << (rng() % 13);
+		request.requirements.size += rng() % request.requirements.size;
+		request.requirements.alignment = 16ULL << (rng() % 9);
+		request.requirements.memoryTypeBits = ~0u;
+		request.kind = rng() % 2 ? ResourceKind::Linear : ResourceKind::Optimal;
+		return request;
+	};
+
+	// sub-allocator: random interleaving of allocations and frees with up to maxLive allocations alive
+	std::vector<Allocation> live;
+	live.reserve(maxLive);
+	AllocatorStats peakStats;
+	uint32_t allocations = 0;
+
+	auto start = BenchClock::now();
+	for (uint32_t i = 0; i < operations; i++) {
+		if (live.empty() || (live.size() < maxLive && rng() % 2)) {
+			Request request = makeRequest();
+			live.push_back(allocator.allocate(request.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, request.kind));
+			allocations++;
+		} else {
+			size_t index = rng() % live.size();
+			allocator.free(live[index]);
+			live[index] = live.back();
+			live.pop_back();
+		}
+
+		if (i == operations / 2) {
+			peakStats = allocator.getStats();
+		}
+	}
+	double subAllocMs = elapsedMs(start, BenchClock::now());
+
+	for (auto& allocation : live) {
+		allocator.free(allocation);
+	}
+
+	// the driver for comparison, kept well below maxMemoryAllocationCount
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+	uint32_t driverCount = std::min(1000u, properties.limits.maxMemoryAllocationCount / 4);
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(mainDevice.physicalDevice, &memoryProperties);
+	uint32_t memoryType = 0;
+	while (memoryType < memoryProperties.memoryTypeCount
+		&& !(memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+		memoryType++;
+	}
+
+	std::vector<VkDeviceMemory> driverAllocations;
+	driverAllocations.reserve(driverCount);
+	rng.seed(42);
+	start = BenchClock::now();
+	for (uint32_t i = 0; i < driverCount; i++) {
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = makeRequest().requirements.size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(mainDevice.logicalDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+			break;
+		}
+		driverAllocations.push_back(memory);
+	}
+	for (auto memory : driverAllocations) {
+		vkFreeMemory(mainDevice.logicalDevice, memory, nullptr);
+	}
+	double driverMs = elapsedMs(start, BenchClock::now());
+
+	json.beginObject("sub_allocator");
+	json.value("operations", operations);
+	json.value("allocations", allocations);
+	json.value("total_ms", subAllocMs);
+	json.value("ops_per_s", subAllocMs > 0.0 ? operations / (subAllocMs / 1000.0) : 0.0);
+	json.beginObject("midpoint");
+	peakStats.writeJson(json);
+	json.endObject();
+	json.endObject();
+
+	// each driver allocation is one allocate plus one free
+	uint32_t driverOperations = static_cast<uint32_t>(driverAllocations.size()) * 2;
+	json.beginObject("driver");
+	json.value("operations", driverOperations);
+	json.value("total_ms", driverMs);
+	json.value("ops_per_s", driverMs > 0.0 ? driverOperations / (driverMs / 1000.0) : 0.0);
+	json.endObject();
+
+	json.beginObject("after_free");
+	allocator.getStats().writeJson(json);
+	json.endObject();
+}
+
+void VulkanRenderer::benchmarkUpload(JsonWriter& json) {
+	const VkDeviceSize sizes[] = {1ULL << 20, 16ULL << 20, 64ULL << 20, 256ULL << 20};
+	const uint32_t repeats = 3;
+
+	QueueFamilyIndices indices = findQueueFamilies(mainDevice.physicalDevice);
+	json.value("transfer_queue", uploader.usesTransferQueue());
+	json.value("transfer_family", static_cast<uint64_t>(indices.transferFamily.value()));
+	// a DMA queue, rather than a compute family standing in for one
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &familyCount, families.data());
+	json.value("transfer_only", !(families[indices.transferFamily.value()].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)));
+	json.value("graphics_family", static_cast<uint64_t>(indices.graphicsFamily.value()));
+	json.value("staging_bytes", static_cast<uint64_t>(BufferUploader::STAGING_SIZE));
+
+	// vertex data stand-in, the contents don't matter for the copy
+	std::vector<uint8_t> data(static_cast<size_t>(sizes[std::size(sizes) - 1]));
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = static_cast<uint8_t>(i * 31);
+	}
+
+	json.beginArray("uploads");
+	for (VkDeviceSize size : sizes) {
+		// each upload includes creating the device local buffer, like loading a mesh would
+		std::vector<double> uploadMs;
+		for (uint32_t i = 0; i < repeats; i++) {
+			VkBuffer buffer;
+			Allocation allocation;
+			auto start = BenchClock::now();
+			uploader.uploadBuffer(data.data(), size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, buffer, allocation);
+			uploadMs.push_back(elapsedMs(start, BenchClock::now()));
+			allocator.destroyBuffer(buffer, allocation);
+		}
+
+		SampleStats stats = computeStats(uploadMs);
+		double megabytes = static_cast<double>(size) / (1024.0 * 1024.0);
+
+		json.beginObject();
+		json.value("bytes", static_cast<uint64_t>(size));
+		json.value("repeats", static_cast<uint64_t>(repeats));
+		json.stats("upload_ms", stats);
+		json.value("mb_per_s", stats.p50 > 0.0 ? megabytes / (stats.p50 / 1000.0) : 0.0);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkStreaming(JsonWriter& json) {
+	const uint32_t drawCounts[] = {1000, 10000, 50000};
+	const uint32_t frameCount = 20;
+
+	auto makeConstants = [](uint32_t draw) {
+		DrawConstants constants{};
+		constants.transform = glm::mat4(1.0f);
+		constants.transform[3][0] = static_cast<float>(draw);
+		return constants;
+	};
+
+	json.beginArray("runs");
+	for (uint32_t draws : drawCounts) {
+		// streaming: one bump allocation + write per draw, the region is recycled every frame.
+		// 256 is the largest minUniformBufferOffsetAlignment the spec allows
+		StreamingBuffer stream;
+		stream.init(mainDevice.logicalDevice, mainDevice.physicalDevice, allocator,
+		            static_cast<VkDeviceSize>(draws) * std::max<VkDeviceSize>(sizeof(DrawConstants), 256), settings.framesInFlight);
+
+		std::vector<double> streamingMs;
+		for (uint32_t frame = 0; frame < frameCount; frame++) {
+			auto start = BenchClock::now();
+			stream.beginFrame(frame % settings.framesInFlight);
+			for (uint32_t draw = 0; draw < draws; draw++) {
+				stream.push(makeConstants(draw));
+			}
+			streamingMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+		stream.destroy();
+
+		// per-draw buffers: a VkBuffer + sub-allocation per draw, freed when the frame is over
+		std::vector<VkBuffer> buffers(draws);
+		std::vector<Allocation> allocations(draws);
+		std::vector<double> perDrawMs;
+		for (uint32_t frame = 0; frame < frameCount; frame++) {
+			auto start = BenchClock::now();
+			for (uint32_t draw = 0; draw < draws; draw++) {
+				allocator.createBuffer(sizeof(DrawConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				                       buffers[draw], allocations[draw]);
+				*static_cast<DrawConstants*>(allocations[draw].mapped) = makeConstants(draw);
+			}
+			for (uint32_t draw = 0; draw < draws; draw++) {
+				allocator.destroyBuffer(buffers[draw], allocations[draw]);
+			}
+			perDrawMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+
+		SampleStats streaming = computeStats(streamingMs);
+		SampleStats perDraw = computeStats(perDrawMs);
+
+		json.beginObject();
+		json.value("draws", static_cast<uint64_t>(draws));
+		json.value("frames", static_cast<uint64_t>(frameCount));
+		json.stats("streaming_frame_ms", streaming);
+		json.stats("per_draw_buffers_frame_ms", perDraw);
+		json.value("streaming_ns_per_draw", streaming.p50 * 1e6 / draws);
+		json.value("per_draw_buffers_ns_per_draw", perDraw.p50 * 1e6 / draws);
+		json.value("speedup", streaming.p50 > 0.0 ? perDraw.p50 / streaming.p50 : 0.0);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkRecording(JsonWriter& json) {
+	const uint32_t drawCounts[] = {10000, 50000, 100000};
+	const uint32_t repeats = 10;
+
+	// powers of two up to the job system's worker count, and the worker count itself
+	uint32_t workerCount = jobs.getWorkerCount();
+	std::vector<uint32_t> chunkCounts = powersOfTwoUpTo(workerCount);
+
+	// records into the current slot without submitting, so nothing may be in flight
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	ScopedBenchmarkState savedState(*this);
+	FrameData& frame = frames[currentFrame];
+
+	// full re-recording every frame, or incremental recording of an unchanged scene (every secondary reused)
+	auto measure = [&](uint32_t chunks, bool incremental) {
+		settings.incrementalRecording = incremental;
+		invalidateRecordings();
+
+		std::vector<double> recordMs;
+		for (uint32_t i = 0; i <= repeats; i++) {
+			streamingBuffer.beginFrame(currentFrame);
+			vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+
+			auto start = BenchClock::now();
+			recordCommandBuffer(frame.commandBuffer, 0, chunks);
+			// the first incremental frame records everything, it's the steady state that's interesting
+			if (i > 0) {
+				recordMs.push_back(elapsedMs(start, BenchClock::now()));
+			}
+		}
+		return computeStats(recordMs);
+	};
+
+	json.value("job_threads", workerCount);
+	json.value("views", static_cast<uint64_t>(views.size()));
+	json.beginArray("runs");
+	for (uint32_t draws : drawCounts) {
+		setTestScene(draws);
+		ensureStreamingCapacity();
+
+		json.beginObject();
+		json.value("draws", static_cast<uint64_t>(draws));
+		json.beginArray("chunks");
+
+		double singleThreadMs = 0.0;
+		for (uint32_t chunks : chunkCounts) {
+			SampleStats full = measure(chunks, false);
+			SampleStats incremental = measure(chunks, true);
+			if (chunks == 1) {
+				singleThreadMs = full.p50;
+			}
+
+			json.beginObject();
+			json.value("chunks", chunks);
+			json.value("secondaries", chunks > 1);
+			json.stats("record_ms", full);
+			json.value("draws_per_ms", full.p50 > 0.0 ? draws / full.p50 : 0.0);
+			json.value("speedup", full.p50 > 0.0 ? singleThreadMs / full.p50 : 0.0);
+			json.stats("incremental_record_ms", incremental);
+			json.endObject();
+		}
+
+		json.endArray();
+		json.endObject();
+	}
+	json.endArray();
+
+	vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+}
+
+void VulkanRenderer::benchmarkJobs(JsonWriter& json) {
+	const uint32_t batches = 1000;
+	const uint32_t jobsPerBatch = 1000;
+	const uint32_t elements = 1 << 24;
+	const uint32_t grainSize = 1 << 14;
+	const uint32_t repeats = 10;
+
+	uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<float> values(elements, 1.0f);
+
+	json.value("cores", cores);
+	json.value("pinned", settings.pinJobThreads);
+	json.value("elements", elements);
+	json.value("grain_size", grainSize);
+	json.beginArray("workers");
+
+	double singleWorkerMs = 0.0;
+	for (uint32_t workerCount : powersOfTwoUpTo(cores)) {
+		JobSystem system;
+		system.init(workerCount, settings.pinJobThreads);
+
+		// throughput: empty jobs submitted from the main thread in batches, stolen by everyone else
+		std::atomic<uint32_t> executed{0};
+		auto start = BenchClock::now();
+		for (uint32_t batch = 0; batch < batches; batch++) {
+			JobCounter counter;
+			for (uint32_t i = 0; i < jobsPerBatch; i++) {
+				system.run(counter, [&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+			}
+			system.wait(counter);
+		}
+		double throughputMs = elapsedMs(start, BenchClock::now());
+		JobStats throughputStats = system.getStats();
+		system.resetStats();
+
+		// scaling: a memory and ALU bound parallelFor over the whole array
+		std::vector<double> parallelForMs;
+		for (uint32_t i = 0; i < repeats; i++) {
+			start = BenchClock::now();
+			system.parallelFor(elements, grainSize, [&values](uint32_t begin, uint32_t end) {
+				for (uint32_t e = begin; e < end; e++) {
+					values[e] = std::sqrt(values[e] * 1.0001f + 0.5f);
+				}
+			});
+			parallelForMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+		SampleStats parallelFor = computeStats(parallelForMs);
+		if (workerCount == 1) {
+			singleWorkerMs = parallelFor.p50;
+		}
+
+		json.beginObject();
+		json.value("workers", workerCount);
+		json.value("jobs_per_s", throughputMs > 0.0 ? executed.load() / (throughputMs / 1000.0) : 0.0);
+		json.beginObject("throughput_counters");
+		throughputStats.writeJson(json);
+		json.endObject();
+		json.stats("parallel_for_ms", parallelFor);
+		json.value("speedup", parallelFor.p50 > 0.0 ? singleWorkerMs / parallelFor.p50 : 0.0);
+		json.beginObject("parallel_for_counters");
+		system.getStats().writeJson(json);
+		json.endObject();
+		json.endObject();
+
+		system.destroy();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkRenderGraph(JsonWriter& json) {
+	const uint32_t repeats = 1000;
+
+	// a deferred-style frame with empty passes: the GPU only runs the barriers, the CPU cost is declaring,
+	// compiling and recording the graph. Two passes produce nothing that is used and get culled
+	VkExtent2D full = swapChainExtent;
+	VkExtent2D half = {std::max(1u, full.width / 2), std::max(1u, full.height / 2)};
+
+	VkImageCreateInfo targetInfo{};
+	targetInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	targetInfo.imageType = VK_IMAGE_TYPE_2D;
+	targetInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	targetInfo.extent = {full.width, full.height, 1};
+	targetInfo.mipLevels = 1;
+	targetInfo.arrayLayers = 1;
+	targetInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	targetInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	targetInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	targetInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	targetInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkImage target;
+	Allocation targetAllocation;
+	allocator.createImage(targetInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target, targetAllocation);
+
+	VkBuffer indirect;
+	Allocation indirectAllocation;
+	allocator.createBuffer(4096, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+	                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirect, indirectAllocation);
+
+	auto declare = [&](RenderGraph& graph) {
+		graph.beginFrame(0);
+		RenderGraphResource output = graph.importImage("output", target, VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT,
+		                                               VK_IMAGE_LAYOUT_UNDEFINED, 0, ResourceAccess::TransferRead);
+		RenderGraphResource draws = graph.importBuffer("indirect draws", indirect, ResourceAccess::None);
+		RenderGraphResource depth = graph.createImage("depth", VK_FORMAT_D32_SFLOAT, full);
+		RenderGraphResource albedo = graph.createImage("albedo", VK_FORMAT_R8G8B8A8_UNORM, full);
+		RenderGraphResource normals = graph.createImage("normals", VK_FORMAT_R16G16B16A16_SFLOAT, full);
+		RenderGraphResource occlusion = graph.createImage("occlusion", VK_FORMAT_R8G8B8A8_UNORM, half);
+		RenderGraphResource hdr = graph.createImage("hdr", VK_FORMAT_R16G16B16A16_SFLOAT, full);
+		RenderGraphResource bloom = graph.createImage("bloom", VK_FORMAT_R16G16B16A16_SFLOAT, half);
+		RenderGraphResource bloomBlurred = graph.createImage("bloom blurred", VK_FORMAT_R16G16B16A16_SFLOAT, half);
+		RenderGraphResource debugView = graph.createImage("debug view", VK_FORMAT_R8G8B8A8_UNORM, full);
+		// nothing reads it, so its pass is culled and never touches the (shared) buffer
+		RenderGraphResource histogram = graph.importBuffer("histogram", indirect, ResourceAccess::None);
+
+		graph.addPass("cull", [&](RenderGraph::PassBuilder& pass) {
+			pass.write(draws, ResourceAccess::ComputeShaderWrite);
+		}, nullptr);
+		graph.addPass("depth prepass", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(draws, ResourceAccess::IndirectRead);
+			pass.write(depth, ResourceAccess::DepthAttachmentWrite);
+		}, nullptr);
+		graph.addPass("gbuffer", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(draws, ResourceAccess::IndirectRead);
+			pass.read(depth, ResourceAccess::DepthAttachmentRead);
+			pass.write(albedo, ResourceAccess::ColorAttachmentWrite);
+			pass.write(normals, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("debug normals", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(normals, ResourceAccess::FragmentShaderRead);
+			pass.write(debugView, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("ssao", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(depth, ResourceAccess::FragmentShaderRead);
+			pass.read(normals, ResourceAccess::FragmentShaderRead);
+			pass.write(occlusion, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("lighting", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(depth, ResourceAccess::FragmentShaderRead);
+			pass.read(albedo, ResourceAccess::FragmentShaderRead);
+			pass.read(normals, ResourceAccess::FragmentShaderRead);
+			pass.read(occlusion, ResourceAccess::FragmentShaderRead);
+			pass.write(hdr, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("luminance histogram", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(hdr, ResourceAccess::ComputeShaderRead);
+			pass.write(histogram, ResourceAccess::ComputeShaderWrite);
+		}, nullptr);
+		graph.addPass("bloom downsample", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(hdr, ResourceAccess::FragmentShaderRead);
+			pass.write(bloom, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("bloom blur", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(bloom, ResourceAccess::FragmentShaderRead);
+			pass.write(bloomBlurred, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+		graph.addPass("tonemap", [&](RenderGraph::PassBuilder& pass) {
+			pass.read(hdr, ResourceAccess::FragmentShaderRead);
+			pass.read(bloomBlurred, ResourceAccess::FragmentShaderRead);
+			pass.write(output, ResourceAccess::ColorAttachmentWrite);
+		}, nullptr);
+	};
+
+	// with synchronization2 when the device has it, and always with the original barriers for comparison
+	std::vector<bool> variants = {false};
+	if (isDeviceExtensionEnabled(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+		variants.push_back(true);
+	}
+
+	json.value("width", full.width);
+	json.value("height", full.height);
+	json.beginArray("runs");
+	for (bool synchronization2 : variants) {
+		RenderGraph graph;
+		graph.init(mainDevice.logicalDevice, allocator, 1, synchronization2);
+
+		// the first compile creates and places the transient images, later ones find them unchanged
+		auto start = BenchClock::now();
+		declare(graph);
+		graph.compile();
+		double coldMs = elapsedMs(start, BenchClock::now());
+
+		std::vector<double> compileMs;
+		for (uint32_t i = 0; i < repeats; i++) {
+			start = BenchClock::now();
+			declare(graph);
+			graph.compile();
+			compileMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+
+		std::vector<double> recordMs;
+		for (uint32_t i = 0; i < repeats; i++) {
+			VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+			start = BenchClock::now();
+			graph.execute(commandBuffer);
+			recordMs.push_back(elapsedMs(start, BenchClock::now()));
+			vkEndCommandBuffer(commandBuffer);
+			vkFreeCommandBuffers(mainDevice.logicalDevice, commandPool, 1, &commandBuffer);
+		}
+
+		// submit one for real so validation sees the barriers
+		VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+		graph.execute(commandBuffer);
+		endSingleTimeCommands(commandBuffer);
+
+		const RenderGraphStats& stats = graph.getStats();
+		json.beginObject();
+		stats.writeJson(json);
+		// one barrier command per hazard, what passes synchronizing themselves would record
+		json.value("unbatched_barriers", stats.imageBarriers + stats.memoryBarriers);
+		json.beginArray("order");
+		for (const char* name : graph.getExecutionOrder()) {
+			json.beginObject();
+			json.value("pass", name);
+			json.endObject();
+		}
+		json.endArray();
+		json.value("cold_compile_ms", coldMs);
+		json.stats("compile_ms", computeStats(compileMs));
+		json.stats("record_ms", computeStats(recordMs));
+		json.endObject();
+
+		graph.destroy();
+	}
+	json.endArray();
+
+	allocator.destroyBuffer(indirect, indirectAllocation);
+	allocator.destroyImage(target, targetAllocation);
+}
+
+void VulkanRenderer::benchmarkRendering(JsonWriter& json) {
+	const uint32_t passesPerRecording = 1000;
+	const uint32_t repeats = 20;
+
+	// records without submitting, so nothing may be in flight
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	FrameData& frame = frames[currentFrame];
+	VkClearValue clearValues[2] = {};
+	clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clearValues[1].depthStencil = {1.0f, 0};
+
+	// begin/end of an empty pass, ns per pass
+	auto measureBeginEnd = [&](auto&& recordPass) {
+		std::vector<double> passNs;
+		for (uint32_t i = 0; i <= repeats; i++) {
+			vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			if (vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to begin recording command buffer");
+			}
+
+			auto start = BenchClock::now();
+			for (uint32_t pass = 0; pass < passesPerRecording; pass++) {
+				recordPass(frame.commandBuffer);
+			}
+			auto end = BenchClock::now();
+			vkEndCommandBuffer(frame.commandBuffer);
+
+			// the first recording warms up the pool
+			if (i > 0) {
+				passNs.push_back(elapsedMs(start, end) * 1e6 / passesPerRecording);
+			}
+		}
+		return computeStats(passNs);
+	};
+
+	// the render pass path rebuilds its render pass (on format changes) and a framebuffer per image on every
+	// swap chain recreate, created here so both paths can be compared in the same run
+	std::vector<double> recreateMs;
+	VkRenderPass mainPass = VK_NULL_HANDLE;
+	std::vector<VkFramebuffer> framebuffers(swapChainImageViews.size());
+	for (uint32_t i = 0; i <= repeats; i++) {
+		vkDestroyRenderPass(mainDevice.logicalDevice, mainPass, nullptr);
+		for (VkFramebuffer& framebuffer : framebuffers) {
+			vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+		}
+
+		auto start = BenchClock::now();
+		mainPass = createMainRenderPass(swapChainImageFormat, depthFormat);
+		for (size_t image = 0; image < framebuffers.size(); image++) {
+			framebuffers[image] = createFramebuffer(mainPass, swapChainImageViews[image], depthTargets[image].view);
+		}
+		if (i > 0) {
+			recreateMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+	}
+
+	SampleStats renderPassNs = measureBeginEnd([&](VkCommandBuffer commandBuffer) {
+		VkRenderPassBeginInfo renderPassInfo{};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = mainPass;
+		renderPassInfo.framebuffer = framebuffers[0];
+		renderPassInfo.renderArea.extent = swapChainExtent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(std::size(clearValues));
+		renderPassInfo.pClearValues = clearValues;
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdEndRenderPass(commandBuffer);
+	});
+
+	json.value("passes_per_recording", passesPerRecording);
+	json.value("swapchain_images", static_cast<uint64_t>(framebuffers.size()));
+	json.value("dynamic_rendering", usesDynamicRendering());
+
+	json.beginObject("render_pass");
+	json.stats("begin_end_ns", renderPassNs);
+	json.stats("recreate_ms", computeStats(recreateMs));
+	json.value("recreate_objects", static_cast<uint64_t>(1 + framebuffers.size()));
+	json.endObject();
+
+	// only loaded when the device was created with it (--dynamic-rendering)
+	if (usesDynamicRendering()) {
+		SampleStats dynamicNs = measureBeginEnd([&](VkCommandBuffer commandBuffer) {
+			VkRenderingAttachmentInfoKHR colorAttachment{};
+			colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+			colorAttachment.imageView = swapChainImageViews[0];
+			colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			colorAttachment.clearValue = clearValues[0];
+
+			VkRenderingAttachmentInfoKHR depthAttachment{};
+			depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+			depthAttachment.imageView = depthTargets[0].view;
+			depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			depthAttachment.clearValue = clearValues[1];
+
+			VkRenderingInfoKHR renderingInfo{};
+			renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+			renderingInfo.renderArea.extent = swapChainExtent;
+			renderingInfo.layerCount = 1;
+			renderingInfo.colorAttachmentCount = 1;
+			renderingInfo.pColorAttachments = &colorAttachment;
+			renderingInfo.pDepthAttachment = &depthAttachment;
+			cmdBeginRendering(commandBuffer, &renderingInfo);
+			cmdEndRendering(commandBuffer);
+		});
+
+		// nothing but the image views themselves, which both paths recreate
+		json.beginObject("dynamic_rendering");
+		json.stats("begin_end_ns", dynamicNs);
+		json.value("recreate_objects", 0);
+		json.endObject();
+	}
+
+	vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+	for (VkFramebuffer framebuffer : framebuffers) {
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
+	vkDestroyRenderPass(mainDevice.logicalDevice, mainPass, nullptr);
+}
+
+void VulkanRenderer::benchmarkDepthPrepass(JsonWriter& json) {
+	const uint32_t overdraws[] = {1, 4, 16};
+	const uint32_t drawsPerLayer = 4096;
+	const uint32_t warmupFrames = 10;
+	const uint32_t measuredFrames = 100;
+
+	ScopedBenchmarkState savedState(*this);
+
+	// with enough overdraw the frame time is the GPU's. The prepass doubles the vertex work to save all but one
+	// layer's fragment shading
+	auto measure = [&](bool prepass) {
+		setDepthPrepass(prepass);
+		FrameSample sample;
+		measureFrames(warmupFrames, measuredFrames, sample);
+		return sample;
+	};
+
+	// lazily allocated memory only gets committed if the depth targets ever leave the tile
+	VkDeviceSize committedBytes = 0;
+	for (const auto& target : depthTargets) {
+		VkDeviceSize committed = target.allocation.size;
+		if (depthLazilyAllocated) {
+			vkGetDeviceMemoryCommitment(mainDevice.logicalDevice, target.allocation.memory, &committed);
+		}
+		committedBytes += committed;
+	}
+
+	json.value("depth_format", static_cast<uint32_t>(depthFormat));
+	json.value("lazily_allocated", depthLazilyAllocated);
+	json.value("depth_targets", static_cast<uint64_t>(depthTargets.size()));
+	json.value("depth_committed_bytes", static_cast<uint64_t>(committedBytes));
+	json.value("width", swapChainExtent.width);
+	json.value("height", swapChainExtent.height);
+	json.value("frames", measuredFrames);
+	json.beginArray("runs");
+	for (uint32_t overdraw : overdraws) {
+		setTestScene(drawsPerLayer * overdraw, overdraw);
+		ensureStreamingCapacity();
+
+		FrameSample direct = measure(false);
+		FrameSample prepass = measure(true);
+
+		json.beginObject();
+		json.value("overdraw", overdraw);
+		json.value("draws", static_cast<uint64_t>(drawItems.size()));
+		json.value("frame_ms", direct.frameMs);
+		json.value("prepass_frame_ms", prepass.frameMs);
+		json.value("speedup", prepass.frameMs > 0.0 ? direct.frameMs / prepass.frameMs : 0.0);
+		json.value("record_ms", direct.recordMs);
+		json.value("prepass_record_ms", prepass.recordMs);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkGpuDriven(JsonWriter& json) {
+	const uint32_t objectCounts[] = {10000, 100000, 1000000};
+	const uint32_t warmupFrames = 5;
+
+	json.value("supported", supportsGpuDriven());
+	json.value("width", swapChainExtent.width);
+	json.value("height", swapChainExtent.height);
+	if (!supportsGpuDriven()) {
+		return;
+	}
+
+	ScopedBenchmarkState savedState(*this);
+	setInstancing(false);
+
+	// the CPU-issued path records (and streams constants for) every object it draws, the GPU-driven one a few
+	// commands. The GPU path culls on the GPU, so the CPU path is measured both without culling and with its own
+	// frustum culling to keep culling apart from the cost of issuing the draws
+	auto measure = [&](bool gpuDriven, bool cpuCulling, uint32_t measuredFrames) {
+		setGpuDriven(gpuDriven);
+		setFrustumCulling(cpuCulling);
+		FrameSample sample;
+		measureFrames(warmupFrames, measuredFrames, sample);
+		return sample;
+	};
+
+	json.beginArray("runs");
+	for (uint32_t objectCount : objectCounts) {
+		// a grid twice the view's size in x and y, so roughly a quarter of the objects survive frustum culling
+		uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objectCount))));
+		float cell = 4.0f / columns;
+		drawItems.assign(objectCount, DrawItem());
+		for (uint32_t i = 0; i < objectCount; i++) {
+			glm::vec3 position(-2.0f + cell * (i % columns + 0.5f), -2.0f + cell * (i / columns + 0.5f), 0.5f);
+			drawItems[i].mesh = &triangleMesh;
+			drawItems[i].transform = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(cell));
+		}
+		invalidateScene();
+
+		// the CPU path gets slow enough at a million objects that fewer frames still give a stable median
+		uint32_t measuredFrames = objectCount >= 1000000 ? 10 : 100;
+		FrameSample cpu = measure(false, false, measuredFrames);
+		FrameSample cpuCulled = measure(false, true, measuredFrames);
+		uint32_t cpuVisible = getVisibleDrawCount();
+
+		setGpuDriven(true);
+		auto uploadStart = BenchClock::now();
+		updateGpuScene();
+		double uploadMs = elapsedMs(uploadStart, BenchClock::now());
+
+		FrameSample gpu = measure(true, false, measuredFrames);
+
+		json.beginObject();
+		json.value("objects", objectCount);
+		json.value("batches", gpuScene.getBatchCount());
+		json.value("frames", measuredFrames);
+		json.value("cpu_frame_ms", cpu.frameMs);
+		json.value("cpu_record_ms", cpu.recordMs);
+		json.value("cpu_culled_frame_ms", cpuCulled.frameMs);
+		json.value("cpu_culled_record_ms", cpuCulled.recordMs);
+		json.value("cpu_culled_visible", cpuVisible);
+		json.value("gpu_frame_ms", gpu.frameMs);
+		json.value("gpu_record_ms", gpu.recordMs);
+		// against the culled CPU path, so it's only what issuing the draws from the GPU saves
+		json.value("speedup", gpu.frameMs > 0.0 ? cpuCulled.frameMs / gpu.frameMs : 0.0);
+		json.value("speedup_unculled", gpu.frameMs > 0.0 ? cpu.frameMs / gpu.frameMs : 0.0);
+		json.value("scene_upload_ms", uploadMs);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkInstancing(JsonWriter& json) {
+	const uint32_t objectCounts[] = {1000, 10000, 100000};
+	const uint32_t meshCount = 2;
+	const uint32_t materialCount = 4;
+	const uint32_t warmupFrames = 10;
+	const uint32_t measuredFrames = 100;
+
+	ScopedBenchmarkState savedState(*this);
+	setGpuDriven(false);
+
+	auto measure = [&](bool instancing) {
+		setInstancing(instancing);
+		FrameSample sample;
+		measureFrames(warmupFrames, measuredFrames, sample);
+		return sample;
+	};
+
+	json.value("unique_pairs", meshCount * materialCount);
+	json.value("views", static_cast<uint32_t>(views.size()));
+	json.value("frames", measuredFrames);
+	json.beginArray("runs");
+	for (uint32_t objectCount : objectCounts) {
+		// repeated props: every object is one of a few meshes with one of a few materials, spread over the view
+		uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objectCount))));
+		float cell = 2.0f / columns;
+		drawItems.assign(objectCount, DrawItem());
+		for (uint32_t i = 0; i < objectCount; i++) {
+			glm::vec3 position(-1.0f + cell * (i % columns + 0.5f), -1.0f + cell * (i / columns + 0.5f), 0.5f);
+			drawItems[i].mesh = i % meshCount ? &quadMesh : &triangleMesh;
+			drawItems[i].material = (i / meshCount) % materialCount;
+			drawItems[i].transform = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(cell));
+		}
+		invalidateScene();
+
+		FrameSample direct = measure(false);
+
+		setInstancing(true);
+		auto buildStart = BenchClock::now();
+		updateInstanceBatches();
+		double buildMs = elapsedMs(buildStart, BenchClock::now());
+
+		FrameSample instanced = measure(true);
+
+		json.beginObject();
+		json.value("objects", objectCount);
+		json.value("batches", getInstanceBatchCount());
+		json.value("draw_calls", direct.drawCalls);
+		json.value("instanced_draw_calls", instanced.drawCalls);
+		json.value("draw_call_reduction", instanced.drawCalls > 0 ? static_cast<double>(direct.drawCalls) / instanced.drawCalls : 0.0);
+		json.value("frame_ms", direct.frameMs);
+		json.value("instanced_frame_ms", instanced.frameMs);
+		json.value("speedup", instanced.frameMs > 0.0 ? direct.frameMs / instanced.frameMs : 0.0);
+		json.value("record_ms", direct.recordMs);
+		json.value("instanced_record_ms", instanced.recordMs);
+		json.value("batch_build_ms", buildMs);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkCulling(JsonWriter& json) {
+	const uint32_t objectCount = 1000000;
+	const uint32_t repeats = 21;
+
+	// spheres scattered through a cube, the camera sits on its front face looking through it so part of them is visible
+	FrustumCuller culler;
+	culler.resize(objectCount);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.5f, 2.0f);
+	for (uint32_t i = 0; i < objectCount; i++) {
+		culler.setSphere(i, glm::vec3(position(rng), position(rng), position(rng)), size(rng));
+	}
+	glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 500.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+
+	// median of the repeats, the first run of each also warms the caches and the output vector
+	std::vector<uint32_t> reference;
+	culler.cull(frustum, CullKernel::Scalar, reference);
+	bool resultsMatch = true;
+	auto measure = [&](bool parallel, CullKernel kernel) {
+		std::vector<uint32_t> visible;
+		std::vector<double> runMs;
+		for (uint32_t repeat = 0; repeat < repeats + 1; repeat++) {
+			auto start = BenchClock::now();
+			if (parallel) {
+				culler.cullParallel(frustum, kernel, jobs, visible);
+			} else {
+				culler.cull(frustum, kernel, visible);
+			}
+			if (repeat > 0) {
+				runMs.push_back(elapsedMs(start, BenchClock::now()));
+			}
+		}
+		resultsMatch = resultsMatch && visible == reference;
+		return computeStats(runMs).p50 * 1e6 / objectCount;
+	};
+
+	json.value("objects", objectCount);
+	json.value("visible", static_cast<uint32_t>(reference.size()));
+	json.value("threads", jobs.getWorkerCount());
+	json.value("chunk_size", FrustumCuller::CHUNK_SIZE);
+	json.value("best_kernel", cullKernelName(FrustumCuller::getBestKernel()));
+
+	double scalarNs = 0.0;
+	double bestNs = 0.0;
+	json.beginArray("kernels");
+	for (CullKernel kernel : {CullKernel::Scalar, CullKernel::Sse, CullKernel::Avx2}) {
+		if (!FrustumCuller::isSupported(kernel)) {
+			continue;
+		}
+		double ns = measure(false, kernel);
+		scalarNs = kernel == CullKernel::Scalar ? ns : scalarNs;
+		bestNs = kernel == FrustumCuller::getBestKernel() ? ns : bestNs;
+		json.beginObject();
+		json.value("kernel", cullKernelName(kernel));
+		json.value("ns_per_object", ns);
+		json.value("speedup", ns > 0.0 ? scalarNs / ns : 0.0);
+		json.endObject();
+	}
+	json.endArray();
+
+	double parallelNs = measure(true, FrustumCuller::getBestKernel());
+	json.value("parallel_ns_per_object", parallelNs);
+	json.value("parallel_speedup", parallelNs > 0.0 ? bestNs / parallelNs : 0.0);
+	json.value("total_speedup", parallelNs > 0.0 ? scalarNs / parallelNs : 0.0);
+	json.value("results_match", resultsMatch);
+}
+
+void VulkanRenderer::benchmarkTransforms(JsonWriter& json) {
+	const uint32_t nodeCount = 100000;
+	const uint32_t maxDepth = 12;
+	const double dirtyRatios[] = {0.01, 1.0};
+	const uint32_t repeats = 21;
+
+	// a random forest built depth first: each node goes under the previous one or one of its ancestors
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+	TransformHierarchy hierarchy;
+	std::vector<uint32_t> openPath;
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		uint32_t pops = rng() % 3;
+		for (uint32_t pop = 0; pop < pops && !openPath.empty(); pop++) {
+			openPath.pop_back();
+		}
+		if (openPath.size() >= maxDepth) {
+			openPath.pop_back();
+		}
+		Transform local;
+		local.position = glm::vec3(offset(rng), offset(rng), offset(rng));
+		local.rotation = glm::angleAxis(offset(rng), glm::vec3(0.0f, 1.0f, 0.0f));
+		openPath.push_back(hierarchy.addNode(openPath.empty() ? TransformHierarchy::NO_PARENT : openPath.back(), local));
+	}
+	hierarchy.updateAll();
+	uint32_t rootCount = 0;
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		rootCount += hierarchy.getParent(node) == TransformHierarchy::NO_PARENT;
+	}
+
+	// flags a random dirtyCount nodes (all of them at 100%), outside the timed part
+	auto touch = [&](uint32_t dirtyCount) {
+		for (uint32_t i = 0; i < dirtyCount; i++) {
+			uint32_t node = dirtyCount == nodeCount ? i : rng() % nodeCount;
+			Transform local = hierarchy.getLocal(node);
+			local.rotation = glm::normalize(local.rotation * glm::angleAxis(0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
+			hierarchy.setLocal(node, local);
+		}
+	};
+	auto measure = [&](uint32_t dirtyCount, bool parallel, bool full) {
+		std::vector<double> runMs;
+		for (uint32_t repeat = 0; repeat < repeats; repeat++) {
+			touch(dirtyCount);
+			auto start = BenchClock::now();
+			if (full) {
+				hierarchy.updateAll();
+			} else if (parallel) {
+				hierarchy.update(jobs);
+			} else {
+				hierarchy.update();
+			}
+			runMs.push_back(elapsedMs(start, BenchClock::now()));
+		}
+		return computeStats(runMs).p50;
+	};
+
+	json.value("nodes", nodeCount);
+	json.value("roots", rootCount);
+	json.value("max_depth", maxDepth);
+	json.value("threads", jobs.getWorkerCount());
+	json.beginArray("runs");
+	for (double ratio : dirtyRatios) {
+		uint32_t dirtyCount = std::max(1u, static_cast<uint32_t>(nodeCount * ratio));
+		double fullMs = measure(dirtyCount, false, true);
+		double serialMs = measure(dirtyCount, false, false);
+		double parallelMs = measure(dirtyCount, true, false);
+		TransformUpdateStats stats = hierarchy.getLastUpdateStats();
+
+		// the incremental result has to be what recomputing everything gives
+		touch(dirtyCount);
+		hierarchy.update(jobs);
+		std::vector<glm::mat4> incremental(nodeCount);
+		for (uint32_t node = 0; node < nodeCount; node++) {
+			incremental[node] = hierarchy.getWorld(node);
+		}
+		hierarchy.updateAll();
+		bool resultsMatch = true;
+		for (uint32_t node = 0; node < nodeCount; node++) {
+			resultsMatch = resultsMatch && incremental[node] == hierarchy.getWorld(node);
+		}
+
+		json.beginObject();
+		json.value("dirty_ratio", ratio);
+		json.value("dirty_nodes", dirtyCount);
+		json.value("subtrees", stats.subtrees);
+		json.value("nodes_updated", stats.nodesUpdated);
+		json.value("tasks", stats.tasks);
+		json.value("full_ms", fullMs);
+		json.value("serial_ms", serialMs);
+		json.value("parallel_ms", parallelMs);
+		json.value("ns_per_updated_node", stats.nodesUpdated > 0 ? serialMs * 1e6 / stats.nodesUpdated : 0.0);
+		json.value("speedup_vs_full", parallelMs > 0.0 ? fullMs / parallelMs : 0.0);
+		json.value("parallel_speedup", parallelMs > 0.0 ? serialMs / parallelMs : 0.0);
+		json.value("results_match", resultsMatch);
+		json.endObject();
+	}
+	json.endArray();
+}
+
+void VulkanRenderer::benchmarkPipelines(JsonWriter& json) {
+	const uint32_t rounds = 10;
+	const uint32_t requestsPerRound = 100;
+
+	// material variants: every combination of these states is its own pipeline
+	const VkCullModeFlags cullModes[] = {VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT};
+	const VkFrontFace frontFaces[] = {VK_FRONT_FACE_CLOCKWISE, VK_FRONT_FACE_COUNTER_CLOCKWISE};
+	const VkCompareOp depthCompares[] = {VK_COMPARE_OP_LESS, VK_COMPARE_OP_LESS_OR_EQUAL, VK_COMPARE_OP_EQUAL, VK_COMPARE_OP_GREATER};
+	const BlendMode blends[] = {BlendMode::Opaque, BlendMode::Alpha};
+	const bool depthWrites[] = {true, false};
+	std::vector<PipelineDesc> variants;
+	PipelineDesc base;
+	base.vertexShader = "shader.vert";
+	base.fragmentShader = "shader.frag";
+	base.colorFormat = swapChainImageFormat;
+	base.depthFormat = depthFormat;
+	base.renderPass = usesDynamicRendering() ? VK_NULL_HANDLE : renderPass;
+	base.layout = pipelineLayout;
+	for (auto cullMode : cullModes) {
+		for (auto frontFace : frontFaces) {
+			for (auto depthCompare : depthCompares) {
+				for (auto blend : blends) {
+					for (bool depthWrite : depthWrites) {
+						PipelineDesc desc = base;
+						desc.cullMode = cullMode;
+						desc.frontFace = frontFace;
+						desc.depthCompare = depthCompare;
+						desc.blend = blend;
+						desc.depthWrite = depthWrite;
+						variants.push_back(desc);
+					}
+				}
+			}
+		}
+	}
+
+	// no pipeline cache, so every pipeline is really compiled. Each round is a frame's worth of materials
+	// asking for their variants, what's new is created in one batch at the end of the round
+	std::mt19937 rng(42);
+	PipelineRegistry registry;
+	registry.init(mainDevice.logicalDevice, shaderLibrary, nullptr, false);
+	for (uint32_t round = 0; round < rounds; round++) {
+		for (uint32_t i = 0; i < requestsPerRound; i++) {
+			registry.request(variants[rng() % variants.size()]);
+		}
+		registry.flush();
+	}
+	PipelineRegistryStats batched = registry.getStats();
+	registry.destroy();
+
+	// the same unique pipelines one vkCreateGraphicsPipelines call each
+	PipelineRegistry single;
+	single.init(mainDevice.logicalDevice, shaderLibrary, nullptr, false);
+	for (const auto& desc : variants) {
+		single.get(desc);
+	}
+	PipelineRegistryStats individual = single.getStats();
+	single.destroy();
+
+	json.value("variants", static_cast<uint32_t>(variants.size()));
+	json.beginObject("batched");
+	batched.writeJson(json);
+	json.value("ms_per_pipeline", batched.created > 0 ? batched.compileMs / batched.created : 0.0);
+	json.endObject();
+	json.beginObject("individual");
+	individual.writeJson(json);
+	json.value("ms_per_pipeline", individual.created > 0 ? individual.compileMs / individual.created : 0.0);
+	json.endObject();
+	json.value("batch_speedup", batched.compileMs > 0.0 && batched.created > 0 && individual.created > 0
+	           ? (individual.compileMs / individual.created) / (batched.compileMs / batched.created) : 0.0);
+}
+
+void VulkanRenderer::benchmarkAsyncPipelines(JsonWriter& json) {
+	const uint32_t drawCount = 4096;
+	const uint32_t framesPerMaterial = 8;
+	const uint32_t warmupFrames = 30;
+	const uint32_t tailFrames = 60;
+	const double budgetMs = 1000.0 / 60.0;
+
+	ScopedBenchmarkState savedState(*this);
+	setGpuDriven(false);
+	setInstancing(false);
+	setDepthPrepass(false);
+
+	// material variants, every one its own pipeline. The two runs differ in the color write mask so neither
+	// finds the other's pipelines (run without a warm pipeline cache for the same reason)
+	auto makeVariants = [](VkColorComponentFlags colorWriteMask) {
+		std::vector<PipelineDesc> variants;
+		for (uint32_t bits = 0; bits < 32; bits++) {
+			PipelineDesc desc;
+			desc.vertexShader = "shader.vert";
+			desc.fragmentShader = "shader.frag";
+			desc.blend = bits & 1 ? BlendMode::Alpha : BlendMode::Opaque;
+			desc.depthCompare = bits & 2 ? VK_COMPARE_OP_LESS_OR_EQUAL : VK_COMPARE_OP_LESS;
+			desc.cullMode = bits & 4 ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
+			desc.depthWrite = (bits & 8) != 0;
+			desc.depthTest = (bits & 16) != 0;
+			desc.colorWriteMask = colorWriteMask;
+			variants.push_back(desc);
+		}
+		return variants;
+	};
+
+	auto run = [&](bool async, const std::vector<PipelineDesc>& variants) {
+		setAsyncPipelines(async);
+		clearMaterialPipelines();
+		setTestScene(drawCount);
+		uint32_t materialCount = static_cast<uint32_t>(variants.size());
+		for (uint32_t i = 0; i < drawCount; i++) {
+			drawItems[i].material = i % materialCount;
+		}
+		invalidateScene();
+		for (uint32_t i = 0; i < warmupFrames; i++) {
+			drawFrame();
+		}
+		vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+		// a new material streams in every few frames, whatever asks for its pipeline pays for the compile
+		// on the frame that asks unless it's async
+		std::vector<double> frameMs;
+		uint64_t pendingDraws = 0;
+		uint32_t framesUntilReady = 0;
+		uint32_t frameCount = materialCount * framesPerMaterial + tailFrames;
+		for (uint32_t frame = 0; frame < frameCount; frame++) {
+			auto frameStart = BenchClock::now();
+			if (frame % framesPerMaterial == 0 && frame / framesPerMaterial < materialCount) {
+				uint32_t material = frame / framesPerMaterial;
+				setMaterialPipeline(material, variants[material]);
+			}
+			drawFrame();
+			frameMs.push_back(elapsedMs(frameStart, BenchClock::now()));
+			pendingDraws += lastFrameTimings.pendingPipelineDraws;
+			if (getPendingPipelineCount() > 0 || frame < materialCount * framesPerMaterial) {
+				framesUntilReady = frame + 1;
+			}
+		}
+		pipelineRegistry.waitIdle();
+		vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+		SampleStats stats = computeStats(frameMs);
+		uint32_t hitches = static_cast<uint32_t>(std::count_if(frameMs.begin(), frameMs.end(), [&](double ms) { return ms > budgetMs; }));
+		json.beginObject(async ? "async" : "sync");
+		json.value("frames", frameCount);
+		json.value("materials", materialCount);
+		json.value("hitches", hitches);
+		json.value("frame_ms_p50", stats.p50);
+		json.value("frame_ms_p99", stats.p99);
+		json.value("frame_ms_max", stats.max);
+		json.value("pending_draws", pendingDraws);
+		json.value("frames_until_ready", framesUntilReady);
+		json.value("failed_pipelines", getFailedPipelineCount());
+		json.endObject();
+		return hitches;
+	};
+
+	json.value("draws", drawCount);
+	json.value("budget_ms", budgetMs);
+	json.value("frames_per_material", framesPerMaterial);
+	json.value("compile_threads", settings.pipelineCompileThreads);
+	json.value("skip_pending_draws", settings.skipPendingDraws);
+	json.value("pipeline_cache", pipelineCache.isWarm() ? "warm" : "cold");
+	uint32_t syncHitches = run(false, makeVariants(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT));
+	uint32_t asyncHitches = settings.pipelineCompileThreads > 0
+		? run(true, makeVariants(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT)) : syncHitches;
+	json.value("hitches_avoided", static_cast<int64_t>(syncHitches) - static_cast<int64_t>(asyncHitches));
+}
+
+void VulkanRenderer::benchmarkSpecialization(JsonWriter& json) {
+	const uint32_t drawCount = 1024;
+	const uint32_t overdraw = 8;
+	const uint32_t warmupFrames = 10;
+	const uint32_t measuredFrames = 100;
+
+	ScopedBenchmarkState savedState(*this);
+	setGpuDriven(false);
+	setInstancing(false);
+	setDepthPrepass(false);
+	setAsyncPipelines(false);
+
+	// the view covered several times over by one material, so the fragment shader is most of the frame
+	setTestScene(drawCount, overdraw);
+
+	// with this much overdraw the GPU is the slower side
+	auto measure = [&](const MaterialConstants& constants, bool specialize) {
+		setMaterialPipeline(0, getMaterialDesc(constants, specialize), constants);
+		FrameSample sample;
+		measureFrames(warmupFrames, measuredFrames, sample);
+		return sample.frameMs;
+	};
+
+	json.value("draws", drawCount);
+	json.value("overdraw", overdraw);
+	json.value("frames", measuredFrames);
+	json.value("width", swapChainExtent.width);
+	json.value("height", swapChainExtent.height);
+
+	const uint32_t lightingModels[] = {0, 1, 2};
+	const uint32_t shadingLoops[] = {1, 8};
+	const uint32_t alphaTests[] = {0, 1};
+	uint32_t specializedPipelines = 0;
+	json.beginArray("permutations");
+	for (uint32_t lightingModel : lightingModels) {
+		for (uint32_t loops : shadingLoops) {
+			for (uint32_t alphaTest : alphaTests) {
+				MaterialConstants constants;
+				constants.lightingModel = lightingModel;
+				constants.shadingLoops = loops;
+				constants.alphaTest = alphaTest;
+
+				// one pipeline serves every permutation through the branches, each specialized one is new
+				double branchMs = measure(constants, false);
+				double specializedMs = measure(constants, true);
+				specializedPipelines++;
+
+				json.beginObject();
+				json.value("lighting_model", lightingModel);
+				json.value("shading_loops", loops);
+				json.value("alpha_test", alphaTest != 0);
+				json.value("branch_frame_ms", branchMs);
+				json.value("specialized_frame_ms", specializedMs);
+				json.value("speedup", specializedMs > 0.0 ? branchMs / specializedMs : 0.0);
+				json.endObject();
+			}
+		}
+	}
+	json.endArray();
+	json.value("specialized_pipelines", specializedPipelines);
+	json.value("branch_pipelines", 1);
+}
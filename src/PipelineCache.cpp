@@ -0,0 +1,174 @@
+#include "PipelineCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+void PipelineCache::init(VkDevice newDevice, VkPhysicalDevice physicalDevice, const std::string& newPath) {
+	device = newDevice;
+	path = newPath;
+	loadedBytes = 0;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	// read a previous blob if there is one and it was produced by this exact device + driver
+	std::vector<char> initialData;
+	if (!path.empty()) {
+		std::ifstream file(path, std::ios::binary);
+		FileHeader header{};
+		if (file.is_open() && file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+			std::vector<char> data(static_cast<size_t>(std::min<uint64_t>(header.dataSize, 1ULL << 30)));
+			if (file.read(data.data(), data.size()) && isCompatible(header, data)) {
+				initialData = std::move(data);
+			} else {
+				std::cerr << "pipeline cache: discarding stale or corrupt " << path << std::endl;
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = initialData.size();
+	cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline cache");
+	}
+	loadedBytes = initialData.size();
+}
+
+void PipelineCache::destroy() {
+	if (cache != VK_NULL_HANDLE) {
+		vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+	}
+}
+
+void PipelineCache::save() {
+	if (path.empty() || cache == VK_NULL_HANDLE) {
+		return;
+	}
+
+	size_t dataSize = 0;
+	vkGetPipelineCacheData(device, cache, &dataSize, nullptr);
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+		std::cerr << "pipeline cache: failed to read cache data" << std::endl;
+		return;
+	}
+	data.resize(dataSize);
+
+	FileHeader header{};
+	header.magic = FILE_MAGIC;
+	header.fileVersion = FILE_VERSION;
+	header.vendorID = deviceProperties.vendorID;
+	header.deviceID = deviceProperties.deviceID;
+	header.driverVersion = deviceProperties.driverVersion;
+	memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = data.size();
+	header.dataHash = hashData(data.data(), data.size());
+
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "pipeline cache: failed to open " << tempPath << std::endl;
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), data.size());
+		if (!file.flush()) {
+			std::cerr << "pipeline cache: failed to write " << tempPath << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		std::cerr << "pipeline cache: failed to replace " << path << ": " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+VkPipelineCache PipelineCache::createWorkerCache() {
+	std::vector<char> data;
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) == VK_SUCCESS && dataSize > 0) {
+		data.resize(dataSize);
+		if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+			data.clear();
+		}
+		data.resize(std::min(data.size(), dataSize));
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VkPipelineCache workerCache;
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &workerCache) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create worker pipeline cache");
+	}
+	return workerCache;
+}
+
+void PipelineCache::mergeWorkerCache(VkPipelineCache workerCache) {
+	{
+		// the destination of a merge must be externally synchronized
+		std::lock_guard<std::mutex> lock(mergeMutex);
+		vkMergePipelineCaches(device, cache, 1, &workerCache);
+	}
+	vkDestroyPipelineCache(device, workerCache, nullptr);
+}
+
+void PipelineCache::recordFeedback(const VkPipelineCreationFeedbackEXT& feedback) {
+	if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+		return;
+	}
+
+	if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+		hits++;
+	} else {
+		misses++;
+	}
+}
+
+bool PipelineCache::isCompatible(const FileHeader& header, const std::vector<char>& data) const {
+	if (header.magic != FILE_MAGIC || header.fileVersion != FILE_VERSION
+		|| header.vendorID != deviceProperties.vendorID
+		|| header.deviceID != deviceProperties.deviceID
+		|| header.driverVersion != deviceProperties.driverVersion
+		|| memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+		return false;
+	}
+
+	if (header.dataSize != data.size() || header.dataHash != hashData(data.data(), data.size())) {
+		return false;
+	}
+
+	// the driver's own header has to agree as well, drivers are not required to reject foreign blobs gracefully
+	VkPipelineCacheHeaderVersionOne driverHeader;
+	if (data.size() < sizeof(driverHeader)) {
+		return false;
+	}
+	memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+
+	return driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& driverHeader.vendorID == deviceProperties.vendorID
+		&& driverHeader.deviceID == deviceProperties.deviceID
+		&& memcmp(driverHeader.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+uint64_t PipelineCache::hashData(const char* data, size_t size) {
+	// FNV-1a, only needs to catch truncated or corrupted files
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= static_cast<uint8_t>(data[i]);
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+// VkPipelineCache persisted to disk between runs.
+// The blob is only reused when it was written by the same device (vendor/device ID, pipelineCacheUUID)
+// and driver version; anything else is discarded and the cache starts empty.
+class PipelineCache {
+public:
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, const std::string& path);
+	void destroy();
+
+	// writes the cache to a temporary file and renames it over the old one, so a crash never leaves a torn file
+	void save();
+
+	VkPipelineCache get() const { return cache; }
+	bool isWarm() const { return loadedBytes > 0; }
+	size_t getLoadedBytes() const { return loadedBytes; }
+
+	// - worker threads
+	// pipelines compiled on other threads go into their own cache (no contention on the main one), seeded with
+	// the main cache's contents so a warm cache still hits. They're folded back in with mergeWorkerCache, which
+	// also destroys the worker cache; the main cache must not be in use on another thread while it merges
+	VkPipelineCache createWorkerCache();
+	void mergeWorkerCache(VkPipelineCache workerCache);
+
+	// - VK_EXT_pipeline_creation_feedback
+	void recordFeedback(const VkPipelineCreationFeedbackEXT& feedback);
+	uint32_t getHits() const { return hits; }
+	uint32_t getMisses() const { return misses; }
+
+private:
+	// prefixed to the driver blob on disk, the driver's own header doesn't carry the driver version
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t fileVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	static const uint32_t FILE_MAGIC = 0x43504B56;		// "VKPC"
+	static const uint32_t FILE_VERSION = 1;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties deviceProperties{};
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	size_t loadedBytes = 0;
+	std::mutex mergeMutex;
+
+	std::atomic<uint32_t> hits{0};
+	std::atomic<uint32_t> misses{0};
+
+	bool isCompatible(const FileHeader& header, const std::vector<char>& data) const;
+	static uint64_t hashData(const char* data, size_t size);
+};
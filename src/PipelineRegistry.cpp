@@ -0,0 +1,582 @@
+#include "PipelineRegistry.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include "Benchmark.h"
+#include "Mesh.h"
+
+// FNV-1a, fed field by field so padding never ends up in the hash
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+}
+
+template <typename T>
+static void hashValue(uint64_t& hash, T value) {
+	hashBytes(hash, &value, sizeof(value));
+}
+
+static void hashString(uint64_t& hash, const std::string& value) {
+	hashValue(hash, static_cast<uint32_t>(value.size()));
+	hashBytes(hash, value.data(), value.size());
+}
+
+uint64_t PipelineDesc::hash() const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hashString(hash, vertexShader);
+	hashString(hash, fragmentShader);
+	hashValue(hash, static_cast<uint32_t>(constants.size()));
+	for (const auto& constant : constants) {
+		hashValue(hash, constant.id);
+		hashValue(hash, constant.value);
+	}
+	hashValue(hash, static_cast<uint32_t>(vertexLayout));
+	hashValue(hash, static_cast<uint32_t>(topology));
+	hashValue(hash, static_cast<uint32_t>(polygonMode));
+	hashValue(hash, static_cast<uint32_t>(cullMode));
+	hashValue(hash, static_cast<uint32_t>(frontFace));
+	hashValue(hash, static_cast<uint32_t>(depthTest));
+	hashValue(hash, static_cast<uint32_t>(depthWrite));
+	hashValue(hash, static_cast<uint32_t>(depthCompare));
+	hashValue(hash, static_cast<uint32_t>(blend));
+	hashValue(hash, static_cast<uint32_t>(colorWriteMask));
+	hashValue(hash, static_cast<uint32_t>(colorFormat));
+	hashValue(hash, static_cast<uint32_t>(depthFormat));
+	hashValue(hash, static_cast<uint32_t>(renderPass != VK_NULL_HANDLE));
+	return hash;
+}
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const {
+	return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader && constants == other.constants
+		&& vertexLayout == other.vertexLayout && topology == other.topology
+		&& polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace
+		&& depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompare == other.depthCompare
+		&& blend == other.blend && colorWriteMask == other.colorWriteMask
+		&& colorFormat == other.colorFormat && depthFormat == other.depthFormat && renderPass == other.renderPass
+		&& layout == other.layout;
+}
+
+void PipelineDesc::setConstant(uint32_t id, uint32_t value) {
+	auto it = std::lower_bound(constants.begin(), constants.end(), id,
+	                           [](const SpecializationConstant& constant, uint32_t key) { return constant.id < key; });
+	if (it != constants.end() && it->id == id) {
+		it->value = value;
+	} else {
+		SpecializationConstant constant;
+		constant.id = id;
+		constant.value = value;
+		constants.insert(it, constant);
+	}
+}
+
+void PipelineRegistryStats::writeJson(JsonWriter& json) const {
+	json.value("requests", requests);
+	json.value("hits", hits);
+	json.value("hit_rate", hitRate());
+	json.value("pipelines", pipelines);
+	json.value("created", created);
+	json.value("batches", batches);
+	json.value("async_created", asyncCreated);
+	json.value("failed", failed);
+	json.value("compile_ms", compileMs);
+	json.value("shader_ms", shaderMs);
+}
+
+void PipelineRegistry::init(VkDevice newDevice, ShaderLibrary& newShaderLibrary, PipelineCache* newPipelineCache, bool newCreationFeedback,
+                            uint32_t compileThreadCount) {
+	device = newDevice;
+	shaderLibrary = &newShaderLibrary;
+	pipelineCache = newPipelineCache;
+	creationFeedback = newCreationFeedback && newPipelineCache;
+
+	stopping = false;
+	unmergedPipelines = 0;
+	for (uint32_t i = 0; i < compileThreadCount; i++) {
+		if (pipelineCache) {
+			workerCaches.push_back(pipelineCache->createWorkerCache());
+		}
+		compileThreads.emplace_back(&PipelineRegistry::compileLoop, this, i);
+	}
+}
+
+void PipelineRegistry::destroy() {
+	{
+		std::lock_guard<std::mutex> lock(compileMutex);
+		compileQueue.clear();
+		stopping = true;
+	}
+	compileReady.notify_all();
+	for (auto& thread : compileThreads) {
+		thread.join();
+	}
+	compileThreads.clear();
+	mergeWorkerCaches(false);
+
+	for (const auto& entry : entries) {
+		VkPipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+		if (pipeline != VK_NULL_HANDLE && !entry.evicted) {
+			vkDestroyPipeline(device, pipeline, nullptr);
+		}
+	}
+	for (const auto& shaderModule : shaderModules) {
+		vkDestroyShaderModule(device, shaderModule.second, nullptr);
+	}
+	entries.clear();
+	entriesByHash.clear();
+	pending.clear();
+	shaderModules.clear();
+}
+
+uint32_t PipelineRegistry::find(const PipelineDesc& desc) {
+	std::lock_guard<std::mutex> lock(compileMutex);
+	stats.requests++;
+	auto bucket = entriesByHash.find(desc.hash());
+	if (bucket != entriesByHash.end()) {
+		for (uint32_t id : bucket->second) {
+			if (entries[id].desc == desc) {
+				stats.hits++;
+				return id;
+			}
+		}
+	}
+	return UINT32_MAX;
+}
+
+uint32_t PipelineRegistry::add(const PipelineDesc& desc) {
+	uint32_t id = static_cast<uint32_t>(entries.size());
+	entries.emplace_back();
+	Entry& entry = entries.back();
+	entry.id = id;
+	entry.desc = desc;
+	entry.vertexModule = getShaderModule(desc.vertexShader);
+	entry.fragmentModule = desc.fragmentShader.empty() ? VK_NULL_HANDLE : getShaderModule(desc.fragmentShader);
+	std::lock_guard<std::mutex> lock(compileMutex);
+	entriesByHash[desc.hash()].push_back(id);
+	return id;
+}
+
+uint32_t PipelineRegistry::request(const PipelineDesc& desc) {
+	uint32_t id = find(desc);
+	if (id == UINT32_MAX) {
+		id = add(desc);
+		pending.push_back(id);
+	}
+	return id;
+}
+
+uint32_t PipelineRegistry::requestAsync(const PipelineDesc& desc) {
+	if (compileThreads.empty()) {
+		throw std::runtime_error("Failed to queue pipeline, the registry has no compile threads");
+	}
+
+	uint32_t id = find(desc);
+	if (id == UINT32_MAX) {
+		id = add(desc);
+		{
+			std::lock_guard<std::mutex> lock(compileMutex);
+			compileQueue.push_back(&entries[id]);
+		}
+		compileReady.notify_one();
+	}
+	return id;
+}
+
+void PipelineRegistry::compileLoop(uint32_t thread) {
+	while (true) {
+		// oldest requests first, a few at a time
+		std::vector<Entry*> batch;
+		VkPipelineCache cache = VK_NULL_HANDLE;
+		{
+			std::unique_lock<std::mutex> lock(compileMutex);
+			compileReady.wait(lock, [this] { return stopping || !compileQueue.empty(); });
+			if (compileQueue.empty()) {
+				return;
+			}
+			size_t count = std::min<size_t>(compileQueue.size(), ASYNC_BATCH_SIZE);
+			batch.assign(compileQueue.begin(), compileQueue.begin() + count);
+			compileQueue.erase(compileQueue.begin(), compileQueue.begin() + count);
+			compilesRunning++;
+			// replaced by every merge, only read while holding the lock
+			cache = workerCaches.empty() ? VK_NULL_HANDLE : workerCaches[thread];
+		}
+
+		try {
+			std::vector<VkPipeline> pipelines = createPipelines(batch, cache);
+			for (size_t i = 0; i < pipelines.size(); i++) {
+				batch[i]->pipeline.store(pipelines[i], std::memory_order_release);
+			}
+			published.fetch_add(static_cast<uint32_t>(pipelines.size()), std::memory_order_release);
+			std::lock_guard<std::mutex> lock(compileMutex);
+			stats.asyncCreated += static_cast<uint32_t>(pipelines.size());
+			unmergedPipelines += static_cast<uint32_t>(pipelines.size());
+		} catch (const std::runtime_error& e) {
+			std::cerr << "pipeline registry: " << e.what() << (batch.size() > 1 ? ", retrying one at a time" : "") << std::endl;
+			compileSingly(batch, cache);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(compileMutex);
+			compilesRunning--;
+		}
+		compileIdle.notify_all();
+	}
+}
+
+void PipelineRegistry::compileSingly(const std::vector<Entry*>& batch, VkPipelineCache cache) {
+	for (Entry* entry : batch) {
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if (batch.size() > 1) {
+			try {
+				pipeline = createPipelines({entry}, cache)[0];
+			} catch (const std::runtime_error& e) {
+				std::cerr << "pipeline registry: " << e.what() << std::endl;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(compileMutex);
+		if (pipeline != VK_NULL_HANDLE) {
+			entry->pipeline.store(pipeline, std::memory_order_release);
+			stats.asyncCreated++;
+			unmergedPipelines++;
+		} else {
+			// out of the lookup, so asking for the description again makes a new entry and tries again
+			std::vector<uint32_t>& bucket = entriesByHash[entry->desc.hash()];
+			bucket.erase(std::remove(bucket.begin(), bucket.end(), entry->id), bucket.end());
+			entry->failed.store(true, std::memory_order_release);
+			stats.failed++;
+		}
+		published.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void PipelineRegistry::waitIdle() {
+	std::unique_lock<std::mutex> lock(compileMutex);
+	compileIdle.wait(lock, [this] { return compileQueue.empty() && compilesRunning == 0; });
+	mergeWorkerCaches(true);
+}
+
+void PipelineRegistry::mergeWorkerCaches(bool recreate) {
+	// merging destroys a worker cache, the new one starts from the merged main cache so nothing is merged twice
+	bool merge = unmergedPipelines > 0;
+	for (auto& workerCache : workerCaches) {
+		if (merge || !recreate) {
+			pipelineCache->mergeWorkerCache(workerCache);
+			workerCache = recreate ? pipelineCache->createWorkerCache() : VK_NULL_HANDLE;
+		}
+	}
+	if (!recreate) {
+		workerCaches.clear();
+	}
+	unmergedPipelines = 0;
+}
+
+VkPipeline PipelineRegistry::get(const PipelineDesc& desc) {
+	uint32_t id = request(desc);
+	flush();
+	return getPipeline(id);
+}
+
+VkShaderModule PipelineRegistry::getShaderModule(const std::string& name) {
+	auto it = shaderModules.find(name);
+	if (it != shaderModules.end()) {
+		return it->second;
+	}
+
+	// embedded in the executable unless a shader directory overrides them, no file I/O in the common case
+	auto shaderStart = BenchClock::now();
+	ShaderCode code = shaderLibrary->get(name);
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size;
+	createInfo.pCode = code.code;
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create shader module");
+	}
+	shaderModules[name] = shaderModule;
+	std::lock_guard<std::mutex> lock(compileMutex);
+	stats.shaderMs += elapsedMs(shaderStart, BenchClock::now());
+	return shaderModule;
+}
+
+void PipelineRegistry::flush() {
+	if (pending.empty()) {
+		return;
+	}
+
+	std::vector<Entry*> batch;
+	for (uint32_t id : pending) {
+		batch.push_back(&entries[id]);
+	}
+	// throws with the batch still queued
+	std::vector<VkPipeline> pipelines = createPipelines(batch, pipelineCache ? pipelineCache->get() : VK_NULL_HANDLE);
+	for (size_t i = 0; i < batch.size(); i++) {
+		batch[i]->pipeline.store(pipelines[i], std::memory_order_release);
+	}
+	pending.clear();
+}
+
+std::vector<VkPipeline> PipelineRegistry::createPipelines(const std::vector<Entry*>& batch, VkPipelineCache cache) {
+
+	// - vertex input per layout, shared by every pipeline in the batch
+	auto vertexBinding = Vertex::getBindingDescription();
+	auto vertexAttributes = Vertex::getAttributeDescriptions();
+	auto positionBinding = Vertex::getPositionBindingDescription();
+	auto positionAttribute = Vertex::getPositionAttributeDescription();
+	VkVertexInputBindingDescription instancedBindings[] = {vertexBinding, InstanceData::getBindingDescription()};
+	std::vector<VkVertexInputAttributeDescription> instancedAttributes(vertexAttributes.begin(), vertexAttributes.end());
+	auto instanceAttributes = InstanceData::getAttributeDescriptions();
+	instancedAttributes.insert(instancedAttributes.end(), instanceAttributes.begin(), instanceAttributes.end());
+
+	std::array<VkPipelineVertexInputStateCreateInfo, 4> vertexInputs{};
+	for (auto& vertexInput : vertexInputs) {
+		vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	}
+	VkPipelineVertexInputStateCreateInfo& vertexInput = vertexInputs[static_cast<size_t>(VertexLayout::Vertex)];
+	vertexInput.vertexBindingDescriptionCount = 1;
+	vertexInput.pVertexBindingDescriptions = &vertexBinding;
+	vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributes.size());
+	vertexInput.pVertexAttributeDescriptions = vertexAttributes.data();
+	VkPipelineVertexInputStateCreateInfo& positionInput = vertexInputs[static_cast<size_t>(VertexLayout::Position)];
+	positionInput.vertexBindingDescriptionCount = 1;
+	positionInput.pVertexBindingDescriptions = &positionBinding;
+	positionInput.vertexAttributeDescriptionCount = 1;
+	positionInput.pVertexAttributeDescriptions = &positionAttribute;
+	VkPipelineVertexInputStateCreateInfo& instancedInput = vertexInputs[static_cast<size_t>(VertexLayout::Instanced)];
+	instancedInput.vertexBindingDescriptionCount = static_cast<uint32_t>(std::size(instancedBindings));
+	instancedInput.pVertexBindingDescriptions = instancedBindings;
+	instancedInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(instancedAttributes.size());
+	instancedInput.pVertexAttributeDescriptions = instancedAttributes.data();
+
+	// - state that's the same for every pipeline
+	// viewport and scissor are set while recording (see dynamicStates below), only their count is fixed here
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	// state that is cheap to set per draw and would otherwise mean one pipeline per extent/view layout
+	VkDynamicState dynamicStates[] = {
+		VK_DYNAMIC_STATE_VIEWPORT,
+		VK_DYNAMIC_STATE_SCISSOR,
+		VK_DYNAMIC_STATE_LINE_WIDTH
+	};
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(std::size(dynamicStates));
+	dynamicState.pDynamicStates = dynamicStates;
+
+	// - per pipeline, sized up front so the create infos can point into them
+	struct PipelineState {
+		VkPipelineShaderStageCreateInfo stages[2];
+		VkSpecializationInfo specialization;
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+		VkPipelineRasterizationStateCreateInfo rasterizer;
+		VkPipelineDepthStencilStateCreateInfo depthStencil;
+		VkPipelineColorBlendAttachmentState colorBlendAttachment;
+		VkPipelineColorBlendStateCreateInfo colorBlending;
+		VkPipelineRenderingCreateInfoKHR renderingInfo;
+		VkPipelineCreationFeedbackEXT feedback;
+		VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo;
+	};
+	uint32_t pipelineCount = static_cast<uint32_t>(batch.size());
+	std::vector<PipelineState> states(pipelineCount);
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(pipelineCount);
+
+	// the constants' values are read straight out of the descriptions, only their map entries are built here.
+	// Reserved so the entries never move once the create infos point at them
+	size_t constantCount = 0;
+	for (const Entry* entry : batch) {
+		constantCount += entry->desc.constants.size();
+	}
+	std::vector<VkSpecializationMapEntry> mapEntries;
+	mapEntries.reserve(constantCount);
+
+	for (uint32_t i = 0; i < pipelineCount; i++) {
+		const Entry& entry = *batch[i];
+		const PipelineDesc& desc = entry.desc;
+		PipelineState& state = states[i];
+		state = PipelineState{};
+
+		// both stages share one specialization info, a stage ignores the ids it doesn't declare
+		const VkSpecializationInfo* specialization = nullptr;
+		if (!desc.constants.empty()) {
+			state.specialization.mapEntryCount = static_cast<uint32_t>(desc.constants.size());
+			state.specialization.pMapEntries = mapEntries.data() + mapEntries.size();
+			state.specialization.dataSize = sizeof(SpecializationConstant) * desc.constants.size();
+			state.specialization.pData = desc.constants.data();
+			for (uint32_t c = 0; c < desc.constants.size(); c++) {
+				VkSpecializationMapEntry mapEntry{};
+				mapEntry.constantID = desc.constants[c].id;
+				mapEntry.offset = static_cast<uint32_t>(sizeof(SpecializationConstant) * c + offsetof(SpecializationConstant, value));
+				mapEntry.size = sizeof(uint32_t);
+				mapEntries.push_back(mapEntry);
+			}
+			specialization = &state.specialization;
+		}
+
+		uint32_t stageCount = 0;
+		VkPipelineShaderStageCreateInfo& vertexStage = state.stages[stageCount++];
+		vertexStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		vertexStage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+		vertexStage.module = entry.vertexModule;
+		vertexStage.pName = "main";
+		vertexStage.pSpecializationInfo = specialization;
+		if (entry.fragmentModule != VK_NULL_HANDLE) {
+			VkPipelineShaderStageCreateInfo& fragmentStage = state.stages[stageCount++];
+			fragmentStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			fragmentStage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+			fragmentStage.module = entry.fragmentModule;
+			fragmentStage.pName = "main";
+			fragmentStage.pSpecializationInfo = specialization;
+		}
+
+		state.inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		state.inputAssembly.topology = desc.topology;
+		state.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		state.rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		state.rasterizer.depthClampEnable = VK_FALSE;
+		state.rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		state.rasterizer.polygonMode = desc.polygonMode;
+		state.rasterizer.lineWidth = 1.0f;
+		state.rasterizer.cullMode = desc.cullMode;
+		state.rasterizer.frontFace = desc.frontFace;
+		state.rasterizer.depthBiasEnable = VK_FALSE;
+
+		state.depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		state.depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+		state.depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+		state.depthStencil.depthCompareOp = desc.depthCompare;
+		state.depthStencil.depthBoundsTestEnable = VK_FALSE;
+		state.depthStencil.stencilTestEnable = VK_FALSE;
+
+		state.colorBlendAttachment.colorWriteMask = desc.colorWriteMask;
+		if (desc.blend == BlendMode::Alpha) {
+			state.colorBlendAttachment.blendEnable = VK_TRUE;
+			state.colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+			state.colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+			state.colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+			state.colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			state.colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+			state.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+		}
+
+		state.colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		state.colorBlending.logicOpEnable = VK_FALSE;
+		state.colorBlending.logicOp = VK_LOGIC_OP_COPY;
+		state.colorBlending.attachmentCount = 1;
+		state.colorBlending.pAttachments = &state.colorBlendAttachment;
+
+		VkGraphicsPipelineCreateInfo& pipelineInfo = pipelineInfos[i];
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = stageCount;
+		pipelineInfo.pStages = state.stages;
+		pipelineInfo.pVertexInputState = &vertexInputs[static_cast<size_t>(desc.vertexLayout)];
+		pipelineInfo.pInputAssemblyState = &state.inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &state.rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pDepthStencilState = &state.depthStencil;
+		pipelineInfo.pColorBlendState = &state.colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = desc.layout;
+		pipelineInfo.renderPass = desc.renderPass;
+		pipelineInfo.subpass = 0;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
+
+		// without a render pass the pipeline is built against the attachment formats instead
+		if (desc.renderPass == VK_NULL_HANDLE) {
+			state.renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+			state.renderingInfo.colorAttachmentCount = 1;
+			state.renderingInfo.pColorAttachmentFormats = &desc.colorFormat;
+			state.renderingInfo.depthAttachmentFormat = desc.depthFormat;
+			pipelineInfo.pNext = &state.renderingInfo;
+		}
+
+		// ask the driver whether each pipeline came out of the cache
+		if (creationFeedback) {
+			state.feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+			state.feedbackInfo.pPipelineCreationFeedback = &state.feedback;
+			state.feedbackInfo.pNext = pipelineInfo.pNext;
+			pipelineInfo.pNext = &state.feedbackInfo;
+		}
+	}
+
+	// one call for all of them, drivers can compile a batch in parallel
+	std::vector<VkPipeline> pipelines(pipelineCount);
+	auto compileStart = BenchClock::now();
+	VkResult result = vkCreateGraphicsPipelines(device, cache, pipelineCount,
+	                                            pipelineInfos.data(), nullptr, pipelines.data());
+	double compileMs = elapsedMs(compileStart, BenchClock::now());
+	if (result != VK_SUCCESS) {
+		// some may have been created before the failure
+		for (VkPipeline pipeline : pipelines) {
+			vkDestroyPipeline(device, pipeline, nullptr);
+		}
+		throw std::runtime_error("Failed to create graphics pipelines");
+	}
+
+	if (creationFeedback) {
+		for (const auto& state : states) {
+			pipelineCache->recordFeedback(state.feedback);
+		}
+	}
+	std::lock_guard<std::mutex> lock(compileMutex);
+	stats.compileMs += compileMs;
+	stats.batches++;
+	stats.created += pipelineCount;
+	stats.pipelines += pipelineCount;
+	return pipelines;
+}
+
+std::vector<VkPipeline> PipelineRegistry::evict(const std::function<bool(const PipelineDesc&)>& match) {
+	// nothing may be published into an entry after it's gone
+	waitIdle();
+
+	std::vector<VkPipeline> evicted;
+	std::lock_guard<std::mutex> lock(compileMutex);
+	for (uint32_t id = 0; id < entries.size(); id++) {
+		Entry& entry = entries[id];
+		VkPipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+		if (entry.evicted || pipeline == VK_NULL_HANDLE || !match(entry.desc)) {
+			continue;
+		}
+
+		// the entry itself stays so ids keep their meaning, it just can't be found anymore
+		std::vector<uint32_t>& bucket = entriesByHash[entry.desc.hash()];
+		bucket.erase(std::find(bucket.begin(), bucket.end(), id));
+		evicted.push_back(pipeline);
+		entry.pipeline.store(VK_NULL_HANDLE, std::memory_order_release);
+		entry.evicted = true;
+		stats.pipelines--;
+	}
+	return evicted;
+}
+
+PipelineRegistryStats PipelineRegistry::getStats() const {
+	std::lock_guard<std::mutex> lock(compileMutex);
+	return stats;
+}
+
+void PipelineRegistry::resetStats() {
+	std::lock_guard<std::mutex> lock(compileMutex);
+	uint32_t pipelines = stats.pipelines;
+	stats = PipelineRegistryStats();
+	stats.pipelines = pipelines;
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+
+class JsonWriter;
+
+// vertex streams a pipeline reads, see Mesh.h
+enum class VertexLayout : uint8_t {
+	None,			// no vertex input, everything comes from gl_VertexIndex or buffers
+	Vertex,			// Vertex, binding 0
+	Position,		// positions only, the depth prepass stream
+	Instanced		// Vertex plus InstanceData per instance at binding 1
+};
+
+enum class BlendMode : uint8_t {
+	Opaque,
+	Alpha			// src alpha / one minus src alpha on color, alpha written as is
+};
+
+// one specialization constant, by its constant_id. Bools are VkBool32 and floats go in as their bits
+struct SpecializationConstant {
+	uint32_t id = 0;
+	uint32_t value = 0;
+
+	bool operator==(const SpecializationConstant& other) const { return id == other.id && value == other.value; }
+};
+
+// Everything that makes one graphics pipeline different from another. Viewport, scissor and line width are
+// always dynamic so they're not part of it. Two descriptions that compare equal share one VkPipeline.
+struct PipelineDesc {
+	// - shaders, ShaderLibrary names. No fragment shader makes a depth-only pipeline
+	std::string vertexShader;
+	std::string fragmentShader;
+
+	// specialization constants for both stages, sorted by id (setConstant keeps them that way) so the same
+	// permutation always compares equal. Ids a shader doesn't declare are ignored by it
+	std::vector<SpecializationConstant> constants;
+
+	VertexLayout vertexLayout = VertexLayout::Vertex;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	// - rasterization
+	VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+	// - depth and color
+	bool depthTest = true;
+	bool depthWrite = true;
+	VkCompareOp depthCompare = VK_COMPARE_OP_LESS;
+	BlendMode blend = BlendMode::Alpha;
+	VkColorComponentFlags colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+	// - render targets, a null render pass builds for dynamic rendering with these formats
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+
+	// FNV-1a over the fields, so it's the same in every run for the same description. The layout and render
+	// pass handles aren't hashed (they're different every run), only compared
+	uint64_t hash() const;
+	bool operator==(const PipelineDesc& other) const;
+	bool operator!=(const PipelineDesc& other) const { return !(*this == other); }
+
+	// adds the constant or replaces its value
+	void setConstant(uint32_t id, uint32_t value);
+};
+
+struct PipelineRegistryStats {
+	uint64_t requests = 0;
+	uint64_t hits = 0;				// requests answered with a pipeline that exists or is already queued
+	uint32_t pipelines = 0;			// alive, not counting evicted ones
+	uint32_t created = 0;
+	uint32_t batches = 0;			// vkCreateGraphicsPipelines calls
+	uint32_t asyncCreated = 0;		// of created, how many on the compile threads
+	uint32_t failed = 0;			// pipelines the compile threads couldn't create, even on their own
+	double compileMs = 0.0;			// inside vkCreateGraphicsPipelines, summed over all threads
+	double shaderMs = 0.0;			// getting the SPIR-V and creating shader modules
+
+	double hitRate() const { return requests > 0 ? static_cast<double>(hits) / requests : 0.0; }
+	// writes the fields as members of the currently open JSON object
+	void writeJson(JsonWriter& json) const;
+};
+
+// Owns the graphics pipelines. Asking for a description that's been asked for before returns the existing
+// pipeline; new ones are queued and created together by flush, in a single vkCreateGraphicsPipelines call the
+// driver can spread over its own threads. Shader modules are created on first use and kept.
+//
+// requestAsync hands new pipelines to the registry's compile threads instead, so the caller never waits on the
+// driver. Each pipeline is published with an atomic store once it's compiled; until then getPipeline returns
+// null and the caller decides what to draw instead. A pipeline that fails to compile stays null, isFailed tells
+// it apart and asking for its description again tries once more. Each compile thread has its own worker pipeline
+// cache, merged into the main one by waitIdle and destroy. Everything but getPipeline, isFailed and
+// getPublishedCount is for the thread that calls init only.
+class PipelineRegistry {
+public:
+	// pipelineCache may be null (no cache, no creation feedback). The compile threads are only started when
+	// compileThreads > 0, requestAsync needs at least one
+	void init(VkDevice device, ShaderLibrary& shaderLibrary, PipelineCache* pipelineCache, bool creationFeedback,
+	          uint32_t compileThreads = 0);
+	// drops what's still waiting to compile, stops the compile threads, then destroys the pipelines it still owns
+	// (not the evicted ones) and the shader modules
+	void destroy();
+
+	// id of the description's pipeline, queued for the next flush if it's new. Ids stay valid until evicted
+	uint32_t request(const PipelineDesc& desc);
+	// creates everything queued with one call
+	void flush();
+	// request plus flush
+	VkPipeline get(const PipelineDesc& desc);
+
+	// like request, but a new pipeline is compiled in the background and shows up in getPipeline when it's done
+	uint32_t requestAsync(const PipelineDesc& desc);
+	// blocks until the compile threads have nothing left to do, then merges what they compiled into the main cache
+	void waitIdle();
+	// pipelines the compile threads have published (or given up on) so far, when it changes some getPipeline
+	// or isFailed result did
+	uint32_t getPublishedCount() const { return published.load(std::memory_order_acquire); }
+
+	// null while the pipeline is still queued or compiling
+	VkPipeline getPipeline(uint32_t id) const { return entries[id].pipeline.load(std::memory_order_acquire); }
+	// the compile threads couldn't create it, the pipeline stays null for good
+	bool isFailed(uint32_t id) const { return entries[id].failed.load(std::memory_order_acquire); }
+
+	// drops the pipelines whose description matches and hands them over, for the caller to destroy once no
+	// frame uses them anymore (e.g. everything built for a swap chain format that's gone). Waits for the compile
+	// threads first
+	std::vector<VkPipeline> evict(const std::function<bool(const PipelineDesc&)>& match);
+
+	PipelineRegistryStats getStats() const;
+	void resetStats();
+
+	// the most pipelines one compile thread creates with one call, small so a few slow pipelines don't hold
+	// back the ones queued with them
+	static const uint32_t ASYNC_BATCH_SIZE = 4;
+
+private:
+	struct Entry {
+		uint32_t id = 0;		// own index, so compile threads never index entries while the render thread grows it
+		PipelineDesc desc;
+		VkShaderModule vertexModule = VK_NULL_HANDLE;		// looked up on request, the compile threads only read them
+		VkShaderModule fragmentModule = VK_NULL_HANDLE;
+		std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+		std::atomic<bool> failed{false};
+		bool evicted = false;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	ShaderLibrary* shaderLibrary = nullptr;
+	PipelineCache* pipelineCache = nullptr;
+	bool creationFeedback = false;
+
+	// a deque so entries never move, the compile threads hold pointers to them
+	std::deque<Entry> entries;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> entriesByHash;
+	std::vector<uint32_t> pending;
+	std::unordered_map<std::string, VkShaderModule> shaderModules;
+
+	// - compile threads, compileMutex also guards stats and entriesByHash
+	std::vector<std::thread> compileThreads;
+	std::vector<VkPipelineCache> workerCaches;		// one per compile thread, none without a pipeline cache
+	uint32_t unmergedPipelines = 0;					// created into the worker caches since the last merge
+	mutable std::mutex compileMutex;
+	std::condition_variable compileReady;
+	std::condition_variable compileIdle;
+	std::vector<Entry*> compileQueue;
+	uint32_t compilesRunning = 0;
+	bool stopping = false;
+	std::atomic<uint32_t> published{0};
+	PipelineRegistryStats stats;
+
+	uint32_t find(const PipelineDesc& desc);
+	uint32_t add(const PipelineDesc& desc);
+	VkShaderModule getShaderModule(const std::string& name);
+	// one vkCreateGraphicsPipelines call for the batch, throws if it fails. Safe on any thread
+	std::vector<VkPipeline> createPipelines(const std::vector<Entry*>& batch, VkPipelineCache cache);
+	void compileLoop(uint32_t thread);
+	// the batch one at a time after it failed as a whole, so one bad pipeline doesn't take the others with it
+	void compileSingly(const std::vector<Entry*>& batch, VkPipelineCache cache);
+	// folds the worker caches into the main one, the compile threads must be idle
+	void mergeWorkerCaches(bool recreate);
+};
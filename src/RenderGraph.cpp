@@ -0,0 +1,760 @@
+#include "RenderGraph.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+// access bits that are writes, only those have to be made available by a barrier
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+struct AccessInfo {
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	VkImageLayout layout;
+	VkImageUsageFlags usage;
+	bool write;
+};
+
+static AccessInfo getAccessInfo(ResourceAccess access) {
+	const VkPipelineStageFlags fragmentTests = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	switch (access) {
+	case ResourceAccess::ColorAttachmentWrite:
+		return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+	case ResourceAccess::DepthAttachmentWrite:
+		return {fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true};
+	case ResourceAccess::DepthAttachmentRead:
+		return {fragmentTests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+		        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false};
+	case ResourceAccess::VertexShaderRead:
+		return {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+	case ResourceAccess::FragmentShaderRead:
+		return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+	case ResourceAccess::ComputeShaderRead:
+		return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+		        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+	case ResourceAccess::ComputeShaderWrite:
+		return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true};
+	case ResourceAccess::IndirectRead:
+		return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		        VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+	case ResourceAccess::TransferRead:
+		return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+		        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+	case ResourceAccess::TransferWrite:
+		return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true};
+	case ResourceAccess::Present:
+		// presentation engine reads are ordered by the semaphore, the barrier only has to change the layout
+		return {0, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, false};
+	case ResourceAccess::None:
+	default:
+		return {0, 0, VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+	}
+}
+
+static VkImageAspectFlags getAspect(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+void RenderGraphStats::writeJson(JsonWriter& json) const {
+	json.value("passes", passes);
+	json.value("culled_passes", culledPasses);
+	json.value("barriers", barriers);
+	json.value("image_barriers", imageBarriers);
+	json.value("memory_barriers", memoryBarriers);
+	json.value("transient_images", transientImages);
+	json.value("transient_bytes", static_cast<uint64_t>(transientBytes));
+	json.value("allocated_bytes", static_cast<uint64_t>(allocatedBytes));
+	json.value("aliased_bytes_saved", static_cast<uint64_t>(aliasedBytesSaved()));
+	json.value("synchronization2", synchronization2);
+}
+
+void RenderGraph::PassBuilder::read(RenderGraphResource resource, ResourceAccess access) {
+	use(resource, access, false);
+}
+
+void RenderGraph::PassBuilder::write(RenderGraphResource resource, ResourceAccess access) {
+	use(resource, access, true);
+}
+
+void RenderGraph::PassBuilder::setSideEffects() {
+	graph.passes[pass].sideEffects = true;
+}
+
+void RenderGraph::PassBuilder::use(RenderGraphResource resource, ResourceAccess access, bool write) {
+	Pass& declaring = graph.passes[pass];
+	if (!resource.isValid() || resource.index >= graph.resourceCount) {
+		throw std::runtime_error(std::string("Failed to declare render graph pass ") + declaring.name + ": unknown resource");
+	}
+
+	Resource& target = graph.resources[resource.index];
+	AccessInfo info = getAccessInfo(access);
+	if (info.write != write || info.stages == 0) {
+		throw std::runtime_error(std::string("Failed to declare render graph pass ") + declaring.name + ": access to "
+		                         + target.name + " doesn't match read/write");
+	}
+
+	Use declared;
+	declared.resource = resource.index;
+	declared.stages = info.stages;
+	declared.access = info.access;
+	declared.layout = target.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	declared.write = info.write;
+	if (!target.imported) {
+		target.usage |= info.usage;
+	}
+
+	// several uses of one resource in a pass are a single use as far as barriers go, so they have to agree on the layout
+	for (Use& existing : declaring.uses) {
+		if (existing.resource == resource.index) {
+			if (existing.layout != declared.layout) {
+				throw std::runtime_error(std::string("Failed to declare render graph pass ") + declaring.name + ": "
+				                         + target.name + " is used in two layouts");
+			}
+			existing.stages |= declared.stages;
+			existing.access |= declared.access;
+			existing.write |= declared.write;
+			return;
+		}
+	}
+	declaring.uses.push_back(declared);
+}
+
+void RenderGraph::init(VkDevice newDevice, DeviceAllocator& newAllocator, uint32_t framesInFlight, bool useSynchronization2) {
+	device = newDevice;
+	allocator = &newAllocator;
+	frameResources.resize(framesInFlight);
+
+	// extension commands aren't exported by the loader
+	cmdPipelineBarrier2 = nullptr;
+	if (useSynchronization2) {
+		cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+	}
+	synchronization2 = cmdPipelineBarrier2 != nullptr;
+	stats.synchronization2 = synchronization2;
+}
+
+void RenderGraph::destroy() {
+	for (auto& frame : frameResources) {
+		destroyTransients(frame);
+	}
+	frameResources.clear();
+}
+
+void RenderGraph::beginFrame(uint32_t newFrameSlot) {
+	frameSlot = newFrameSlot;
+	passCount = 0;
+	resourceCount = 0;
+	compiled = false;
+}
+
+RenderGraph::Resource& RenderGraph::addResource(const char* name) {
+	if (resourceCount == resources.size()) {
+		resources.emplace_back();
+	}
+
+	// start over but keep the readers' capacity
+	Resource& resource = resources[resourceCount++];
+	std::vector<uint32_t> readers = std::move(resource.readers);
+	resource = Resource();
+	resource.readers = std::move(readers);
+	resource.readers.clear();
+	resource.name = name;
+	return resource;
+}
+
+RenderGraphResource RenderGraph::importImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect,
+                                             VkImageLayout initialLayout, VkPipelineStageFlags initialStages, ResourceAccess finalAccess) {
+	Resource& resource = addResource(name);
+	resource.imported = true;
+	resource.image = image;
+	resource.view = view;
+	resource.aspect = aspect;
+	resource.initialLayout = initialLayout;
+	resource.initialStages = initialStages;
+	resource.finalAccess = finalAccess;
+	return {resourceCount - 1};
+}
+
+RenderGraphResource RenderGraph::importBuffer(const char* name, VkBuffer buffer, ResourceAccess finalAccess) {
+	Resource& resource = addResource(name);
+	resource.imported = true;
+	resource.isImage = false;
+	resource.buffer = buffer;
+	resource.finalAccess = finalAccess;
+	return {resourceCount - 1};
+}
+
+RenderGraphResource RenderGraph::createImage(const char* name, VkFormat format, VkExtent2D extent) {
+	Resource& resource = addResource(name);
+	resource.format = format;
+	resource.extent = extent;
+	resource.aspect = getAspect(format);
+	return {resourceCount - 1};
+}
+
+void RenderGraph::addPass(const char* name, const SetupFunction& setup, ExecuteFunction execute) {
+	if (passCount == passes.size()) {
+		passes.emplace_back();
+	}
+
+	Pass& pass = passes[passCount++];
+	pass.name = name;
+	pass.execute = std::move(execute);
+	pass.uses.clear();
+	pass.sideEffects = false;
+
+	PassBuilder builder(*this, passCount - 1);
+	setup(builder);
+}
+
+void RenderGraph::compile() {
+	stats = RenderGraphStats();
+	stats.synchronization2 = synchronization2;
+	stats.passes = passCount;
+
+	buildDependencies();
+	cull();
+	schedule();
+
+	// lifetimes in execution order, what aliasing is decided on
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		resources[r].firstUse = UINT32_MAX;
+		resources[r].lastUse = 0;
+	}
+	for (uint32_t position = 0; position < order.size(); position++) {
+		for (const Use& use : passes[order[position]].uses) {
+			Resource& resource = resources[use.resource];
+			if (resource.firstUse == UINT32_MAX) {
+				resource.firstUse = position;
+				if (!resource.imported && !use.write) {
+					throw std::runtime_error(std::string("Failed to compile render graph: ") + resource.name + " is read before anything writes it");
+				}
+			}
+			resource.lastUse = position;
+		}
+	}
+
+	allocateTransients();
+	planBarriers();
+	compiled = true;
+}
+
+void RenderGraph::buildDependencies() {
+	// passes are declared in submission order, so a read sees the last write declared before it
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		resources[r].lastWriter = UINT32_MAX;
+		resources[r].readers.clear();
+	}
+
+	for (uint32_t p = 0; p < passCount; p++) {
+		Pass& pass = passes[p];
+		pass.producers.clear();
+		pass.readsBefore.clear();
+
+		for (const Use& use : pass.uses) {
+			Resource& resource = resources[use.resource];
+			// overwriting counts as depending on the last writer too: attachments may be loaded, and writes stay in order
+			if (resource.lastWriter != UINT32_MAX) {
+				pass.producers.push_back(resource.lastWriter);
+			}
+
+			if (use.write) {
+				pass.readsBefore.insert(pass.readsBefore.end(), resource.readers.begin(), resource.readers.end());
+				resource.readers.clear();
+				resource.lastWriter = p;
+			} else {
+				resource.readers.push_back(p);
+			}
+		}
+	}
+}
+
+void RenderGraph::cull() {
+	// everything the graph hands back (imported resources with a final access) or that has side effects is needed,
+	// and so is everything those passes depend on
+	std::vector<uint32_t>& pending = cullStack;
+	pending.clear();
+
+	for (uint32_t p = 0; p < passCount; p++) {
+		passes[p].kept = false;
+		passes[p].position = UINT32_MAX;
+		if (passes[p].sideEffects) {
+			pending.push_back(p);
+		}
+	}
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		const Resource& resource = resources[r];
+		if (resource.imported && resource.finalAccess != ResourceAccess::None && resource.lastWriter != UINT32_MAX) {
+			pending.push_back(resource.lastWriter);
+		}
+	}
+
+	while (!pending.empty()) {
+		uint32_t p = pending.back();
+		pending.pop_back();
+		if (passes[p].kept) {
+			continue;
+		}
+		passes[p].kept = true;
+		pending.insert(pending.end(), passes[p].producers.begin(), passes[p].producers.end());
+	}
+
+	for (uint32_t p = 0; p < passCount; p++) {
+		stats.culledPasses += !passes[p].kept;
+	}
+}
+
+void RenderGraph::schedule() {
+	// topological order of the kept passes. Of the passes that are ready, the one whose inputs were produced most
+	// recently goes first: consumers run right after their producers, which keeps transient lifetimes short and lets
+	// more of them share memory. Ties keep the declaration order
+	order.clear();
+	uint32_t keptCount = passCount - stats.culledPasses;
+
+	while (order.size() < keptCount) {
+		uint32_t best = UINT32_MAX;
+		int64_t bestReadyAt = -2;
+
+		for (uint32_t p = 0; p < passCount; p++) {
+			const Pass& pass = passes[p];
+			if (!pass.kept || pass.position != UINT32_MAX) {
+				continue;
+			}
+
+			bool ready = true;
+			int64_t readyAt = -1;
+			auto check = [&](const std::vector<uint32_t>& dependencies) {
+				for (uint32_t dependency : dependencies) {
+					if (!passes[dependency].kept) {
+						continue;		// a culled reader doesn't hold anything up
+					}
+					if (passes[dependency].position == UINT32_MAX) {
+						ready = false;
+						return;
+					}
+					readyAt = std::max<int64_t>(readyAt, passes[dependency].position);
+				}
+			};
+			check(pass.producers);
+			if (ready) {
+				check(pass.readsBefore);
+			}
+
+			if (ready && readyAt > bestReadyAt) {
+				best = p;
+				bestReadyAt = readyAt;
+			}
+		}
+
+		// dependencies only ever point at earlier declarations, so something is always ready
+		if (best == UINT32_MAX) {
+			throw std::runtime_error("Failed to compile render graph: dependency cycle");
+		}
+		passes[best].position = static_cast<uint32_t>(order.size());
+		order.push_back(best);
+	}
+}
+
+void RenderGraph::allocateTransients() {
+	FrameResources& frame = frameResources[frameSlot];
+
+	transientKeys.clear();
+	transientResources.clear();
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		Resource& resource = resources[r];
+		if (resource.imported || resource.firstUse == UINT32_MAX) {
+			continue;		// culled along with every pass using it
+		}
+		resource.transient = static_cast<uint32_t>(transientKeys.size());
+		transientKeys.push_back({resource.format, resource.extent, resource.usage, resource.firstUse, resource.lastUse});
+		transientResources.push_back(r);
+	}
+
+	// the common case: the slot declared exactly the same thing last time
+	if (transientKeys == frame.keys) {
+		stats.transientImages = static_cast<uint32_t>(frame.images.size());
+		stats.transientBytes = frame.transientBytes;
+		stats.allocatedBytes = frame.allocatedBytes;
+		return;
+	}
+
+	// the slot's fence has been waited on, nothing on the GPU uses its images anymore
+	destroyTransients(frame);
+	frame.keys = transientKeys;
+	frame.images.resize(transientKeys.size());
+
+	for (size_t i = 0; i < transientKeys.size(); i++) {
+		const TransientKey& key = transientKeys[i];
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = key.format;
+		imageInfo.extent = {key.extent.width, key.extent.height, 1};
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = key.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(device, &imageInfo, nullptr, &frame.images[i].image) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create render graph image");
+		}
+		vkGetImageMemoryRequirements(device, frame.images[i].image, &frame.images[i].requirements);
+		frame.transientBytes += frame.images[i].requirements.size;
+	}
+
+	// biggest first, each into the first heap that's free for its whole lifetime
+	std::vector<uint32_t> bySize(transientKeys.size());
+	for (uint32_t i = 0; i < bySize.size(); i++) {
+		bySize[i] = i;
+	}
+	std::sort(bySize.begin(), bySize.end(), [&](uint32_t a, uint32_t b) {
+		return frame.images[a].requirements.size > frame.images[b].requirements.size;
+	});
+
+	for (uint32_t i : bySize) {
+		TransientImage& image = frame.images[i];
+		const TransientKey& key = transientKeys[i];
+
+		uint32_t heapIndex = 0;
+		for (; heapIndex < frame.heaps.size(); heapIndex++) {
+			const TransientHeap& heap = frame.heaps[heapIndex];
+			if ((heap.memoryTypeBits & image.requirements.memoryTypeBits) == 0) {
+				continue;
+			}
+			bool overlaps = std::any_of(heap.images.begin(), heap.images.end(), [&](uint32_t other) {
+				return transientKeys[other].firstUse <= key.lastUse && key.firstUse <= transientKeys[other].lastUse;
+			});
+			if (!overlaps) {
+				break;
+			}
+		}
+		if (heapIndex == frame.heaps.size()) {
+			frame.heaps.emplace_back();
+		}
+
+		TransientHeap& heap = frame.heaps[heapIndex];
+		heap.size = std::max(heap.size, image.requirements.size);
+		heap.alignment = std::max(heap.alignment, image.requirements.alignment);
+		heap.memoryTypeBits &= image.requirements.memoryTypeBits;
+		heap.images.push_back(i);
+		image.heap = heapIndex;
+	}
+
+	for (TransientHeap& heap : frame.heaps) {
+		VkMemoryRequirements requirements{};
+		requirements.size = heap.size;
+		requirements.alignment = heap.alignment;
+		requirements.memoryTypeBits = heap.memoryTypeBits;
+		heap.allocation = allocator->allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceKind::Optimal);
+		frame.allocatedBytes += heap.size;
+
+		// whoever used the memory last has to be done with it before the next image's first use
+		for (uint32_t i : heap.images) {
+			uint32_t firstUse = transientKeys[i].firstUse;
+			TransientImage& image = frame.images[i];
+			for (uint32_t other : heap.images) {
+				if (transientKeys[other].lastUse < firstUse
+					&& (image.aliasPredecessor == UINT32_MAX || transientKeys[other].lastUse > transientKeys[image.aliasPredecessor].lastUse)) {
+					image.aliasPredecessor = other;
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < frame.images.size(); i++) {
+		TransientImage& image = frame.images[i];
+		const TransientHeap& heap = frame.heaps[image.heap];
+		if (vkBindImageMemory(device, image.image, heap.allocation.memory, heap.allocation.offset) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to bind render graph image memory");
+		}
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = image.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = transientKeys[i].format;
+		viewInfo.subresourceRange.aspectMask = resources[transientResources[i]].aspect;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.layerCount = 1;
+		if (vkCreateImageView(device, &viewInfo, nullptr, &image.view) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create render graph image view");
+		}
+	}
+
+	stats.transientImages = static_cast<uint32_t>(frame.images.size());
+	stats.transientBytes = frame.transientBytes;
+	stats.allocatedBytes = frame.allocatedBytes;
+}
+
+void RenderGraph::destroyTransients(FrameResources& frame) {
+	for (auto& image : frame.images) {
+		vkDestroyImageView(device, image.view, nullptr);
+		vkDestroyImage(device, image.image, nullptr);
+	}
+	for (auto& heap : frame.heaps) {
+		allocator->free(heap.allocation);
+	}
+	frame.keys.clear();
+	frame.images.clear();
+	frame.heaps.clear();
+	frame.transientBytes = 0;
+	frame.allocatedBytes = 0;
+}
+
+void RenderGraph::planBarriers() {
+	const FrameResources& frame = frameResources[frameSlot];
+
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		Resource& resource = resources[r];
+		resource.state = ResourceState();
+		if (resource.imported) {
+			resource.state.layout = resource.isImage ? resource.initialLayout : VK_IMAGE_LAYOUT_UNDEFINED;
+			resource.state.writeStages = resource.initialStages;
+		}
+	}
+
+	auto countBatch = [this](const std::vector<Barrier>& batch) {
+		if (batch.empty()) {
+			return;
+		}
+		stats.barriers++;
+		bool memoryBarrier = false;
+		for (const Barrier& barrier : batch) {
+			if (resources[barrier.resource].isImage) {
+				stats.imageBarriers++;
+			} else {
+				memoryBarrier = true;
+			}
+		}
+		stats.memoryBarriers += memoryBarrier;
+	};
+
+	for (uint32_t position = 0; position < order.size(); position++) {
+		Pass& pass = passes[order[position]];
+		pass.barriers.clear();
+
+		for (const Use& use : pass.uses) {
+			Resource& resource = resources[use.resource];
+
+			// an aliased image starts out where the previous user of its memory left off, so the first use waits for that
+			if (!resource.imported && resource.firstUse == position) {
+				uint32_t predecessor = frame.images[resource.transient].aliasPredecessor;
+				if (predecessor != UINT32_MAX) {
+					const ResourceState& previous = resources[transientResources[predecessor]].state;
+					resource.state.writeStages = previous.writeStages | previous.readStages;
+					resource.state.writeAccess = previous.writeAccess;
+				}
+			}
+			transition(pass.barriers, use);
+		}
+		countBatch(pass.barriers);
+	}
+
+	// hand imported resources back the way their owner expects them
+	finalBarriers.clear();
+	for (uint32_t r = 0; r < resourceCount; r++) {
+		const Resource& resource = resources[r];
+		if (!resource.imported || resource.finalAccess == ResourceAccess::None) {
+			continue;
+		}
+
+		AccessInfo info = getAccessInfo(resource.finalAccess);
+		Use handBack;
+		handBack.resource = r;
+		handBack.stages = info.stages;
+		handBack.access = info.access;
+		handBack.layout = resource.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+		handBack.write = info.write;
+		transition(finalBarriers, handBack);
+	}
+	countBatch(finalBarriers);
+}
+
+void RenderGraph::transition(std::vector<Barrier>& batch, const Use& use) {
+	Resource& resource = resources[use.resource];
+	ResourceState& state = resource.state;
+	bool layoutChange = resource.isImage && use.layout != state.layout;
+
+	Barrier barrier;
+	barrier.resource = use.resource;
+	barrier.srcAccess = state.writeAccess;
+	barrier.dstStages = use.stages;
+	barrier.dstAccess = use.access;
+	barrier.oldLayout = state.layout;
+	barrier.newLayout = use.layout;
+
+	if (layoutChange || use.write) {
+		// write-after-write, write-after-read or a layout transition (which writes too): wait for everything since the
+		// last write. Reads only need an execution dependency
+		barrier.srcStages = state.writeStages | state.readStages;
+		if (layoutChange || barrier.srcStages != 0) {
+			batch.push_back(barrier);
+		}
+
+		state.layout = use.layout;
+		state.writeStages = use.stages;
+		state.writeAccess = use.write ? use.access & WRITE_ACCESS : 0;
+		state.readStages = 0;
+		state.visibleStages = use.stages;
+		return;
+	}
+
+	// read-after-write: only stages that haven't seen the last write yet need a barrier, later reads in them are free
+	if (state.writeStages != 0 && (use.stages & ~state.visibleStages) != 0) {
+		barrier.srcStages = state.writeStages;
+		batch.push_back(barrier);
+		state.visibleStages |= use.stages;
+	}
+	state.readStages |= use.stages;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+	if (!compiled) {
+		throw std::runtime_error("Failed to execute render graph: compile it first");
+	}
+
+	for (uint32_t p : order) {
+		recordBarriers(commandBuffer, passes[p].barriers);
+		if (passes[p].execute) {
+			passes[p].execute(commandBuffer);
+		}
+	}
+	recordBarriers(commandBuffer, finalBarriers);
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& batch) {
+	if (batch.empty()) {
+		return;
+	}
+
+	// buffers are merged into one global memory barrier, per-buffer barriers buy nothing on current hardware
+	if (synchronization2) {
+		imageBarriers2.clear();
+		VkMemoryBarrier2KHR memoryBarrier{};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+		bool hasMemoryBarrier = false;
+
+		for (const Barrier& barrier : batch) {
+			// synchronization2 stage and access bits share their values with the original ones
+			if (!resources[barrier.resource].isImage) {
+				memoryBarrier.srcStageMask |= barrier.srcStages;
+				memoryBarrier.srcAccessMask |= barrier.srcAccess;
+				memoryBarrier.dstStageMask |= barrier.dstStages;
+				memoryBarrier.dstAccessMask |= barrier.dstAccess;
+				hasMemoryBarrier = true;
+				continue;
+			}
+
+			VkImageMemoryBarrier2KHR imageBarrier{};
+			imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+			imageBarrier.srcStageMask = barrier.srcStages;
+			imageBarrier.srcAccessMask = barrier.srcAccess;
+			imageBarrier.dstStageMask = barrier.dstStages;
+			imageBarrier.dstAccessMask = barrier.dstAccess;
+			imageBarrier.oldLayout = barrier.oldLayout;
+			imageBarrier.newLayout = barrier.newLayout;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = getImage({barrier.resource});
+			imageBarrier.subresourceRange = {resources[barrier.resource].aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+			imageBarriers2.push_back(imageBarrier);
+		}
+
+		VkDependencyInfoKHR dependencyInfo{};
+		dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+		dependencyInfo.memoryBarrierCount = hasMemoryBarrier ? 1 : 0;
+		dependencyInfo.pMemoryBarriers = &memoryBarrier;
+		dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers2.size());
+		dependencyInfo.pImageMemoryBarriers = imageBarriers2.data();
+		cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+		return;
+	}
+
+	// without synchronization2 a batch shares one pair of stage masks, and "no stage" has to be spelled TOP/BOTTOM_OF_PIPE
+	imageBarriers.clear();
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	bool hasMemoryBarrier = false;
+	VkPipelineStageFlags srcStages = 0;
+	VkPipelineStageFlags dstStages = 0;
+
+	for (const Barrier& barrier : batch) {
+		srcStages |= barrier.srcStages;
+		dstStages |= barrier.dstStages;
+		if (!resources[barrier.resource].isImage) {
+			memoryBarrier.srcAccessMask |= barrier.srcAccess;
+			memoryBarrier.dstAccessMask |= barrier.dstAccess;
+			hasMemoryBarrier = true;
+			continue;
+		}
+
+		VkImageMemoryBarrier imageBarrier{};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.srcAccessMask = barrier.srcAccess;
+		imageBarrier.dstAccessMask = barrier.dstAccess;
+		imageBarrier.oldLayout = barrier.oldLayout;
+		imageBarrier.newLayout = barrier.newLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = getImage({barrier.resource});
+		imageBarrier.subresourceRange = {resources[barrier.resource].aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+		imageBarriers.push_back(imageBarrier);
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+	                     srcStages != 0 ? srcStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+	                     dstStages != 0 ? dstStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT),
+	                     0, hasMemoryBarrier ? 1 : 0, &memoryBarrier, 0, nullptr,
+	                     static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource resource) const {
+	const Resource& target = resources[resource.index];
+	if (target.imported || target.transient == UINT32_MAX) {
+		return target.image;
+	}
+	return frameResources[frameSlot].images[target.transient].image;
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphResource resource) const {
+	const Resource& target = resources[resource.index];
+	if (target.imported || target.transient == UINT32_MAX) {
+		return target.view;
+	}
+	return frameResources[frameSlot].images[target.transient].view;
+}
+
+VkBuffer RenderGraph::getBuffer(RenderGraphResource resource) const {
+	return resources[resource.index].buffer;
+}
+
+std::vector<const char*> RenderGraph::getExecutionOrder() const {
+	std::vector<const char*> names;
+	for (uint32_t p : order) {
+		names.push_back(passes[p].name);
+	}
+	return names;
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "DeviceAllocator.h"
+
+class JsonWriter;
+
+// how a pass uses a resource, decides the layout an image has to be in and what the barrier in front of the pass waits for
+enum class ResourceAccess {
+	None,					// only as an imported resource's final access: nothing after the graph cares about it
+	ColorAttachmentWrite,
+	DepthAttachmentWrite,
+	DepthAttachmentRead,	// depth test without depth writes
+	VertexShaderRead,		// sampled image, uniform or storage buffer
+	FragmentShaderRead,
+	ComputeShaderRead,
+	ComputeShaderWrite,		// storage image or buffer
+	IndirectRead,			// indirect draw arguments and counts
+	TransferRead,
+	TransferWrite,
+	Present
+};
+
+// handle to a resource declared in the current frame's graph
+struct RenderGraphResource {
+	uint32_t index = UINT32_MAX;
+	bool isValid() const { return index != UINT32_MAX; }
+};
+
+struct RenderGraphStats {
+	uint32_t passes = 0;
+	uint32_t culledPasses = 0;			// nothing that is kept depends on what they write
+	uint32_t barriers = 0;				// pipeline barrier commands recorded, each one a batch
+	uint32_t imageBarriers = 0;
+	uint32_t memoryBarriers = 0;		// buffer hazards, merged into one global memory barrier per batch
+	uint32_t transientImages = 0;
+	VkDeviceSize transientBytes = 0;	// memory the transient images would take each on their own
+	VkDeviceSize allocatedBytes = 0;	// memory they actually got, sharing where lifetimes don't overlap
+	bool synchronization2 = false;
+
+	VkDeviceSize aliasedBytesSaved() const { return transientBytes - allocatedBytes; }
+	// writes the fields as members of the currently open JSON object
+	void writeJson(JsonWriter& json) const;
+};
+
+// Frame graph: every frame the passes are declared again with the resources they read and write.
+// compile() culls passes nothing depends on, orders the rest, places transient images in shared memory where
+// their lifetimes don't overlap and plans the barriers; execute() records the passes with one batched barrier
+// in front of each pass that needs one. Passes never synchronize anything themselves.
+class RenderGraph {
+public:
+	// declares what a pass reads and writes, handed to the setup function of addPass
+	class PassBuilder {
+	public:
+		void read(RenderGraphResource resource, ResourceAccess access);
+		void write(RenderGraphResource resource, ResourceAccess access);
+		// keep the pass even though nothing reads what it writes (queries, host readback)
+		void setSideEffects();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : graph(graph), pass(pass) {}
+		void use(RenderGraphResource resource, ResourceAccess access, bool write);
+
+		RenderGraph& graph;
+		uint32_t pass;
+	};
+
+	using SetupFunction = std::function<void(PassBuilder&)>;
+	using ExecuteFunction = std::function<void(VkCommandBuffer)>;
+
+	// synchronization2 records vkCmdPipelineBarrier2KHR, the device needs VK_KHR_synchronization2 with the feature enabled
+	void init(VkDevice device, DeviceAllocator& allocator, uint32_t framesInFlight, bool synchronization2);
+	// the GPU must be done with every frame that used the graph
+	void destroy();
+
+	// starts declaring the graph of a frame slot. Transient images belong to the slot and are reused
+	// for as long as the slot declares the same ones
+	void beginFrame(uint32_t frameSlot);
+
+	// - resources
+	// an image owned elsewhere. It is in initialLayout with earlier work (or the semaphore wait) at initialStages,
+	// and is left ready for finalAccess after the graph
+	RenderGraphResource importImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect,
+	                                VkImageLayout initialLayout, VkPipelineStageFlags initialStages, ResourceAccess finalAccess);
+	RenderGraphResource importBuffer(const char* name, VkBuffer buffer, ResourceAccess finalAccess);
+	// an image the graph owns that only lives within the frame, so it can share memory with others
+	RenderGraphResource createImage(const char* name, VkFormat format, VkExtent2D extent);
+
+	// - passes
+	void addPass(const char* name, const SetupFunction& setup, ExecuteFunction execute);
+
+	// culls, orders, places transient images and plans the barriers
+	void compile();
+	// records the kept passes with their barriers, then the transitions to each imported resource's final access
+	void execute(VkCommandBuffer commandBuffer);
+
+	// - after compile
+	VkImage getImage(RenderGraphResource resource) const;
+	VkImageView getImageView(RenderGraphResource resource) const;
+	VkBuffer getBuffer(RenderGraphResource resource) const;
+	// kept pass names in execution order
+	std::vector<const char*> getExecutionOrder() const;
+	const RenderGraphStats& getStats() const { return stats; }
+
+private:
+	// stage, access and layout one declared use boils down to
+	struct Use {
+		uint32_t resource = 0;
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool write = false;
+	};
+
+	struct Barrier {
+		uint32_t resource = 0;
+		VkPipelineStageFlags srcStages = 0;
+		VkAccessFlags srcAccess = 0;
+		VkPipelineStageFlags dstStages = 0;
+		VkAccessFlags dstAccess = 0;
+		VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	struct Pass {
+		const char* name = nullptr;
+		ExecuteFunction execute;
+		std::vector<Use> uses;
+		bool sideEffects = false;
+
+		// - compile
+		std::vector<uint32_t> producers;	// earlier passes writing what this one reads or overwrites
+		std::vector<uint32_t> readsBefore;	// earlier passes reading what this one overwrites, ordering only
+		bool kept = false;
+		uint32_t position = UINT32_MAX;		// in the execution order
+		std::vector<Barrier> barriers;		// recorded in one batch in front of the pass
+	};
+
+	// where a resource is in the frame, while barriers are planned
+	struct ResourceState {
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags writeStages = 0;	// last write or layout transition
+		VkAccessFlags writeAccess = 0;
+		VkPipelineStageFlags readStages = 0;	// reads since then
+		VkPipelineStageFlags visibleStages = 0;	// stages the last write has been made visible to
+	};
+
+	struct Resource {
+		const char* name = nullptr;
+		bool isImage = true;
+		bool imported = false;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkImageAspectFlags aspect = 0;
+
+		// - imported
+		VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags initialStages = 0;
+		ResourceAccess finalAccess = ResourceAccess::None;
+
+		// - transient
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent{};
+		VkImageUsageFlags usage = 0;
+		uint32_t transient = UINT32_MAX;		// index into the slot's transient images
+
+		// - compile
+		uint32_t lastWriter = UINT32_MAX;
+		std::vector<uint32_t> readers;			// passes reading it since lastWriter
+		uint32_t firstUse = UINT32_MAX;			// positions in the execution order
+		uint32_t lastUse = 0;
+		ResourceState state;
+	};
+
+	// what a slot's transient images were created for, they're rebuilt when it changes
+	struct TransientKey {
+		VkFormat format;
+		VkExtent2D extent;
+		VkImageUsageFlags usage;
+		uint32_t firstUse;
+		uint32_t lastUse;
+
+		bool operator==(const TransientKey& other) const {
+			return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height
+				&& usage == other.usage && firstUse == other.firstUse && lastUse == other.lastUse;
+		}
+	};
+
+	struct TransientImage {
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkMemoryRequirements requirements{};
+		uint32_t heap = 0;
+		uint32_t aliasPredecessor = UINT32_MAX;	// image that used the memory last before this one
+	};
+
+	// memory shared by transient images whose lifetimes don't overlap, all bound at its start
+	struct TransientHeap {
+		Allocation allocation;
+		VkDeviceSize size = 0;
+		VkDeviceSize alignment = 1;
+		uint32_t memoryTypeBits = UINT32_MAX;
+		std::vector<uint32_t> images;
+	};
+
+	struct FrameResources {
+		std::vector<TransientKey> keys;
+		std::vector<TransientImage> images;
+		std::vector<TransientHeap> heaps;
+		VkDeviceSize transientBytes = 0;
+		VkDeviceSize allocatedBytes = 0;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	DeviceAllocator* allocator = nullptr;
+	bool synchronization2 = false;
+	PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+
+	uint32_t frameSlot = 0;
+	std::vector<FrameResources> frameResources;
+
+	// entries are reused from frame to frame so declaring the graph doesn't allocate once it's warm
+	std::vector<Pass> passes;
+	uint32_t passCount = 0;
+	std::vector<Resource> resources;
+	uint32_t resourceCount = 0;
+	std::vector<uint32_t> order;					// kept passes in execution order
+	std::vector<Barrier> finalBarriers;
+	bool compiled = false;
+	RenderGraphStats stats;
+
+	// compile and recording scratch
+	std::vector<uint32_t> cullStack;
+	std::vector<TransientKey> transientKeys;
+	std::vector<uint32_t> transientResources;		// resource of each transient image
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	std::vector<VkImageMemoryBarrier2KHR> imageBarriers2;
+
+	Resource& addResource(const char* name);
+	void buildDependencies();
+	void cull();
+	void schedule();
+	void allocateTransients();
+	void destroyTransients(FrameResources& frame);
+	void planBarriers();
+	// moves the resource to the state use needs, adding a barrier to batch when that takes one
+	void transition(std::vector<Barrier>& batch, const Use& use);
+	void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& batch);
+};
@@ -0,0 +1,55 @@
+#include "ShaderLibrary.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+#include "generated/EmbeddedShaders.h"
+
+ShaderCode ShaderLibrary::get(const std::string& name) {
+	auto loaded = diskShaders.find(name);
+	if (loaded != diskShaders.end()) {
+		return {loaded->second.data(), loaded->second.size() * sizeof(uint32_t)};
+	}
+
+	std::vector<uint32_t> code;
+	if (loadFromDisk(name, code)) {
+		auto& stored = diskShaders[name];
+		stored = std::move(code);
+		return {stored.data(), stored.size() * sizeof(uint32_t)};
+	}
+
+	for (const auto& entry : EmbeddedShaders::entries) {
+		if (name == entry.name) {
+			return {entry.code, entry.size};
+		}
+	}
+
+	throw std::runtime_error("Failed to find shader " + name);
+}
+
+bool ShaderLibrary::loadFromDisk(const std::string& name, std::vector<uint32_t>& code) const {
+	std::string directory = overrideDirectory;
+	if (directory.empty()) {
+		const char* environment = std::getenv("VKT_SHADER_DIR");
+		if (environment == nullptr) {
+			return false;
+		}
+		directory = environment;
+	}
+
+	std::ifstream file(directory + "/" + name + ".spv", std::ios::ate | std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	size_t fileSize = file.tellg();
+	if (fileSize == 0 || fileSize % sizeof(uint32_t) != 0) {
+		throw std::runtime_error("Shader file " + directory + "/" + name + ".spv is not valid SPIR-V");
+	}
+
+	code.resize(fileSize / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(code.data()), fileSize);
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// SPIR-V words of one shader, points either into the executable's read-only data or into the library's disk copies
+struct ShaderCode {
+	const uint32_t* code = nullptr;
+	size_t size = 0;		// in bytes, as VkShaderModuleCreateInfo wants it
+};
+
+// Shaders are compiled into the binary by the "premake5 embed-shaders" pre-build step.
+// For shader development an override directory can be set (--shader-dir or the VKT_SHADER_DIR environment variable);
+// "<dir>/<name>.spv" is then loaded instead of the embedded copy when it exists.
+class ShaderLibrary {
+public:
+	void setOverrideDirectory(const std::string& directory) { overrideDirectory = directory; }
+
+	// name is the source file name, e.g. "shader.vert"; throws if the shader is neither on disk nor embedded
+	ShaderCode get(const std::string& name);
+
+	// true if any shader handed out so far came from disk
+	bool usedDisk() const { return !diskShaders.empty(); }
+
+private:
+	std::string overrideDirectory;
+	std::map<std::string, std::vector<uint32_t>> diskShaders;		// uint32_t storage keeps the code word aligned
+
+	bool loadFromDisk(const std::string& name, std::vector<uint32_t>& code) const;
+};
@@ -0,0 +1,53 @@
+#include "StreamingBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void StreamingBuffer::init(VkDevice newDevice, VkPhysicalDevice physicalDevice, DeviceAllocator& newAllocator,
+                           VkDeviceSize newBytesPerFrame, uint32_t framesInFlight) {
+	device = newDevice;
+	allocator = &newAllocator;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+
+	// every region starts aligned, so offsets inside it only need aligning relative to the region
+	bytesPerFrame = (newBytesPerFrame + alignment - 1) / alignment * alignment;
+	VkDeviceSize totalSize = bytesPerFrame * framesInFlight;
+	if (totalSize > UINT32_MAX) {
+		throw std::runtime_error("Failed to create streaming buffer: dynamic offsets are 32 bit");
+	}
+
+	// coherent, so writes never need a flush before submit. Also a vertex buffer for per-instance streams
+	allocator->createBuffer(totalSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+
+	beginFrame(0);
+}
+
+void StreamingBuffer::destroy() {
+	allocator->destroyBuffer(buffer, memory);
+	buffer = VK_NULL_HANDLE;
+}
+
+void StreamingBuffer::beginFrame(uint32_t frameSlot) {
+	peakUsage = std::max(peakUsage, std::min(head.load(std::memory_order_relaxed), bytesPerFrame));
+
+	frameBase = bytesPerFrame * frameSlot;
+	frameData = static_cast<char*>(memory.mapped) + frameBase;
+	head.store(0, std::memory_order_relaxed);
+}
+
+StreamingAllocation StreamingBuffer::allocate(VkDeviceSize size) {
+	VkDeviceSize alignedSize = getAlignedSize(size);
+	VkDeviceSize offset = head.fetch_add(alignedSize, std::memory_order_relaxed);
+	if (offset + alignedSize > bytesPerFrame) {
+		throw std::runtime_error("Failed to allocate streaming memory: frame region is full");
+	}
+
+	StreamingAllocation allocation;
+	allocation.data = frameData + offset;
+	allocation.offset = static_cast<uint32_t>(frameBase + offset);
+	return allocation;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "DeviceAllocator.h"
+
+// a piece of this frame's streaming memory: write through data, bind with offset as the dynamic offset
+struct StreamingAllocation {
+	void* data = nullptr;
+	uint32_t offset = 0;		// from the start of the buffer
+};
+
+// Linear allocator for data that lives for one frame (per-draw constants etc.).
+// One persistently mapped host visible buffer, partitioned into a region per frame-in-flight slot;
+// allocating is a single atomic add, and a region is reused once the GPU is done with its slot.
+// Bind it once as a UNIFORM_BUFFER_DYNAMIC descriptor and select data per draw with dynamic offsets.
+class StreamingBuffer {
+public:
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, DeviceAllocator& allocator,
+	          VkDeviceSize bytesPerFrame, uint32_t framesInFlight);
+	void destroy();
+
+	// call once the slot's fence has been waited on, all earlier allocations from the slot become invalid
+	void beginFrame(uint32_t frameSlot);
+
+	// thread safe, throws when the frame's region is full
+	StreamingAllocation allocate(VkDeviceSize size);
+
+	template <typename T>
+	StreamingAllocation push(const T& value) {
+		StreamingAllocation allocation = allocate(sizeof(T));
+		*static_cast<T*>(allocation.data) = value;
+		return allocation;
+	}
+
+	VkBuffer getBuffer() const { return buffer; }
+	VkDeviceSize getAlignment() const { return alignment; }
+	// what allocate(size) actually takes up, use as the stride for arrays of per-draw data
+	VkDeviceSize getAlignedSize(VkDeviceSize size) const { return (size + alignment - 1) / alignment * alignment; }
+	VkDeviceSize getBytesPerFrame() const { return bytesPerFrame; }
+	// bytes handed out in the current frame, and the most any frame has used so far
+	VkDeviceSize getFrameUsage() const { return head.load(std::memory_order_relaxed); }
+	VkDeviceSize getPeakUsage() const { return peakUsage; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	DeviceAllocator* allocator = nullptr;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	Allocation memory;
+
+	VkDeviceSize alignment = 0;			// minUniformBufferOffsetAlignment
+	VkDeviceSize bytesPerFrame = 0;		// rounded up to alignment
+	VkDeviceSize frameBase = 0;			// start of the current slot's region
+	char* frameData = nullptr;
+	std::atomic<VkDeviceSize> head{0};	// next free byte in the current region
+	VkDeviceSize peakUsage = 0;
+};
@@ -0,0 +1,173 @@
+#include "TransformHierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+uint32_t TransformHierarchy::addNode(uint32_t parent, const Transform& local) {
+	uint32_t node = getNodeCount();
+	if (parent != NO_PARENT) {
+		// the new node is only inside parent's range if that range currently ends at the back
+		if (parent >= node || parent + subtreeSizes[parent] != node) {
+			throw std::runtime_error("Failed to add transform node, its parent's subtree is already closed");
+		}
+	}
+
+	positions.push_back(local.position);
+	rotations.push_back(local.rotation);
+	scales.push_back(local.scale);
+	worlds.push_back(glm::mat4(1.0f));
+	parents.push_back(parent);
+	subtreeSizes.push_back(1);
+	dirty.push_back(1);
+	dirtyNodes.push_back(node);
+
+	// O(depth), every ancestor's range grows by one
+	for (uint32_t ancestor = parent; ancestor != NO_PARENT; ancestor = parents[ancestor]) {
+		subtreeSizes[ancestor]++;
+	}
+	return node;
+}
+
+void TransformHierarchy::clear() {
+	positions.clear();
+	rotations.clear();
+	scales.clear();
+	worlds.clear();
+	parents.clear();
+	subtreeSizes.clear();
+	dirty.clear();
+	dirtyNodes.clear();
+	lastStats = TransformUpdateStats();
+}
+
+Transform TransformHierarchy::getLocal(uint32_t node) const {
+	Transform local;
+	local.position = positions[node];
+	local.rotation = rotations[node];
+	local.scale = scales[node];
+	return local;
+}
+
+void TransformHierarchy::setLocal(uint32_t node, const Transform& local) {
+	positions[node] = local.position;
+	rotations[node] = local.rotation;
+	scales[node] = local.scale;
+	if (!dirty[node]) {
+		dirty[node] = 1;
+		dirtyNodes.push_back(node);
+	}
+}
+
+glm::mat4 TransformHierarchy::computeWorld(uint32_t node) const {
+	// translation * rotation * scale without the full matrix products
+	glm::mat4 local = glm::mat4_cast(rotations[node]);
+	local[0] *= scales[node].x;
+	local[1] *= scales[node].y;
+	local[2] *= scales[node].z;
+	local[3] = glm::vec4(positions[node], 1.0f);
+	return parents[node] == NO_PARENT ? local : worlds[parents[node]] * local;
+}
+
+void TransformHierarchy::updateSubtree(uint32_t root) {
+	// parents come before their children, so one pass in order sees every parent already updated
+	uint32_t end = root + subtreeSizes[root];
+	for (uint32_t node = root; node < end; node++) {
+		worlds[node] = computeWorld(node);
+	}
+}
+
+void TransformHierarchy::update() {
+	update(nullptr);
+}
+
+void TransformHierarchy::update(JobSystem& jobs) {
+	update(&jobs);
+}
+
+void TransformHierarchy::update(JobSystem* jobs) {
+	lastStats = TransformUpdateStats();
+	lastStats.dirtyNodes = getDirtyCount();
+	if (dirtyNodes.empty()) {
+		return;
+	}
+
+	// in depth-first order a dirty node inside the range of the dirty root before it is covered by that root,
+	// the rest are the roots of independent subtrees
+	std::sort(dirtyNodes.begin(), dirtyNodes.end());
+	subtreeRoots.clear();
+	uint32_t coveredEnd = 0;
+	for (uint32_t node : dirtyNodes) {
+		dirty[node] = 0;
+		if (node < coveredEnd) {
+			continue;
+		}
+		coveredEnd = node + subtreeSizes[node];
+		lastStats.subtrees++;
+
+		// a big subtree would be one long job: its root is updated here and its children's subtrees become
+		// the roots instead, until they're small enough
+		splitStack.assign(1, node);
+		while (!splitStack.empty()) {
+			uint32_t root = splitStack.back();
+			splitStack.pop_back();
+			if (subtreeSizes[root] <= TASK_NODES) {
+				subtreeRoots.push_back(root);
+				continue;
+			}
+
+			worlds[root] = computeWorld(root);
+			lastStats.nodesUpdated++;
+			size_t firstChild = splitStack.size();
+			uint32_t end = root + subtreeSizes[root];
+			for (uint32_t child = root + 1; child < end; child += subtreeSizes[child]) {
+				splitStack.push_back(child);
+			}
+			// popped in depth-first order, keeps the jobs' ranges ascending
+			std::reverse(splitStack.begin() + firstChild, splitStack.end());
+		}
+	}
+	dirtyNodes.clear();
+
+	// runs of roots adding up to about TASK_NODES nodes each
+	taskStarts.clear();
+	uint32_t taskNodes = TASK_NODES;
+	for (uint32_t i = 0; i < subtreeRoots.size(); i++) {
+		if (taskNodes >= TASK_NODES) {
+			taskStarts.push_back(i);
+			taskNodes = 0;
+		}
+		taskNodes += subtreeSizes[subtreeRoots[i]];
+		lastStats.nodesUpdated += subtreeSizes[subtreeRoots[i]];
+	}
+	taskStarts.push_back(static_cast<uint32_t>(subtreeRoots.size()));
+	uint32_t taskCount = static_cast<uint32_t>(taskStarts.size() - 1);
+	lastStats.tasks = taskCount;
+
+	auto runTasks = [this](uint32_t begin, uint32_t end) {
+		for (uint32_t task = begin; task < end; task++) {
+			for (uint32_t i = taskStarts[task]; i < taskStarts[task + 1]; i++) {
+				updateSubtree(subtreeRoots[i]);
+			}
+		}
+	};
+	if (jobs && taskCount > 1) {
+		jobs->parallelFor(taskCount, 1, runTasks);
+	} else {
+		runTasks(0, taskCount);
+	}
+}
+
+void TransformHierarchy::updateAll() {
+	for (uint32_t node : dirtyNodes) {
+		dirty[node] = 0;
+	}
+	lastStats = TransformUpdateStats();
+	lastStats.dirtyNodes = getDirtyCount();
+	dirtyNodes.clear();
+
+	for (uint32_t node = 0; node < getNodeCount(); node++) {
+		worlds[node] = computeWorld(node);
+	}
+	lastStats.nodesUpdated = getNodeCount();
+	lastStats.tasks = 1;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "JobSystem.h"
+
+// a node's transform relative to its parent
+struct Transform {
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// what the last update did
+struct TransformUpdateStats {
+	uint32_t dirtyNodes = 0;		// nodes changed since the update before
+	uint32_t subtrees = 0;			// independent subtrees recomputed, dirty nodes under a dirty ancestor are part of its subtree
+	uint32_t nodesUpdated = 0;		// world matrices recomputed
+	uint32_t tasks = 0;				// jobs the subtrees were spread over
+};
+
+// Scene graph transforms. Nodes are kept in depth-first order in separate arrays (local position, rotation and
+// scale, world matrix, parent, subtree size), so every node's subtree is the contiguous range after it and a
+// parent always comes before its children. Changing a node only flags it: update() recomputes the subtrees of
+// the flagged nodes and nothing else, independent subtrees in parallel.
+class TransformHierarchy {
+public:
+	static const uint32_t NO_PARENT = UINT32_MAX;
+
+	// appends a node as the last child of parent (or as a new root). To keep the depth-first order parent has to be
+	// the last node added or one of its ancestors. New nodes are dirty
+	uint32_t addNode(uint32_t parent, const Transform& local);
+	void clear();
+	uint32_t getNodeCount() const { return static_cast<uint32_t>(parents.size()); }
+
+	// - per node
+	Transform getLocal(uint32_t node) const;
+	// flags the node, its world matrix and its subtree's are recomputed by the next update
+	void setLocal(uint32_t node, const Transform& local);
+	// up to date as of the last update
+	const glm::mat4& getWorld(uint32_t node) const { return worlds[node]; }
+	uint32_t getParent(uint32_t node) const { return parents[node]; }
+	// the node plus all its descendants, which are the nodes right after it
+	uint32_t getSubtreeSize(uint32_t node) const { return subtreeSizes[node]; }
+
+	// recomputes the world matrices of the dirty subtrees, O(nodes in them) rather than O(nodes)
+	void update();
+	void update(JobSystem& jobs);
+	uint32_t getDirtyCount() const { return static_cast<uint32_t>(dirtyNodes.size()); }
+	const TransformUpdateStats& getLastUpdateStats() const { return lastStats; }
+
+	// recomputes every world matrix ignoring the dirty flags (and clearing them), the baseline update is compared to
+	void updateAll();
+
+	// subtrees bigger than this are split at their children to spread them over jobs,
+	// smaller ones are grouped into jobs of about this many nodes
+	static const uint32_t TASK_NODES = 4096;
+
+private:
+	// - per node, depth-first order
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> subtreeSizes;
+	std::vector<uint8_t> dirty;
+
+	// flagged nodes in the order they were flagged, each once
+	std::vector<uint32_t> dirtyNodes;
+	// scratch for update: the subtrees to recompute and where each job's run of them starts
+	std::vector<uint32_t> subtreeRoots;
+	std::vector<uint32_t> taskStarts;
+	std::vector<uint32_t> splitStack;
+	TransformUpdateStats lastStats;
+
+	glm::mat4 computeWorld(uint32_t node) const;
+	void updateSubtree(uint32_t root);
+	void update(JobSystem* jobs);
+};
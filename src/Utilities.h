@@ -1,13 +1,119 @@
 #pragma once
 #include <optional>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+// upper bound on how many frames the CPU may record ahead of the GPU
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
 
 // indices (locations) of queue families (if they exist at all)
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// the family uploads go through: transfer-only (a DMA queue) if there is one, else any other family that can
+	// transfer but not draw (usually async compute), else graphicsFamily
+	std::optional<uint32_t> transferFamily;
 
 	// check if queue families are valid
 	bool isComplete() const {
 		return graphicsFamily.has_value() && presentFamily.has_value();
 	}
 };
+
+// part of the render target a view is drawn into, in 0..1 of the target's extent
+struct ViewRect {
+	float x = 0.0f;
+	float y = 0.0f;
+	float width = 1.0f;
+	float height = 1.0f;
+};
+
+// what the swap chain's present mode and image count are tuned for
+enum class PresentPolicy {
+	LowLatency,		// IMMEDIATE/MAILBOX, as few queued images as possible
+	Throughput,		// MAILBOX, one spare image so the CPU never waits on the display
+	PowerSaving		// FIFO (vsync), never renders frames that won't be shown
+};
+
+inline const char* presentPolicyName(PresentPolicy policy) {
+	switch (policy) {
+	case PresentPolicy::LowLatency: return "low-latency";
+	case PresentPolicy::Throughput: return "throughput";
+	case PresentPolicy::PowerSaving: return "power-saving";
+	}
+	return "unknown";
+}
+
+// parses the names above, returns false for anything else
+inline bool parsePresentPolicy(const std::string& name, PresentPolicy& policy) {
+	for (PresentPolicy candidate : {PresentPolicy::LowLatency, PresentPolicy::Throughput, PresentPolicy::PowerSaving}) {
+		if (name == presentPolicyName(candidate)) {
+			policy = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// settings chosen at startup (see main.cpp) that shape how the renderer is built
+struct RendererSettings {
+	uint32_t framesInFlight = 2;		// size of the per-frame resource ring, 1..MAX_FRAMES_IN_FLIGHT
+
+	// headless mode renders into renderer-owned images instead of a window surface
+	bool headless = false;
+	uint32_t headlessWidth = 800;
+	uint32_t headlessHeight = 600;
+
+	// present mode / image count profile, can be changed later with VulkanRenderer::setPresentPolicy
+	PresentPolicy presentPolicy = PresentPolicy::Throughput;
+
+	// record GPU timestamp and CPU zones for a Chrome trace
+	bool enableProfiler = false;
+
+	// job system workers, 0 for one per hardware thread; pinning binds worker i to core i
+	uint32_t jobThreads = 0;
+	bool pinJobThreads = false;
+
+	// chunks the scene's draws are recorded in (as jobs), more than 1 records into per-chunk secondary command buffers
+	uint32_t recordThreads = 1;
+	// keep each slot's secondaries and only re-record those whose draws, views or targets changed
+	bool incrementalRecording = false;
+
+	// render graph barriers through VK_KHR_synchronization2 when the device has it, the original barriers otherwise
+	bool synchronization2 = true;
+	// main pass through VK_KHR_dynamic_rendering (core in 1.3) instead of render pass and framebuffer objects,
+	// falls back to the render pass when the device doesn't have it
+	bool dynamicRendering = false;
+
+	// depth-only prepass before the main pass, can be toggled later with VulkanRenderer::setDepthPrepass
+	bool depthPrepass = false;
+
+	// cull and issue the draws on the GPU (compute culling, indirect count draws), can be toggled later with
+	// VulkanRenderer::setGpuDriven. Falls back to CPU-issued draws when the device can't do it
+	bool gpuDriven = false;
+
+	// draw items sharing mesh and material as one instanced draw each, can be toggled later with
+	// VulkanRenderer::setInstancing. GPU-driven drawing takes precedence
+	bool instancing = false;
+
+	// cull the draw items against the frustum on the CPU before recording them, can be toggled later with
+	// VulkanRenderer::setFrustumCulling. Only the per-draw path uses it
+	bool frustumCulling = false;
+
+	// material pipelines are compiled on background threads instead of blocking the frame that asks for them.
+	// Until one is ready its draws use the main pipeline when that's compatible and are skipped otherwise,
+	// skipPendingDraws skips them either way
+	bool asyncPipelines = false;
+	bool skipPendingDraws = false;
+	uint32_t pipelineCompileThreads = 2;
+
+	// per-frame streaming memory for draw constants, times framesInFlight in total
+	uint64_t streamingBytesPerFrame = 4ULL << 20;
+
+	// on-disk VkPipelineCache, empty to always compile from scratch
+	std::string pipelineCachePath = "pipeline_cache.bin";
+
+	// load "<dir>/<shader>.spv" instead of the SPIR-V embedded in the executable (see ShaderLibrary)
+	std::string shaderDirectory;
+};
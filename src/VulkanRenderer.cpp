@@ -10,6 +10,12 @@
 #include <set>
 #include <cstdint>
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <cmath>
+#include <atomic>
+
+#include <glm/gtc/matrix_transform.hpp>
 
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <fstream>
@@ -29,7 +35,7 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 }
 
 static void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
-	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CALLBACK_DATA_EXT;
+	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
 	createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
 		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
 		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
@@ -41,76 +47,144 @@ static void PopulateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT&
 	createInfo.pfnUserCallback = debugCallback;
 }
 
-static std::vector<char> readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		throw std::runtime_error("Failed to open file");
-	}
-
-	size_t fileSize = file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-	return buffer;
-}
-
-int VulkanRenderer::initVulkan(GLFWwindow* newWindow) {
+int VulkanRenderer::initVulkan(GLFWwindow* newWindow, const RendererSettings& newSettings) {
 	window = newWindow;
+	settings = newSettings;
+	settings.framesInFlight = std::clamp(settings.framesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+	auto initStart = BenchClock::now();
+	shaderLibrary.setOverrideDirectory(settings.shaderDirectory);
 
 	try {
 		createInstance();
 		setupDebugMessegner();
-		createSurface();
+		if (!settings.headless) {
+			createSurface();
+		}
 		getPhysicalDevice();
 		createLogicalDevice();
-		createSwapChain();
+		allocator.init(mainDevice.logicalDevice, mainDevice.physicalDevice);
+		uploader.init(mainDevice.logicalDevice, allocator, findQueueFamilies(mainDevice.physicalDevice), transferQueue, graphicsQueue);
+		createMeshes();
+		streamingBuffer.init(mainDevice.logicalDevice, mainDevice.physicalDevice, allocator, settings.streamingBytesPerFrame, settings.framesInFlight);
+		createDescriptorSetLayout();
+		createDescriptorSets();
+		pipelineCache.init(mainDevice.logicalDevice, mainDevice.physicalDevice, settings.pipelineCachePath);
+		pipelineRegistry.init(mainDevice.logicalDevice, shaderLibrary, &pipelineCache,
+		                      isDeviceExtensionEnabled(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME), settings.pipelineCompileThreads);
+		gpuScene.init(mainDevice.logicalDevice, allocator, uploader, settings.framesInFlight, shaderLibrary.get("cull.comp"),
+		              pipelineCache.get(), isDeviceExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME));
+		if (settings.headless) {
+			createHeadlessTargets();
+		} else {
+			createSwapChain();
+		}
 		createImageViews();
+		depthFormat = chooseDepthFormat();
+		createDepthTargets();
 		createRenderPass();
+
+		auto pipelineStart = BenchClock::now();
 		createGraphicsPipeline();
+		startupTimings.pipelineMs = elapsedMs(pipelineStart, BenchClock::now());
+		startupTimings.shaderMs = pipelineRegistry.getStats().shaderMs;
+		startupTimings.shadersFromDisk = shaderLibrary.usedDisk();
+
 		createFrameBuffers();
 		createCommandPool();
 		createCommandBuffers();
-		createSemaphores();
+		createSyncObjects();
+		renderGraph.init(mainDevice.logicalDevice, allocator, settings.framesInFlight,
+		                 isDeviceExtensionEnabled(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME));
+		jobs.init(settings.jobThreads, settings.pinJobThreads);
+		if (settings.recordThreads > 1) {
+			ensureRecordWorkers(settings.recordThreads);
+		}
+
+		if (settings.enableProfiler) {
+			QueueFamilyIndices indices = findQueueFamilies(mainDevice.physicalDevice);
+			profiler.init(mainDevice.logicalDevice, mainDevice.physicalDevice, indices.graphicsFamily.value(), settings.framesInFlight);
+		}
 	}
 	catch (const std::runtime_error& e) {
 		printf("ERROR: %s\n", e.what());
 		return EXIT_FAILURE;
 	}
+
+	startupTimings.initMs = elapsedMs(initStart, BenchClock::now());
+	startupTimings.pipelineCacheWarm = pipelineCache.isWarm();
+	startupTimings.pipelineCacheBytes = pipelineCache.getLoadedBytes();
+	startupTimings.creationFeedback = isDeviceExtensionEnabled(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	startupTimings.cacheHits = pipelineCache.getHits();
+	startupTimings.cacheMisses = pipelineCache.getMisses();
+
+	return EXIT_SUCCESS;
 }
 
 
 void VulkanRenderer::cleanUp() {
-	vkDestroySemaphore(mainDevice.logicalDevice, renderFinishedSemaphore, nullptr);
-	vkDestroySemaphore(mainDevice.logicalDevice, imageAvailableSemaphore, nullptr);
+	// frames may still be executing, nothing can be destroyed until they finish
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	profiler.destroy();
+	destroyRetiredSwapChains(true);
 
+	for (auto& frame : frames) {
+		vkDestroyFence(mainDevice.logicalDevice, frame.inFlightFence, nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, frame.renderFinishedSemaphore, nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, frame.imageAvailableSemaphore, nullptr);
+	}
+
+	jobs.destroy();
+	for (auto& frame : frames) {
+		for (auto& worker : frame.workers) {
+			vkDestroyCommandPool(mainDevice.logicalDevice, worker.pool, nullptr);
+		}
+		vkDestroyCommandPool(mainDevice.logicalDevice, frame.commandPool, nullptr);
+	}
 	vkDestroyCommandPool(mainDevice.logicalDevice, commandPool, nullptr);
 
 	for (auto framebuffer : swapChainFramebuffers) {
 		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
 	}
+	destroyDepthTargets(depthTargets);
 
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+	pipelineRegistry.destroy();
+	pipelineCache.save();
+	pipelineCache.destroy();
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
 	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
 
-	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapChain, nullptr);
+	for (auto imageView : swapChainImageViews) {
+		vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+	}
+
+	if (settings.headless) {
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			allocator.destroyImage(swapChainImages[i], headlessImageAllocations[i]);
+		}
+	} else {
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, swapChain, nullptr);
+	}
+
+	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, drawSetLayout, nullptr);
+	streamingBuffer.destroy();
+	gpuScene.destroy();
+	renderGraph.destroy();
+	destroyMesh(quadMesh);
+	destroyMesh(triangleMesh);
+	uploader.destroy();
+	allocator.destroy();
+
 	if (enableValidationLayers) {
 		destroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 	}
 
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
-	vkDestroyInstance(instance, nullptr);
-
-	for (auto imageView : swapChainImageViews) {
-		vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+	if (!settings.headless) {
+		vkDestroySurfaceKHR(instance, surface, nullptr);
 	}
-
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+	vkDestroyInstance(instance, nullptr);
 }
 
 void VulkanRenderer::createInstance() {
@@ -127,7 +201,7 @@ void VulkanRenderer::createInstance() {
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);		// custom version of the application
 	appInfo.pEngineName = "No Engine";							// custom engine name
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);			// custom engine version
-	appInfo.apiVersion = VK_API_VERSION_1_0;					// the vulkan version
+	appInfo.apiVersion = VK_API_VERSION_1_1;					// the vulkan version (1.1 for vkGetPhysicalDeviceFeatures2)
 
 	// creation information for a VkInstance
 	VkInstanceCreateInfo createInfo = {};
@@ -137,7 +211,7 @@ void VulkanRenderer::createInstance() {
 	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
 	if (enableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-		createInfo.ppEnabledExtensionNames = validationLayers.data();
+		createInfo.ppEnabledLayerNames = validationLayers.data();
 
 		PopulateDebugMessengerCreateInfo(debugCreateInfo);
 		createInfo.pNext = &debugCreateInfo;
@@ -167,8 +241,73 @@ void VulkanRenderer::createLogicalDevice() {
 	// Get the queue family indices for the chosen physical device
 	QueueFamilyIndices indices = findQueueFamilies(mainDevice.physicalDevice);
 
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+
+	// add whichever optional extensions this device supports
+	uint32_t availableCount = 0;
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &availableCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(availableCount);
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &availableCount, availableExtensions.data());
+
+	for (const char* optional : optionalDeviceExtensions) {
+		for (const auto& available : availableExtensions) {
+			if (strcmp(optional, available.extensionName) == 0) {
+				extensions.push_back(optional);
+				break;
+			}
+		}
+	}
+
+	// extensions that come with a feature are only enabled when the device has the feature, which has to be
+	// switched on as well. Querying features needs a 1.1 device
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+	synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
+	dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	synchronization2Features.pNext = &dynamicRenderingFeatures;
+
+	VkPhysicalDeviceFeatures2 features2{};
+	features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features2.pNext = &synchronization2Features;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+	if (properties.apiVersion >= VK_API_VERSION_1_1) {
+		vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &features2);
+	}
+
+	auto dropExtension = [&extensions](const char* extension) {
+		extensions.erase(std::remove_if(extensions.begin(), extensions.end(),
+		                                [extension](const char* enabled) { return strcmp(enabled, extension) == 0; }),
+		                 extensions.end());
+	};
+	auto hasExtension = [&extensions](const char* extension) {
+		return std::any_of(extensions.begin(), extensions.end(), [extension](const char* enabled) { return strcmp(enabled, extension) == 0; });
+	};
+	if (!synchronization2Features.synchronization2 || !settings.synchronization2) {
+		dropExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+	}
+
+	// dynamic rendering builds on depth/stencil resolve and create_renderpass2. They're core from 1.2, but the
+	// instance asks for 1.1 so they're enabled as extensions (1.2 drivers still expose them), only for its sake
+	bool dependenciesMet = hasExtension(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME) && hasExtension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+	if (!dynamicRenderingFeatures.dynamicRendering || !dependenciesMet || !settings.dynamicRendering) {
+		dropExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		dropExtension(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+		dropExtension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+	}
+
+	// GPU-driven draws start every indirect command at its object's index (firstInstance) and draw a whole batch per call
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+	if (!supportedFeatures.multiDrawIndirect || !supportedFeatures.drawIndirectFirstInstance) {
+		dropExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+	enabledDeviceExtensions = std::set<std::string>(extensions.begin(), extensions.end());
+
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value()};
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -190,14 +329,30 @@ void VulkanRenderer::createLogicalDevice() {
 
 	// information to create logical device (sometimes called "device")
 	VkDeviceCreateInfo deviceCreateInfo = {};
-	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO;
+	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());			// number of queue create infos
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();											// list of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());														// number of enabled logical device extensions
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();												// list of enabled logical device extensions
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());														// number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = extensions.data();												// list of enabled logical device extensions
+
+	// the feature structs came back from the query with their supported features set, chaining them enables those
+	void* featureChain = nullptr;
+	if (isDeviceExtensionEnabled(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+		dynamicRenderingFeatures.pNext = featureChain;
+		featureChain = &dynamicRenderingFeatures;
+	}
+	if (isDeviceExtensionEnabled(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)) {
+		synchronization2Features.pNext = featureChain;
+		featureChain = &synchronization2Features;
+	}
+	deviceCreateInfo.pNext = featureChain;
 
 	// physical device features the logical device will be using
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	if (isDeviceExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+		deviceFeatures.multiDrawIndirect = VK_TRUE;
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+	}
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;				// physical device features logical device will use
 
 	// create the logical device for the given physical device
@@ -211,6 +366,13 @@ void VulkanRenderer::createLogicalDevice() {
 	// from given logical device of given queue family, of given queue index (0 since only one queue), place reference in given VkQueue
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentFamily.value(), 0, &presentQueue);
+	vkGetDeviceQueue(mainDevice.logicalDevice, indices.transferFamily.value(), 0, &transferQueue);
+
+	// extension commands aren't exported by the loader
+	if (isDeviceExtensionEnabled(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+		cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdBeginRenderingKHR"));
+		cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(vkGetDeviceProcAddr(mainDevice.logicalDevice, "vkCmdEndRenderingKHR"));
+	}
 }
 
 void VulkanRenderer::createSurface() {
@@ -220,35 +382,102 @@ void VulkanRenderer::createSurface() {
 }
 
 void VulkanRenderer::createFrameBuffers() {
-	swapChainFramebuffers.resize(swapChainImageViews.size());
+	// dynamic rendering renders straight into the image views
+	if (usesDynamicRendering()) {
+		swapChainFramebuffers.clear();
+		return;
+	}
 
+	swapChainFramebuffers.resize(swapChainImageViews.size());
 	for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-		VkImageView attachments[] = {
-			swapChainImageViews[i]
-		};
+		swapChainFramebuffers[i] = createFramebuffer(renderPass, swapChainImageViews[i], depthTargets[i].view);
+	}
+}
+
+VkFramebuffer VulkanRenderer::createFramebuffer(VkRenderPass compatiblePass, VkImageView view, VkImageView depthView) {
+	VkImageView attachments[] = {
+		view,
+		depthView
+	};
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = attachments;
-		framebufferInfo.width = swapChainExtent.width;
-		framebufferInfo.height = swapChainExtent.height;
-		framebufferInfo.layers = 1;
+	VkFramebufferCreateInfo framebufferInfo{};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = compatiblePass;
+	framebufferInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+	framebufferInfo.pAttachments = attachments;
+	framebufferInfo.width = swapChainExtent.width;
+	framebufferInfo.height = swapChainExtent.height;
+	framebufferInfo.layers = 1;
+
+	VkFramebuffer framebuffer;
+	if (vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create framebuffer");
+	}
+	return framebuffer;
+}
+
+void VulkanRenderer::createDepthTargets() {
+	depthTargets.resize(swapChainImages.size());
+	for (auto& target : depthTargets) {
+		// only ever an attachment that is cleared on load and not stored, which is what transient usage promises
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = depthFormat;
+		imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		if (vkCreateImage(mainDevice.logicalDevice, &imageInfo, nullptr, &target.image) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create depth image");
+		}
 
-		if (vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create framebuffer");
+		// tilers have memory that is only committed if the attachment ever has to leave the tile, desktop GPUs don't
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(mainDevice.logicalDevice, target.image, &requirements);
+		const VkMemoryPropertyFlags lazyProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		depthLazilyAllocated = allocator.hasMemoryType(requirements.memoryTypeBits, lazyProperties);
+		VkMemoryPropertyFlags properties = depthLazilyAllocated ? lazyProperties : static_cast<VkMemoryPropertyFlags>(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		target.allocation = allocator.allocate(requirements, properties, ResourceKind::Optimal);
+		vkBindImageMemory(mainDevice.logicalDevice, target.image, target.allocation.memory, target.allocation.offset);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = target.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = depthFormat;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(mainDevice.logicalDevice, &viewInfo, nullptr, &target.view) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create depth image view");
 		}
 	}
 }
 
+void VulkanRenderer::destroyDepthTargets(std::vector<DepthTarget>& targets) {
+	for (auto& target : targets) {
+		vkDestroyImageView(mainDevice.logicalDevice, target.view, nullptr);
+		allocator.destroyImage(target.image, target.allocation);
+	}
+	targets.clear();
+}
+
 void VulkanRenderer::createCommandPool() {
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(mainDevice.physicalDevice);
 
 	VkCommandPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-	poolInfo.flags = 0;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;		// one-off commands, frames use their own pools
 
 	if (vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create command pool");
@@ -256,57 +485,915 @@ void VulkanRenderer::createCommandPool() {
 }
 
 void VulkanRenderer::createCommandBuffers() {
-	commandBuffers.resize(swapChainFramebuffers.size());
+	// one primary command buffer per frame slot, recorded each frame against the acquired image
+	frames.resize(settings.framesInFlight);
 
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = commandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	for (auto& frame : frames) {
+		frame.commandPool = createTransientCommandPool();
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate command buffers");
+		}
+	}
+}
+
+VkCommandPool VulkanRenderer::createTransientCommandPool() {
+	// transient: everything allocated from it is re-recorded within a frame or two, and it's only ever reset as a whole
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = findQueueFamilies(mainDevice.physicalDevice).graphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool;
+	if (vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create frame command pool");
+	}
+	return pool;
+}
+
+void VulkanRenderer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t chunkCount) {
+	// the primary is cheap (a render pass around vkCmdExecuteCommands when secondaries are used) and always re-recorded
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
 
-	if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate command buffers");
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to begin recording command buffer");
 	}
 
-	for (size_t i = 0; i < commandBuffers.size(); i++) {
+	// query resets have to happen outside the render pass
+	profiler.beginFrame(commandBuffer, currentFrame, frameNumber);
+	uint32_t frameZone = profiler.beginZone(commandBuffer, "frame");
+
+	// a single chunk is recorded straight into the primary, more are recorded as jobs into a secondary each.
+	// incremental recording always uses secondaries, they are what gets reused. GPU-driven and instanced frames
+	// are a draw per mesh (and material), they always go straight into the primary
+	bool gpuDriven = isGpuDriven();
+	bool instanced = usesInstancing();
+	bool parallel = !gpuDriven && !instanced && (chunkCount > 1 || settings.incrementalRecording);
+
+	// constants for every draw, one after the other. Always the frame's first streaming allocation,
+	// so with an unchanged scene each draw's constants land where the slot's reused secondaries expect them.
+	// Instanced draws stream their instance data instead, GPU-driven draws read their transforms from the GPU scene
+	StreamingAllocation sceneConstants;
+	uint32_t viewCount = static_cast<uint32_t>(views.size());
+	if (gpuDriven) {
+		lastFrameTimings.drawCalls = gpuScene.getBatchCount() * viewCount;
+	} else if (instanced) {
+		sceneConstants = streamingBuffer.allocate(sizeof(InstanceData) * std::max(instanceBatcher.getInstanceCount(), 1u));
+		instanceBatcher.writeInstances(drawItems, static_cast<InstanceData*>(sceneConstants.data), jobs);
+		lastFrameTimings.drawCalls = getInstanceBatchCount() * viewCount;
+	} else {
+		// with culling only the visible draws get constants, packed in the order they're recorded
+		uint32_t drawCount = getVisibleDrawCount();
+		sceneConstants = streamingBuffer.allocate(streamingBuffer.getAlignedSize(sizeof(DrawConstants)) * std::max(drawCount, 1u));
+		lastFrameTimings.drawCalls = drawCount * viewCount * (settings.depthPrepass ? 2 : 1);
+	}
+
+	// the acquired image's old contents are cleared anyway, and the acquire semaphore is waited on at color output.
+	// Headless targets are never presented, they're left ready to be copied out
+	renderGraph.beginFrame(currentFrame);
+	RenderGraphResource target = renderGraph.importImage("target", swapChainImages[imageIndex], swapChainImageViews[imageIndex],
+	                                                     VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+	                                                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	                                                     settings.headless ? ResourceAccess::TransferRead : ResourceAccess::Present);
+	// the frame that last used the image's depth target has been waited for, the pass clears it and nothing reads it after
+	const DepthTarget& depthTarget = depthTargets[imageIndex];
+	RenderGraphResource depth = renderGraph.importImage("depth", depthTarget.image, depthTarget.view, VK_IMAGE_ASPECT_DEPTH_BIT,
+	                                                    VK_IMAGE_LAYOUT_UNDEFINED,
+	                                                    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+	                                                    ResourceAccess::None);
+
+	// the slot's draw commands and counts were last read by the frame waited on before recording this one
+	RenderGraphResource drawCommands;
+	RenderGraphResource drawCounts;
+	if (gpuDriven) {
+		drawCommands = renderGraph.importBuffer("draw commands", gpuScene.getDrawBuffer(currentFrame), ResourceAccess::None);
+		drawCounts = renderGraph.importBuffer("draw counts", gpuScene.getCountBuffer(currentFrame), ResourceAccess::None);
+
+		renderGraph.addPass("clear draw counts", [&](RenderGraph::PassBuilder& pass) {
+			pass.write(drawCounts, ResourceAccess::TransferWrite);
+		}, [&](VkCommandBuffer passCommands) {
+			gpuScene.recordClearCounts(passCommands, currentFrame);
+		});
+
+		// draw transforms already end in clip space, there's no separate camera to cull against yet
+		renderGraph.addPass("cull", [&](RenderGraph::PassBuilder& pass) {
+			pass.write(drawCounts, ResourceAccess::ComputeShaderWrite);
+			pass.write(drawCommands, ResourceAccess::ComputeShaderWrite);
+		}, [&](VkCommandBuffer passCommands) {
+			GpuZone cullZone(profiler, passCommands, "cull");
+			gpuScene.recordCull(passCommands, currentFrame, glm::mat4(1.0f));
+		});
+	}
+
+	renderGraph.addPass("main pass", [&](RenderGraph::PassBuilder& pass) {
+		pass.write(target, ResourceAccess::ColorAttachmentWrite);
+		pass.write(depth, ResourceAccess::DepthAttachmentWrite);
+		if (gpuDriven) {
+			pass.read(drawCommands, ResourceAccess::IndirectRead);
+			pass.read(drawCounts, ResourceAccess::IndirectRead);
+		}
+	}, [&](VkCommandBuffer passCommands) {
+		GpuZone passZone(profiler, passCommands, "main pass");
+		beginMainPass(passCommands, imageIndex, parallel);
+
+		if (gpuDriven) {
+			// the depth prepass isn't part of the GPU-driven path, the draws test and write depth themselves
+			GpuZone drawZone(profiler, passCommands, "indirect draws");
+			vkCmdBindPipeline(passCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+			vkCmdSetLineWidth(passCommands, 1.0f);
+			for (const auto& view : views) {
+				setViewport(passCommands, view);
+				gpuScene.recordDraws(passCommands, currentFrame);
+			}
+		} else if (instanced) {
+			// like the GPU-driven path, instanced draws test and write depth themselves without a prepass
+			GpuZone drawZone(profiler, passCommands, "instanced draws");
+			recordInstancedDraws(passCommands, sceneConstants);
+		} else if (parallel) {
+			// only vkCmdExecuteCommands is allowed in a subpass with secondary contents, so no GPU zone around the draws here
+			std::vector<VkCommandBuffer> secondaries = recordSecondaries(chunkCount, sceneConstants);
+			vkCmdExecuteCommands(passCommands, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+		} else {
+			uint32_t drawCount = getVisibleDrawCount();
+			if (settings.depthPrepass) {
+				GpuZone prepassZone(profiler, passCommands, "depth prepass");
+				recordDraws(passCommands, 0, drawCount, sceneConstants, true);
+			}
+			GpuZone drawZone(profiler, passCommands, "draws");
+			recordDraws(passCommands, 0, drawCount, sceneConstants, false);
+		}
+
+		endMainPass(passCommands);
+	});
+
+	renderGraph.compile();
+	renderGraph.execute(commandBuffer);
+	profiler.endZone(commandBuffer, frameZone);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to record command buffer");
+	}
+}
+
+void VulkanRenderer::beginMainPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries) {
+	VkClearValue clearValues[2] = {};
+	clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+	clearValues[1].depthStencil = {1.0f, 0};
+
+	if (usesDynamicRendering()) {
+		VkRenderingAttachmentInfoKHR colorAttachment{};
+		colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		colorAttachment.imageView = swapChainImageViews[imageIndex];
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.clearValue = clearValues[0];
+
+		VkRenderingAttachmentInfoKHR depthAttachment{};
+		depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		depthAttachment.imageView = depthTargets[imageIndex].view;
+		depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.clearValue = clearValues[1];
+
+		VkRenderingInfoKHR renderingInfo{};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+		renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+		renderingInfo.renderArea.offset = {0, 0};
+		renderingInfo.renderArea.extent = swapChainExtent;
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments = &colorAttachment;
+		renderingInfo.pDepthAttachment = &depthAttachment;
+		cmdBeginRendering(commandBuffer, &renderingInfo);
+		return;
+	}
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = swapChainExtent;
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(std::size(clearValues));
+	renderPassInfo.pClearValues = clearValues;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void VulkanRenderer::endMainPass(VkCommandBuffer commandBuffer) {
+	if (usesDynamicRendering()) {
+		cmdEndRendering(commandBuffer);
+	} else {
+		vkCmdEndRenderPass(commandBuffer);
+	}
+}
+
+std::vector<VkCommandBuffer> VulkanRenderer::recordSecondaries(uint32_t chunkCount, const StreamingAllocation& sceneConstants) {
+	// with a prepass each chunk also gets a secondary for its depth-only draws, those all go first
+	uint32_t secondaryCount = settings.depthPrepass ? chunkCount * 2 : chunkCount;
+	ensureRecordWorkers(secondaryCount);
+	std::vector<RecordWorker>& workers = frames[currentFrame].workers;
+
+	// contiguous ranges of the draw list, each recorded by one job into its own secondary
+	uint32_t drawCount = getVisibleDrawCount();
+	uint32_t perChunk = (drawCount + chunkCount - 1) / chunkCount;
+
+	std::atomic<uint32_t> recorded{0};
+	auto recordChunk = [&](uint32_t secondary) {
+		RecordWorker& recordWorker = workers[secondary];
+		bool depthOnly = settings.depthPrepass && secondary < chunkCount;
+		uint32_t chunk = secondary % chunkCount;
+		uint32_t first = std::min(chunk * perChunk, drawCount);
+		uint32_t count = std::min(perChunk, drawCount - first);
+
+		// the secondary last recorded for this slot is still valid when nothing it depends on has changed:
+		// scene, views, pipelines, prepass and extent (all covered by recordVersion), its range and where its constants live
+		if (settings.incrementalRecording && recordWorker.recordedVersion == recordVersion
+			&& recordWorker.first == first && recordWorker.count == count && recordWorker.constantsOffset == sceneConstants.offset) {
+			return;
+		}
+
+		// the slot's fence has been waited on, and the pool only holds this secondary, so it can go at once
+		vkResetCommandPool(mainDevice.logicalDevice, recordWorker.pool, 0);
+
+		// no framebuffer, so the secondary doesn't depend on which swap chain image it ends up drawing into.
+		// With dynamic rendering there's no render pass either, only the attachment formats
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+		VkCommandBufferInheritanceRenderingInfoKHR renderingInheritance{};
+		renderingInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+		renderingInheritance.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+		renderingInheritance.colorAttachmentCount = 1;
+		renderingInheritance.pColorAttachmentFormats = &swapChainImageFormat;
+		renderingInheritance.depthAttachmentFormat = depthFormat;
+		renderingInheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		if (usesDynamicRendering()) {
+			inheritanceInfo.pNext = &renderingInheritance;
+		}
+
 		VkCommandBufferBeginInfo beginInfo{};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0;
-		beginInfo.pInheritanceInfo = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		if (!settings.incrementalRecording) {
+			beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		}
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to begin recording command buffer");
+		if (vkBeginCommandBuffer(recordWorker.commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to begin recording secondary command buffer");
 		}
 
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
-		renderPassInfo.renderArea.offset = {0, 0};
-		renderPassInfo.renderArea.extent = swapChainExtent;
-		VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		recordDraws(recordWorker.commandBuffer, first, count, sceneConstants, depthOnly);
+
+		if (vkEndCommandBuffer(recordWorker.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to record secondary command buffer");
+		}
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-		vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-		vkCmdEndRenderPass(commandBuffers[i]);
+		recordWorker.recordedVersion = recordVersion;
+		recordWorker.first = first;
+		recordWorker.count = count;
+		recordWorker.constantsOffset = sceneConstants.offset;
+		recorded++;
+	};
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to record command buffer");
+	// a grain of one chunk, the chunks are already sized to keep a core busy
+	jobs.parallelFor(secondaryCount, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t secondary = begin; secondary < end; secondary++) {
+			recordChunk(secondary);
 		}
+	});
+
+	lastFrameTimings.secondariesRecorded = recorded;
+	lastFrameTimings.secondariesReused = secondaryCount - recorded;
+
+	std::vector<VkCommandBuffer> secondaries(secondaryCount);
+	for (uint32_t secondary = 0; secondary < secondaryCount; secondary++) {
+		secondaries[secondary] = workers[secondary].commandBuffer;
+	}
+	return secondaries;
+}
+
+void VulkanRenderer::recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount, const StreamingAllocation& sceneConstants,
+                                 bool depthOnly) {
+	// constants are shared by all views and the prepass, so they're written once per draw.
+	// firstDraw and drawCount are positions in the recorded list, which is the visible draws while culling
+	VkDeviceSize stride = streamingBuffer.getAlignedSize(sizeof(DrawConstants));
+	const uint32_t* drawList = usesFrustumCulling() ? visibleDraws.data() : nullptr;
+	if (!depthOnly) {
+		for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++) {
+			DrawConstants constants{};
+			constants.transform = drawItems[drawList ? drawList[i] : i].transform;
+			memcpy(static_cast<char*>(sceneConstants.data) + stride * i, &constants, sizeof(constants));
+		}
+	}
+
+	// nothing is inherited by secondaries, so every command buffer sets up its own state.
+	// Material pipelines only replace the main pipeline, the prepass and the draws after it keep theirs
+	VkPipeline pipeline = depthOnly ? depthPrepassPipeline : settings.depthPrepass ? depthEqualPipeline : graphicsPipeline;
+	uint32_t materialCount = depthOnly || settings.depthPrepass ? 0 : static_cast<uint32_t>(materialPipelines.size());
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdSetLineWidth(commandBuffer, 1.0f);
+
+	uint32_t pendingDraws = 0;
+	VkPipeline boundPipeline = pipeline;
+	uint32_t pushedMaterial = UINT32_MAX;
+	for (const auto& view : views) {
+		setViewport(commandBuffer, view);
+
+		const Mesh* boundMesh = nullptr;
+		for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++) {
+			const DrawItem& item = drawItems[drawList ? drawList[i] : i];
+			if (materialCount > 0) {
+				VkPipeline drawPipeline = item.material < materialCount ? materialPipelines[item.material] : pipeline;
+				if (drawPipeline == VK_NULL_HANDLE) {
+					// still compiling (or failed to), drawn with a compatible fallback or not at all
+					pendingDraws++;
+					drawPipeline = settings.skipPendingDraws ? VK_NULL_HANDLE : materialFallbacks[item.material];
+					if (drawPipeline == VK_NULL_HANDLE) {
+						continue;
+					}
+				}
+				if (drawPipeline != boundPipeline) {
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+					boundPipeline = drawPipeline;
+				}
+				// materials sharing an unspecialized pipeline differ only in what's pushed
+				if (item.material < materialCount && item.material != pushedMaterial) {
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MaterialConstants),
+					                   &materialConstants[item.material]);
+					pushedMaterial = item.material;
+				}
+			}
+
+			if (item.mesh != boundMesh) {
+				VkDeviceSize vertexOffset = 0;
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, depthOnly ? &item.mesh->positionBuffer : &item.mesh->vertexBuffer, &vertexOffset);
+				vkCmdBindIndexBuffer(commandBuffer, item.mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+				boundMesh = item.mesh;
+			}
+
+			uint32_t constantsOffset = sceneConstants.offset + static_cast<uint32_t>(stride * i);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &drawSet, 1, &constantsOffset);
+
+			vkCmdDrawIndexed(commandBuffer, item.mesh->indexCount, 1, 0, 0, 0);
+		}
+	}
+	pendingPipelineDraws += pendingDraws;
+}
+
+void VulkanRenderer::recordInstancedDraws(VkCommandBuffer commandBuffer, const StreamingAllocation& instances) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instancedPipeline);
+	vkCmdSetLineWidth(commandBuffer, 1.0f);
+
+	// the instance stream is bound once, firstInstance picks each batch's range of it
+	VkBuffer instanceBuffer = streamingBuffer.getBuffer();
+	VkDeviceSize instanceOffset = instances.offset;
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffer, &instanceOffset);
+
+	for (const auto& view : views) {
+		setViewport(commandBuffer, view);
+
+		const Mesh* boundMesh = nullptr;
+		for (const auto& batch : instanceBatcher.getBatches()) {
+			if (batch.mesh != boundMesh) {
+				VkDeviceSize vertexOffset = 0;
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &batch.mesh->vertexBuffer, &vertexOffset);
+				vkCmdBindIndexBuffer(commandBuffer, batch.mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+				boundMesh = batch.mesh;
+			}
+			vkCmdDrawIndexed(commandBuffer, batch.mesh->indexCount, batch.instanceCount, 0, 0, batch.firstInstance);
+		}
+	}
+}
+
+void VulkanRenderer::setViewport(VkCommandBuffer commandBuffer, const ViewRect& view) {
+	// viewport and scissor are dynamic state, so a new extent or view layout only changes these two calls
+	VkViewport viewport{};
+	viewport.x = view.x * swapChainExtent.width;
+	viewport.y = view.y * swapChainExtent.height;
+	viewport.width = view.width * swapChainExtent.width;
+	viewport.height = view.height * swapChainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = {static_cast<int32_t>(viewport.x), static_cast<int32_t>(viewport.y)};
+	scissor.extent = {static_cast<uint32_t>(viewport.width), static_cast<uint32_t>(viewport.height)};
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+void VulkanRenderer::ensureRecordWorkers(uint32_t chunkCount) {
+	for (auto& frame : frames) {
+		while (frame.workers.size() < chunkCount) {
+			// one pool per chunk per slot: only one job ever records a chunk (pools aren't thread safe),
+			// and a slot's pools are only reset once its fence says so
+			RecordWorker worker;
+			worker.pool = createTransientCommandPool();
+
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = worker.pool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, &worker.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to allocate secondary command buffer");
+			}
+			frame.workers.push_back(worker);
+		}
+	}
+}
+
+void VulkanRenderer::ensureStreamingCapacity() {
+	// every CPU-issued draw streams its constants once per frame, instanced ones their instance data,
+	// GPU-driven ones stream nothing
+	if (isGpuDriven()) {
+		return;
+	}
+	VkDeviceSize needed = usesInstancing() ? streamingBuffer.getAlignedSize(sizeof(InstanceData) * drawItems.size())
+	                                       : streamingBuffer.getAlignedSize(sizeof(DrawConstants)) * drawItems.size();
+	if (needed <= streamingBuffer.getBytesPerFrame()) {
+		return;
+	}
+
+	// grows only, with headroom so a slowly growing scene doesn't stall on every step
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	streamingBuffer.destroy();
+	streamingBuffer.init(mainDevice.logicalDevice, mainDevice.physicalDevice, allocator, needed + needed / 2, settings.framesInFlight);
+	writeDrawDescriptor();
+	invalidateRecordings();
+}
+
+void VulkanRenderer::setTestScene(uint32_t drawCount, uint32_t overdraw) {
+	// a grid of small copies of the triangle covering the view, each layer nearer than the one drawn before it
+	drawItems.assign(drawCount, DrawItem());
+	uint32_t layers = std::max(1u, overdraw);
+	uint32_t perLayer = std::max(1u, (drawCount + layers - 1) / layers);
+	uint32_t columns = std::max(1u, static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(perLayer)))));
+	float cell = 2.0f / columns;
+
+	jobs.parallelFor(drawCount, 4096, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+			DrawItem& item = drawItems[i];
+			uint32_t layer = i / perLayer;
+			uint32_t position = i % perLayer;
+			float z = static_cast<float>(layers - 1 - layer) / layers;
+			item.mesh = &triangleMesh;
+			item.transform = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f + cell * (position % columns + 0.5f), -1.0f + cell * (position / columns + 0.5f), z));
+			item.transform = glm::scale(item.transform, glm::vec3(cell));
+		}
+	});
+	invalidateScene();
+}
+
+void VulkanRenderer::updateGpuScene() {
+	if (!isGpuDriven() || gpuSceneVersion == sceneVersion) {
+		return;
+	}
+	gpuScene.setObjects(drawItems);
+	gpuSceneVersion = sceneVersion;
+}
+
+void VulkanRenderer::updateInstanceBatches() {
+	if (!usesInstancing() || batcherVersion == sceneVersion) {
+		return;
+	}
+	instanceBatcher.build(drawItems);
+	batcherVersion = sceneVersion;
+}
+
+void VulkanRenderer::cullDraws() {
+	lastFrameTimings.cullMs = 0.0;
+	if (!usesFrustumCulling()) {
+		return;
+	}
+
+	auto cullStart = BenchClock::now();
+	CpuZone cullZone(profiler, "frustum cull");
+	if (cullerVersion != sceneVersion) {
+		// world space spheres, a scaled transform scales the radius by its largest axis
+		frustumCuller.resize(static_cast<uint32_t>(drawItems.size()));
+		jobs.parallelFor(static_cast<uint32_t>(drawItems.size()), 4096, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++) {
+				const DrawItem& item = drawItems[i];
+				glm::vec3 center = glm::vec3(item.transform * glm::vec4(glm::vec3(item.mesh->bounds), 1.0f));
+				float scale = std::max({glm::length(glm::vec3(item.transform[0])), glm::length(glm::vec3(item.transform[1])),
+				                        glm::length(glm::vec3(item.transform[2]))});
+				frustumCuller.setSphere(i, center, item.mesh->bounds.w * scale);
+			}
+		});
+		cullerVersion = sceneVersion;
+	}
+
+	// draw transforms already end in clip space, so the frustum is clip space itself until there's a camera.
+	// Recorded secondaries only stay valid while the visible set does
+	frustumCuller.cullParallel(Frustum::fromMatrix(glm::mat4(1.0f)), FrustumCuller::getBestKernel(), jobs, culledDraws);
+	if (culledDraws != visibleDraws) {
+		visibleDraws.swap(culledDraws);
+		invalidateRecordings();
+	}
+	lastFrameTimings.cullMs = elapsedMs(cullStart, BenchClock::now());
+}
+
+void VulkanRenderer::setMaterialPipeline(uint32_t material, const PipelineDesc& desc, const MaterialConstants& constants) {
+	// recordDraws binds the full vertex stream and the per-draw constants, nothing else
+	if (desc.vertexLayout != VertexLayout::Vertex) {
+		throw std::runtime_error("Failed to set material pipeline, the per-draw path only binds the Vertex layout");
+	}
+	if (material >= materialPipelineIds.size()) {
+		materialPipelineIds.resize(material + 1, NO_MATERIAL_PIPELINE);
+		materialPipelineDescs.resize(material + 1);
+		materialConstants.resize(material + 1);
+	}
+	materialPipelineDescs[material] = desc;
+	materialConstants[material] = constants;
+	requestMaterialPipeline(material);
+}
+
+PipelineDesc VulkanRenderer::getMaterialDesc(const MaterialConstants& constants, bool specialize) const {
+	PipelineDesc desc;
+	desc.vertexShader = "shader.vert";
+	desc.fragmentShader = "material.frag";
+	if (specialize) {
+		// every permutation is its own pipeline, the driver folds the branches for each
+		desc.setConstant(static_cast<uint32_t>(MaterialConstant::Specialized), VK_TRUE);
+		desc.setConstant(static_cast<uint32_t>(MaterialConstant::LightingModel), constants.lightingModel);
+		desc.setConstant(static_cast<uint32_t>(MaterialConstant::AlphaTest), constants.alphaTest ? VK_TRUE : VK_FALSE);
+		desc.setConstant(static_cast<uint32_t>(MaterialConstant::ShadingLoops), constants.shadingLoops);
+	}
+	return desc;
+}
+
+void VulkanRenderer::requestMaterialPipeline(uint32_t material) {
+	if (materialPipelineDescs[material].vertexShader.empty()) {
+		return;
+	}
+
+	// drawn in the main pass, so built like the main pipeline
+	PipelineDesc& desc = materialPipelineDescs[material];
+	desc.colorFormat = swapChainImageFormat;
+	desc.depthFormat = depthFormat;
+	desc.renderPass = usesDynamicRendering() ? VK_NULL_HANDLE : renderPass;
+	desc.layout = pipelineLayout;
+
+	// without async pipelines a new material stalls this frame for the whole compile
+	if (settings.asyncPipelines && settings.pipelineCompileThreads > 0) {
+		materialPipelineIds[material] = pipelineRegistry.requestAsync(desc);
+	} else {
+		materialPipelineIds[material] = pipelineRegistry.request(desc);
+		pipelineRegistry.flush();
+	}
+	invalidateRecordings();
+}
+
+void VulkanRenderer::clearMaterialPipelines() {
+	// the pipelines stay in the registry, asking for the same description again finds them
+	materialPipelineIds.clear();
+	materialPipelineDescs.clear();
+	materialConstants.clear();
+	materialPipelines.clear();
+	materialFallbacks.clear();
+	invalidateRecordings();
+}
+
+void VulkanRenderer::updateMaterialPipelines() {
+	// recorded secondaries may hold a fallback that can now be replaced
+	uint32_t publishedPipelines = pipelineRegistry.getPublishedCount();
+	if (publishedPipelines != seenPublishedPipelines) {
+		seenPublishedPipelines = publishedPipelines;
+		invalidateRecordings();
+	}
+
+	// one atomic load per material here instead of one per draw while recording
+	materialPipelines.resize(materialPipelineIds.size());
+	materialFallbacks.resize(materialPipelineIds.size());
+	for (uint32_t material = 0; material < materialPipelineIds.size(); material++) {
+		uint32_t id = materialPipelineIds[material];
+		const PipelineDesc& desc = materialPipelineDescs[material];
+		materialPipelines[material] = id == NO_MATERIAL_PIPELINE ? graphicsPipeline : pipelineRegistry.getPipeline(id);
+		bool compatible = desc.vertexLayout == mainPipelineDesc.vertexLayout && desc.topology == mainPipelineDesc.topology
+			&& desc.layout == mainPipelineDesc.layout && desc.renderPass == mainPipelineDesc.renderPass
+			&& desc.colorFormat == mainPipelineDesc.colorFormat && desc.depthFormat == mainPipelineDesc.depthFormat;
+		materialFallbacks[material] = id == NO_MATERIAL_PIPELINE || compatible ? graphicsPipeline : VK_NULL_HANDLE;
 	}
 }
 
-void VulkanRenderer::createSemaphores() {
+uint32_t VulkanRenderer::getPendingPipelineCount() const {
+	uint32_t pending = 0;
+	for (uint32_t id : materialPipelineIds) {
+		pending += id != NO_MATERIAL_PIPELINE && pipelineRegistry.getPipeline(id) == VK_NULL_HANDLE && !pipelineRegistry.isFailed(id);
+	}
+	return pending;
+}
+
+uint32_t VulkanRenderer::getFailedPipelineCount() const {
+	uint32_t failed = 0;
+	for (uint32_t id : materialPipelineIds) {
+		failed += id != NO_MATERIAL_PIPELINE && pipelineRegistry.isFailed(id);
+	}
+	return failed;
+}
+
+void VulkanRenderer::setFrustumCulling(bool enabled) {
+	// the spheres are rebuilt before the next culled frame if the scene changed in the meantime
+	settings.frustumCulling = enabled;
+	invalidateRecordings();
+}
+
+void VulkanRenderer::setInstancing(bool enabled) {
+	// batches are built before the next instanced frame if the scene changed in the meantime
+	settings.instancing = enabled;
+	invalidateRecordings();
+}
+
+void VulkanRenderer::setGpuDriven(bool enabled) {
+	// the scene is uploaded before the next GPU-driven frame if it changed in the meantime
+	settings.gpuDriven = enabled;
+	invalidateRecordings();
+}
+
+void VulkanRenderer::setDepthPrepass(bool enabled) {
+	// every pipeline involved already exists, only the recorded secondaries are out of date
+	settings.depthPrepass = enabled;
+	invalidateRecordings();
+}
+
+void VulkanRenderer::createMeshes() {
+	const std::vector<Vertex> vertices = {
+		{{0.0f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}},
+		{{0.5f, 0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+		{{-0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}}
+	};
+	const std::vector<uint32_t> indices = {0, 1, 2};
+
+	triangleMesh = createMesh(vertices, indices);
+
+	// a second prop so scenes can mix meshes
+	const std::vector<Vertex> quadVertices = {
+		{{-0.5f, -0.5f, 0.0f}, {1.0f, 1.0f, 0.0f}},
+		{{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 1.0f}},
+		{{0.5f, 0.5f, 0.0f}, {1.0f, 0.0f, 1.0f}},
+		{{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}}
+	};
+	const std::vector<uint32_t> quadIndices = {0, 1, 2, 2, 3, 0};
+	quadMesh = createMesh(quadVertices, quadIndices);
+	drawItems = {{&triangleMesh, glm::mat4(1.0f)}};
+}
+
+Mesh VulkanRenderer::createMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) {
+	Mesh mesh;
+	uploader.uploadBuffer(vertices.data(), sizeof(Vertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                      mesh.vertexBuffer, mesh.vertexAllocation);
+	uploader.uploadBuffer(indices.data(), sizeof(uint32_t) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	                      mesh.indexBuffer, mesh.indexAllocation);
+
+	// the depth prepass only needs positions, a tightly packed copy halves what it fetches
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		positions[i] = vertices[i].position;
+	}
+	uploader.uploadBuffer(positions.data(), sizeof(glm::vec3) * positions.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                      mesh.positionBuffer, mesh.positionAllocation);
+	mesh.indexCount = static_cast<uint32_t>(indices.size());
+
+	// sphere around the center of the bounding box, what GPU culling tests against
+	glm::vec3 minimum = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+	glm::vec3 maximum = minimum;
+	for (const auto& vertex : vertices) {
+		minimum = glm::min(minimum, vertex.position);
+		maximum = glm::max(maximum, vertex.position);
+	}
+	glm::vec3 center = (minimum + maximum) * 0.5f;
+	float radius = 0.0f;
+	for (const auto& vertex : vertices) {
+		radius = std::max(radius, glm::length(vertex.position - center));
+	}
+	mesh.bounds = glm::vec4(center, radius);
+	return mesh;
+}
+
+void VulkanRenderer::destroyMesh(Mesh& mesh) {
+	allocator.destroyBuffer(mesh.vertexBuffer, mesh.vertexAllocation);
+	allocator.destroyBuffer(mesh.indexBuffer, mesh.indexAllocation);
+	allocator.destroyBuffer(mesh.positionBuffer, mesh.positionAllocation);
+	mesh = Mesh();
+}
+
+void VulkanRenderer::createDescriptorSetLayout() {
+	// dynamic, so one descriptor covers every draw's constants in every frame slot
+	VkDescriptorSetLayoutBinding drawBinding{};
+	drawBinding.binding = 0;
+	drawBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	drawBinding.descriptorCount = 1;
+	drawBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &drawBinding;
+
+	if (vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &layoutInfo, nullptr, &drawSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+}
+
+void VulkanRenderer::createDescriptorSets() {
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize.descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 1;
+
+	if (vkCreateDescriptorPool(mainDevice.logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &drawSetLayout;
+
+	if (vkAllocateDescriptorSets(mainDevice.logicalDevice, &allocInfo, &drawSet) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate descriptor set");
+	}
+
+	writeDrawDescriptor();
+}
+
+void VulkanRenderer::writeDrawDescriptor() {
+	// the range is one draw's worth, the dynamic offset picks which one
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = streamingBuffer.getBuffer();
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(DrawConstants);
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = drawSet;
+	write.dstBinding = 0;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	write.descriptorCount = 1;
+	write.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &write, 0, nullptr);
+}
+
+void VulkanRenderer::createSyncObjects() {
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS
-		|| vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create semaphore");
+	// fences start signalled so the first wait on each slot returns immediately
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (auto& frame : frames) {
+		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) != VK_SUCCESS
+			|| vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreInfo, nullptr, &frame.renderFinishedSemaphore) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create semaphore");
+		}
+
+		if (vkCreateFence(mainDevice.logicalDevice, &fenceInfo, nullptr, &frame.inFlightFence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create fence");
+		}
+	}
+
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+}
+
+void VulkanRenderer::createHeadlessTargets() {
+	// stand-ins for swap chain images: one device-local color image per frame slot,
+	// so createImageViews/createFrameBuffers/recordCommandBuffer run exactly as they do with a window
+	swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	swapChainExtent = {settings.headlessWidth, settings.headlessHeight};
+
+	swapChainImages.resize(settings.framesInFlight);
+	headlessImageAllocations.resize(settings.framesInFlight);
+
+	for (size_t i = 0; i < swapChainImages.size(); i++) {
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = swapChainImageFormat;
+		imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;		// transfer src for readback
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		allocator.createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], headlessImageAllocations[i]);
+	}
+}
+
+void VulkanRenderer::readbackLastFrame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height) {
+	if (!settings.headless) {
+		throw std::runtime_error("Readback is only supported in headless mode");
+	}
+	// before the first frame the target is still in UNDEFINED layout with nothing in it
+	if (frameNumber == 0) {
+		throw std::runtime_error("Failed to read back frame, nothing has been drawn yet");
+	}
+
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+
+	width = swapChainExtent.width;
+	height = swapChainExtent.height;
+	VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+
+	// host visible staging buffer to copy the image into, allocator memory of this kind is always mapped
+	VkBuffer stagingBuffer;
+	Allocation stagingAllocation;
+	allocator.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingAllocation);
+
+	// the render graph leaves headless targets in TRANSFER_SRC_OPTIMAL
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {width, height, 1};
+	vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[lastImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                       stagingBuffer, 1, &region);
+
+	// make the copy visible to the host read below
+	VkMemoryBarrier hostBarrier{};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+	endSingleTimeCommands(commandBuffer);
+
+	pixels.resize(static_cast<size_t>(imageSize));
+	memcpy(pixels.data(), stagingAllocation.mapped, static_cast<size_t>(imageSize));
+
+	allocator.destroyBuffer(stagingBuffer, stagingAllocation);
+}
+
+VkCommandBuffer VulkanRenderer::beginSingleTimeCommands() {
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(mainDevice.logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffer");
 	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	return commandBuffer;
+}
+
+void VulkanRenderer::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit one-off command buffer");
+	}
+	vkQueueWaitIdle(graphicsQueue);
+
+	vkFreeCommandBuffers(mainDevice.logicalDevice, commandPool, 1, &commandBuffer);
 }
 
 void VulkanRenderer::getPhysicalDevice() {
@@ -376,8 +1463,8 @@ bool VulkanRenderer::isDeviceSuitable(VkPhysicalDevice device) {
 
 	bool extensionsSupported = checkDeviceExtensionsSupport(device);
 
-	bool swapChainAdequate = false;
-	if (extensionsSupported) {
+	bool swapChainAdequate = settings.headless;		// no surface to present to in headless mode
+	if (extensionsSupported && !settings.headless) {
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
@@ -403,8 +1490,11 @@ QueueFamilyIndices VulkanRenderer::findQueueFamilies(VkPhysicalDevice device) {
 		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {		// this basically says: does this queue family contain graphics queue? see definition of VkQueueFlagBits for all types of queues
 			indices.graphicsFamily = i;		// if queue family is valid, then get index
 
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			// nothing is presented in headless mode, the "present" queue is just the graphics queue
+			VkBool32 presentSupport = settings.headless;
+			if (!settings.headless) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			}
 			if (presentSupport) {
 				indices.presentFamily = i;
 			}
@@ -418,30 +1508,152 @@ QueueFamilyIndices VulkanRenderer::findQueueFamilies(VkPhysicalDevice device) {
 		i++;
 	}
 
+	// uploads prefer the dedicated copy engine: a family that transfers and does nothing else. Without one, a
+	// family that can transfer but not draw (async compute) still keeps uploads off the graphics queue
+	auto findTransferFamily = [&](VkQueueFlags excluded) -> std::optional<uint32_t> {
+		for (uint32_t family = 0; family < queueFamilyCount; family++) {
+			const auto& queueFamily = queueFamilyList[family];
+			if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & excluded)) {
+				return family;
+			}
+		}
+		return std::nullopt;
+	};
+	indices.transferFamily = findTransferFamily(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+	if (!indices.transferFamily.has_value()) {
+		indices.transferFamily = findTransferFamily(VK_QUEUE_GRAPHICS_BIT);
+	}
+	if (!indices.transferFamily.has_value()) {
+		indices.transferFamily = indices.graphicsFamily;
+	}
+
 	return indices;
 }
 
-void VulkanRenderer::drawFrame() {
-	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapChain, UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+VkFormat VulkanRenderer::chooseDepthFormat() const {
+	// most precise first, none with stencil since nothing uses it. D16 attachments are required by the spec
+	const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM};
+	for (VkFormat format : candidates) {
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, format, &properties);
+		if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+			return format;
+		}
+	}
+
+	throw std::runtime_error("Failed to find a supported depth format");
+}
+
+std::vector<const char*> VulkanRenderer::getRequiredDeviceExtensions() const {
+	// the swap chain extension is only needed when there is a surface to present to
+	if (settings.headless) {
+		return {};
+	}
+	return deviceExtensions;
+}
+
+bool VulkanRenderer::drawFrame() {
+	// a resize (or minimize) was reported since the last frame, there is nothing to draw into while minimized
+	if (!settings.headless && framebufferResized && !recreateSwapChain()) {
+		return false;
+	}
+
+	auto frameStart = BenchClock::now();
+	FrameData& frame = frames[currentFrame];
+	profiler.beginCpuFrame(frameNumber);
+
+	// wait until the GPU is done with the last submission that used this slot,
+	// the other slots keep the GPU busy while we record this one
+	vkWaitForFences(mainDevice.logicalDevice, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+	auto fenceEnd = BenchClock::now();
+	profiler.addCpuZone("wait for frame slot", frameStart, fenceEnd);
+
+	// CPU work on the scene, kept out of the acquire wait and the latency below
+	destroyRetiredSwapChains(false);
+	ensureStreamingCapacity();
+	updateGpuScene();
+	updateInstanceBatches();
+	cullDraws();
+	updateMaterialPipelines();
+	streamingBuffer.beginFrame(currentFrame);
+	auto prepareEnd = BenchClock::now();		// also where acquire-to-present latency starts
+	profiler.addCpuZone("prepare", fenceEnd, prepareEnd);
+
+	// headless targets are owned one per slot, so there is nothing to acquire
+	uint32_t imageIndex = currentFrame;
+	if (!settings.headless) {
+		VkResult result = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapChain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+
+		// nothing was acquired and the slot's fence is still signalled, so the frame can simply be dropped
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			recreateSwapChain();
+			return false;
+		}
+		// VK_SUBOPTIMAL_KHR still hands out an image (and signals the semaphore), rebuild after presenting it
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			throw std::runtime_error("Failed to acquire swap chain image");
+		}
+	}
+
+	// the swap chain may hand out images out of order, so an older slot can still be rendering to this image
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+		vkWaitForFences(mainDevice.logicalDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	}
+	imagesInFlight[imageIndex] = frame.inFlightFence;
+	auto acquireEnd = BenchClock::now();
+	profiler.addCpuZone("acquire", prepareEnd, acquireEnd);
+
+	vkResetFences(mainDevice.logicalDevice, 1, &frame.inFlightFence);
+
+	auto recordStart = BenchClock::now();
+	{
+		CpuZone recordZone(profiler, "record");
+		lastFrameTimings.secondariesRecorded = 0;
+		lastFrameTimings.secondariesReused = 0;
+		pendingPipelineDraws = 0;
+		vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+		recordCommandBuffer(frame.commandBuffer, imageIndex, settings.recordThreads);
+	}
+	lastFrameTimings.recordMs = elapsedMs(recordStart, BenchClock::now());
+	lastFrameTimings.pendingPipelineDraws = pendingPipelineDraws;
+	lastFrameTimings.graphBarriers = renderGraph.getStats().barriers;
+	lastFrameTimings.graphAliasedBytesSaved = renderGraph.getStats().aliasedBytesSaved();
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	VkSemaphore waitSemaphores[]{imageAvailableSemaphore};
+	VkSemaphore waitSemaphores[]{frame.imageAvailableSemaphore};
 	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.waitSemaphoreCount = settings.headless ? 0 : 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
 
-	VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
-	submitInfo.signalSemaphoreCount = 1;
+	VkSemaphore signalSemaphores[] = {frame.renderFinishedSemaphore};
+	submitInfo.signalSemaphoreCount = settings.headless ? 0 : 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+	auto submitStart = BenchClock::now();
+	profiler.markSubmit(currentFrame);
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to submit draw command buffer!");
 	}
+	auto submitEnd = BenchClock::now();
+	profiler.addCpuZone("submit", submitStart, submitEnd);
+
+	lastFrameTimings.acquireWaitMs = elapsedMs(frameStart, fenceEnd) + elapsedMs(prepareEnd, acquireEnd);
+	lastFrameTimings.prepareMs = elapsedMs(fenceEnd, prepareEnd);
+	lastFrameTimings.submitMs = elapsedMs(submitStart, submitEnd);
+	lastFrameTimings.presentMs = 0.0;
+	lastFrameTimings.acquireToPresentMs = elapsedMs(prepareEnd, submitEnd);
+
+	lastImageIndex = imageIndex;
+	if (settings.headless) {
+		currentFrame = (currentFrame + 1) % settings.framesInFlight;
+		frameNumber++;
+		lastFrameTimings.cpuMs = elapsedMs(frameStart, BenchClock::now());
+		return true;
+	}
 
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -453,7 +1665,39 @@ void VulkanRenderer::drawFrame() {
 	presentInfo.pSwapchains = swapChains;
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr;
-	vkQueuePresentKHR(presentQueue, &presentInfo);
+	VkResult presentResult = vkQueuePresentKHR(presentQueue, &presentInfo);
+	auto presentEnd = BenchClock::now();
+	profiler.addCpuZone("present", submitEnd, presentEnd);
+
+	currentFrame = (currentFrame + 1) % settings.framesInFlight;
+	frameNumber++;
+
+	lastFrameTimings.presentMs = elapsedMs(submitEnd, presentEnd);
+	lastFrameTimings.acquireToPresentMs = elapsedMs(prepareEnd, presentEnd);
+	lastFrameTimings.cpuMs = elapsedMs(frameStart, presentEnd);
+	lastFrameTimings.recreateMs = pendingRecreateMs;
+	pendingRecreateMs = 0.0;
+
+	// the frame was submitted either way, rebuild so the next one goes to a matching swap chain
+	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
+		framebufferResized = true;
+	} else if (presentResult != VK_SUCCESS) {
+		throw std::runtime_error("Failed to present swap chain image");
+	}
+
+	return true;
+}
+
+void VulkanRenderer::writeTrace(const std::string& path) {
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	profiler.flush();
+	profiler.writeChromeTrace(path);
+}
+
+std::string VulkanRenderer::getDeviceName() const {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &properties);
+	return properties.deviceName;
 }
 
 bool VulkanRenderer::checkValidationLayerSupport() {
@@ -482,11 +1726,15 @@ bool VulkanRenderer::checkValidationLayerSupport() {
 }
 
 std::vector<const char*> VulkanRenderer::getRequiredExtensions() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+
+	// surface extensions are only needed (and GLFW only initialised) when rendering to a window
+	if (!settings.headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (enableValidationLayers) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -533,7 +1781,8 @@ bool VulkanRenderer::checkDeviceExtensionsSupport(VkPhysicalDevice device) {
 	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+	std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 	for (const auto& extension : availableExtensions) {
 		requiredExtensions.erase(extension.extensionName);
 	}
@@ -580,15 +1829,86 @@ VkSurfaceFormatKHR VulkanRenderer::chooseSwapSurfaceFormat(const std::vector<VkS
 }
 
 VkPresentModeKHR VulkanRenderer::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
-	for (const auto& availablePresentMode : availablePresentModes) {
-		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-			return availablePresentMode;
+	// most preferred first for each policy, FIFO is the only mode every device has to support
+	std::vector<VkPresentModeKHR> preferred;
+	switch (settings.presentPolicy) {
+	case PresentPolicy::LowLatency:
+		// IMMEDIATE tears but never waits, FIFO_RELAXED only tears when a frame is late
+		preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+		break;
+	case PresentPolicy::Throughput:
+		preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+		break;
+	case PresentPolicy::PowerSaving:
+		break;
+	}
+
+	for (auto presentMode : preferred) {
+		if (std::find(availablePresentModes.begin(), availablePresentModes.end(), presentMode) != availablePresentModes.end()) {
+			return presentMode;
 		}
 	}
 
 	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+uint32_t VulkanRenderer::chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentMode) {
+	uint32_t imageCount = capabilities.minImageCount + 1;
+	switch (settings.presentPolicy) {
+	case PresentPolicy::LowLatency:
+		// fewer images means fewer frames queued between the CPU and the display,
+		// but MAILBOX needs a third one to have something to replace
+		imageCount = std::max(capabilities.minImageCount, presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? 3u : 2u);
+		break;
+	case PresentPolicy::Throughput:
+		imageCount = std::max(capabilities.minImageCount + 1, 3u);
+		break;
+	case PresentPolicy::PowerSaving:
+		// double buffered vsync, the CPU blocks on the display instead of racing ahead
+		imageCount = std::max(capabilities.minImageCount, 2u);
+		break;
+	}
+
+	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
+		imageCount = capabilities.maxImageCount;
+	}
+	return imageCount;
+}
+
+void VulkanRenderer::setSplitScreen(uint32_t count) {
+	count = std::max(count, 1u);
+	std::vector<ViewRect> splitViews(count);
+	for (uint32_t i = 0; i < count; i++) {
+		splitViews[i].x = static_cast<float>(i) / count;
+		splitViews[i].y = 0.0f;
+		splitViews[i].width = 1.0f / count;
+		splitViews[i].height = 1.0f;
+	}
+	setViews(splitViews);
+}
+
+void VulkanRenderer::setPresentPolicy(PresentPolicy policy) {
+	if (settings.headless || policy == settings.presentPolicy) {
+		return;
+	}
+	settings.presentPolicy = policy;
+	framebufferResized = true;
+}
+
+const char* VulkanRenderer::getPresentModeName() const {
+	if (settings.headless) {
+		return "none";
+	}
+
+	switch (swapChainPresentMode) {
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+	case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+	default: return "other";
+	}
+}
+
 VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
 	// the swap extent is the resolution of the swap chain images and it's almost always exactly equal
 	// to the resolution of the window that we're drawing to in pixels.
@@ -611,17 +1931,14 @@ VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capa
 	return actualExtent;
 }
 
-void VulkanRenderer::createSwapChain() {
+void VulkanRenderer::createSwapChain(VkSwapchainKHR oldSwapChain) {
 	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(mainDevice.physicalDevice);
 
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 	VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-	uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-	if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
-		imageCount = swapChainSupport.capabilities.maxImageCount;
-	}
+	uint32_t imageCount = chooseSwapImageCount(swapChainSupport.capabilities, presentMode);
 
 	VkSwapchainCreateInfoKHR createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -650,7 +1967,7 @@ void VulkanRenderer::createSwapChain() {
 
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	createInfo.oldSwapchain = oldSwapChain;		// lets the driver reuse resources and keep presenting the old images meanwhile
 
 	if (vkCreateSwapchainKHR(mainDevice.logicalDevice, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create swap chain");
@@ -662,6 +1979,83 @@ void VulkanRenderer::createSwapChain() {
 
 	swapChainImageFormat = surfaceFormat.format;
 	swapChainExtent = extent;
+	swapChainPresentMode = presentMode;
+}
+
+bool VulkanRenderer::recreateSwapChain() {
+	// a minimized window has a zero sized framebuffer, which is not a valid swap chain extent
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(window, &width, &height);
+	minimized = width == 0 || height == 0;
+	if (minimized) {
+		framebufferResized = true;		// try again once the window comes back
+		return false;
+	}
+	framebufferResized = false;
+	auto recreateStart = BenchClock::now();
+
+	// frames still in flight keep using the old objects, so they are retired instead of destroyed
+	// and no vkDeviceWaitIdle is needed
+	RetiredSwapChain retired{};
+	retired.retireFrame = frameNumber;
+	retired.swapChain = swapChain;
+	retired.imageViews = std::move(swapChainImageViews);
+	retired.framebuffers = std::move(swapChainFramebuffers);
+	retired.depthTargets = std::move(depthTargets);
+
+	VkFormat oldFormat = swapChainImageFormat;
+	createSwapChain(retired.swapChain);
+
+	// the render pass (and so the pipeline built against it) depends on the format, viewport and scissor are
+	// dynamic so a new extent never needs a new pipeline
+	if (swapChainImageFormat != oldFormat) {
+		retired.renderPass = renderPass;
+		retired.pipelines = pipelineRegistry.evict([&](const PipelineDesc& desc) { return desc.colorFormat == oldFormat; });
+		retired.pipelineLayout = pipelineLayout;
+		createRenderPass();
+		createGraphicsPipeline();
+		for (uint32_t material = 0; material < materialPipelineIds.size(); material++) {
+			requestMaterialPipeline(material);
+		}
+	}
+
+	createImageViews();
+	createDepthTargets();
+	createFrameBuffers();
+	retiredSwapChains.push_back(std::move(retired));
+
+	// the new images have never been rendered to
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+	invalidateRecordings();
+	pendingRecreateMs += elapsedMs(recreateStart, BenchClock::now());
+	return true;
+}
+
+void VulkanRenderer::destroyRetiredSwapChains(bool waitedIdle) {
+	// called right after waiting on the current slot's fence, so frame (frameNumber - framesInFlight) and every
+	// frame before it has finished; the last frame using a retired swap chain is retireFrame - 1
+	auto it = retiredSwapChains.begin();
+	while (it != retiredSwapChains.end()) {
+		if (!waitedIdle && frameNumber + 1 < it->retireFrame + settings.framesInFlight) {
+			++it;
+			continue;
+		}
+
+		for (auto framebuffer : it->framebuffers) {
+			vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+		}
+		for (auto imageView : it->imageViews) {
+			vkDestroyImageView(mainDevice.logicalDevice, imageView, nullptr);
+		}
+		destroyDepthTargets(it->depthTargets);
+		for (auto pipeline : it->pipelines) {
+			vkDestroyPipeline(mainDevice.logicalDevice, pipeline, nullptr);
+		}
+		vkDestroyPipelineLayout(mainDevice.logicalDevice, it->pipelineLayout, nullptr);
+		vkDestroyRenderPass(mainDevice.logicalDevice, it->renderPass, nullptr);
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, it->swapChain, nullptr);
+		it = retiredSwapChains.erase(it);
+	}
 }
 
 std::vector<VkImageView> VulkanRenderer::createImageViews() {
@@ -691,213 +2085,128 @@ std::vector<VkImageView> VulkanRenderer::createImageViews() {
 }
 
 void VulkanRenderer::createGraphicsPipeline() {
-	auto vertShaderCode = readFile("D:/VKTutorial/shaders/vert.spv");
-	auto fragShaderCode = readFile("D:/VKTutorial/shaders/frag.spv");
-
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;			// shader module for the 
-	vertShaderStageInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = {
-		vertShaderStageInfo,
-		fragShaderStageInfo
-	};
-
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.pVertexBindingDescriptions = nullptr;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
-
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(swapChainExtent.width);
-	viewport.height = static_cast<float>(swapChainExtent.height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor{};
-	scissor.offset = {0, 0};
-	scissor.extent = swapChainExtent;
-
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
-
-	VkPipelineRasterizationStateCreateInfo rasterizer{};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f; // thickness of lines in terms of number of fragments
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f;
-	rasterizer.depthBiasClamp = 0.0f;
-	rasterizer.depthBiasSlopeFactor = 0.0f;
-
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading = 1.0f;
-	multisampling.pSampleMask = nullptr;
-	multisampling.alphaToCoverageEnable = VK_FALSE;
-	multisampling.alphaToOneEnable = VK_FALSE;
-
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-		| VK_COLOR_COMPONENT_G_BIT
-		| VK_COLOR_COMPONENT_B_BIT
-		| VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_TRUE;
-	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
-
-
-	VkDynamicState dynamicStates[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
-	};
-	VkPipelineDynamicStateCreateInfo dynamicState{};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = 2;
-	dynamicState.pDynamicStates = dynamicStates;
-
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
-	pipelineLayoutInfo.pSetLayouts = nullptr;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &drawSetLayout;
+
+	// material switches for material.frag, the other shaders don't declare them
+	VkPushConstantRange materialRange{};
+	materialRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	materialRange.offset = 0;
+	materialRange.size = sizeof(MaterialConstants);
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &materialRange;
 
 	if (vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create pipeline layout");
 	}
 
-	//Shader modules are just a thin wrapper around the shader bytecode
-	//that we've previously loaded from a file and the functions defined in it.
-	//The compilation and linking of the SPIR-V bytecode to machine code for execution
-	//by the GPU doesn't happen until the graphics pipeline is created.
-	//That means that we're allowed to destroy the shader modules again as soon as
-	//pipeline creation is finished, which is why we'll make them local variables
-	//in the createGraphicsPipeline function instead of class members.
-
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr;
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.basePipelineIndex = -1;
-
-	if (vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create graphics pipeline");
-	}
-
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertShaderModule, nullptr);
+	// without a prepass the main pass tests and writes depth itself. Without a render pass the pipelines are
+	// built against the attachment formats instead
+	PipelineDesc mainDesc;
+	mainDesc.vertexShader = "shader.vert";
+	mainDesc.fragmentShader = "shader.frag";
+	mainDesc.colorFormat = swapChainImageFormat;
+	mainDesc.depthFormat = depthFormat;
+	mainDesc.renderPass = usesDynamicRendering() ? VK_NULL_HANDLE : renderPass;
+	mainDesc.layout = pipelineLayout;
+
+	// the prepass runs no fragment shader and fetches positions only, with color writes masked off
+	PipelineDesc prepassDesc = mainDesc;
+	prepassDesc.vertexShader = "depth.vert";
+	prepassDesc.fragmentShader.clear();
+	prepassDesc.vertexLayout = VertexLayout::Position;
+	prepassDesc.blend = BlendMode::Opaque;
+	prepassDesc.colorWriteMask = 0;
+
+	// after a prepass the depth buffer is final, only the fragment that wrote it passes and nothing is written
+	PipelineDesc equalDesc = mainDesc;
+	equalDesc.depthWrite = false;
+	equalDesc.depthCompare = VK_COMPARE_OP_EQUAL;
+
+	// GPU-driven draws get their transform from the object buffer instead of per-draw constants
+	PipelineDesc indirectDesc = mainDesc;
+	indirectDesc.vertexShader = "indirect.vert";
+	indirectDesc.layout = gpuScene.getDrawLayout();
+
+	// instanced draws add the per-instance stream as a second binding
+	PipelineDesc instancedDesc = mainDesc;
+	instancedDesc.vertexShader = "instanced.vert";
+	instancedDesc.vertexLayout = VertexLayout::Instanced;
+
+	mainPipelineDesc = mainDesc;
+	uint32_t ids[] = {
+		pipelineRegistry.request(mainDesc),
+		pipelineRegistry.request(prepassDesc),
+		pipelineRegistry.request(equalDesc),
+		pipelineRegistry.request(indirectDesc),
+		pipelineRegistry.request(instancedDesc)
+	};
+	pipelineRegistry.flush();
+	graphicsPipeline = pipelineRegistry.getPipeline(ids[0]);
+	depthPrepassPipeline = pipelineRegistry.getPipeline(ids[1]);
+	depthEqualPipeline = pipelineRegistry.getPipeline(ids[2]);
+	indirectPipeline = pipelineRegistry.getPipeline(ids[3]);
+	instancedPipeline = pipelineRegistry.getPipeline(ids[4]);
 }
 
-VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code) {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(mainDevice.logicalDevice, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create shader module");
-	}
-
-	return shaderModule;
+void VulkanRenderer::createRenderPass() {
+	// dynamic rendering has no render pass objects at all
+	renderPass = usesDynamicRendering() ? VK_NULL_HANDLE : createMainRenderPass(swapChainImageFormat, depthFormat);
 }
 
-void VulkanRenderer::createRenderPass() {
+VkRenderPass VulkanRenderer::createMainRenderPass(VkFormat colorFormat, VkFormat depthStencilFormat) {
 	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapChainImageFormat;
+	colorAttachment.format = colorFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// the render graph moves the target into and out of the attachment layout with its own barriers (which also order
+	// the pass against the acquire semaphore and presentation), so the render pass does no transitions of its own
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	// depth only lives for the pass: cleared on load and never stored, so a tiler keeps it on chip
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = depthStencilFormat;
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentReference depthAttachmentRef{};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// the prepass and the main pass share the subpass, draws within it are depth tested in submission order
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(std::size(attachments));
+	renderPassInfo.pAttachments = attachments;
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
 
-	if (vkCreateRenderPass(mainDevice.logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+	VkRenderPass newRenderPass;
+	if (vkCreateRenderPass(mainDevice.logicalDevice, &renderPassInfo, nullptr, &newRenderPass) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create render pass");
 	}
-
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	return newRenderPass;
 }
@@ -1,20 +1,146 @@
 #pragma once
+#include <atomic>
 #include <vector>
+#include <string>
+#include <set>
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan_core.h>
 
 #include "Utilities.h"
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+#include "DeviceAllocator.h"
+#include "BufferUploader.h"
+#include "Mesh.h"
+#include "StreamingBuffer.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "GpuScene.h"
+#include "InstanceBatcher.h"
+#include "FrustumCuller.h"
+#include "PipelineRegistry.h"
 
 struct SwapChainSupportDetails;
 
 class VulkanRenderer {
 public:
-	int initVulkan(GLFWwindow* newWindow);
+	int initVulkan(GLFWwindow* newWindow, const RendererSettings& newSettings = RendererSettings());
 	void cleanUp();
-	void drawFrame();
+	// returns false when no frame was rendered (minimized window, or the swap chain had to be rebuilt first)
+	bool drawFrame();
+
+	// - window
+	// called from the GLFW framebuffer size callback, the swap chain is rebuilt before the next frame
+	void notifyResized() { framebufferResized = true; }
+	bool isMinimized() const { return minimized; }
+
+	// - presentation
+	// takes effect on the next frame by recreating the swap chain
+	void setPresentPolicy(PresentPolicy policy);
+	PresentPolicy getPresentPolicy() const { return settings.presentPolicy; }
+	const char* getPresentModeName() const;
+	uint32_t getSwapChainImageCount() const { return static_cast<uint32_t>(swapChainImages.size()); }
+
+	// - views
+	// the scene is drawn once per view, viewport and scissor are dynamic so changing these never rebuilds a pipeline
+	void setViews(const std::vector<ViewRect>& newViews) { views = newViews; invalidateRecordings(); }
+	// evenly split the target into count side-by-side views
+	void setSplitScreen(uint32_t count);
+
+	// - scene
+	// replaces the scene with drawCount small copies of the triangle laid out in a grid. With overdraw > 1 the grid
+	// is stacked that many times, drawn back to front so every layer passes the depth test without a prepass
+	void setTestScene(uint32_t drawCount, uint32_t overdraw = 1);
+	uint32_t getDrawCount() const { return static_cast<uint32_t>(drawItems.size()); }
+
+	// - GPU-driven drawing
+	// the scene is culled by a compute pass and drawn with one indirect count draw per mesh, so recording costs
+	// the same for any object count. Only takes effect when the device supports it
+	void setGpuDriven(bool enabled);
+	bool isGpuDriven() const { return settings.gpuDriven && gpuScene.isSupported(); }
+	bool supportsGpuDriven() const { return gpuScene.isSupported(); }
+
+	// - instancing
+	// draw items sharing a mesh and material become one instanced draw, transforms and materials go
+	// through a per-instance vertex stream. Ignored while GPU-driven drawing is on
+	void setInstancing(bool enabled);
+	bool isInstancingEnabled() const { return settings.instancing; }
+	uint32_t getInstanceBatchCount() const { return static_cast<uint32_t>(instanceBatcher.getBatches().size()); }
+
+	// - frustum culling
+	// the per-draw path culls the draw items' bounding spheres on the CPU every frame (SIMD, spread over the jobs)
+	// and records only the visible ones. The GPU-driven path culls on the GPU, instanced draws aren't culled
+	void setFrustumCulling(bool enabled);
+	bool isFrustumCullingEnabled() const { return settings.frustumCulling; }
+	uint32_t getVisibleDrawCount() const { return usesFrustumCulling() ? static_cast<uint32_t>(visibleDraws.size()) : getDrawCount(); }
+
+	// - material pipelines
+	// the per-draw path draws items whose material has a pipeline with it (the main pipeline is used after a
+	// depth prepass). desc only needs shaders and state, targets and layout are filled in here. With async
+	// pipelines it compiles in the background and the material's draws fall back (or are skipped) until it's ready
+	void setMaterialPipeline(uint32_t material, const PipelineDesc& desc, const MaterialConstants& constants = MaterialConstants());
+	// material.frag for these switches, either compiled into the pipeline as specialization constants or left
+	// to runtime branches on the pushed MaterialConstants
+	PipelineDesc getMaterialDesc(const MaterialConstants& constants, bool specialize) const;
+	void clearMaterialPipelines();
+	void setAsyncPipelines(bool enabled) { settings.asyncPipelines = enabled; }
+	bool isAsyncPipelinesEnabled() const { return settings.asyncPipelines; }
+	void setSkipPendingDraws(bool enabled) { settings.skipPendingDraws = enabled; invalidateRecordings(); }
+	// materials whose pipeline is still compiling, and those whose pipeline failed to compile
+	uint32_t getPendingPipelineCount() const;
+	uint32_t getFailedPipelineCount() const;
+
+	// - depth
+	// depth-only pass over the scene before the main pass, which then shades only the visible fragment (EQUAL test).
+	// Can be toggled between frames, every pipeline involved is always built
+	void setDepthPrepass(bool enabled);
+	bool isDepthPrepassEnabled() const { return settings.depthPrepass; }
+	VkFormat getDepthFormat() const { return depthFormat; }
+	// the depth targets have no backing memory unless the tiler has to spill them
+	bool isDepthLazilyAllocated() const { return depthLazilyAllocated; }
+
+	// - jobs
+	// CPU work that can be spread over cores (recording, culling, asset work) goes through here
+	JobSystem& getJobSystem() { return jobs; }
+
+	// - render graph
+	// passes of the frame being recorded and the barriers between them, stats are for the last recorded frame
+	const RenderGraphStats& getRenderGraphStats() const { return renderGraph.getStats(); }
+	// main pass goes through vkCmdBeginRenderingKHR on the image views instead of render pass and framebuffer objects
+	bool usesDynamicRendering() const { return isDeviceExtensionEnabled(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME); }
+
+	// - frame ring
+	uint32_t getFrameSlot() const { return currentFrame; }			// slot of the frame being recorded, use to key per-frame resources
+	uint64_t getFrameIndex() const { return frameNumber; }			// monotonically increasing count of frames submitted so far
+	uint32_t getFramesInFlight() const { return settings.framesInFlight; }
+
+	// - stats
+	const FrameTimings& getLastFrameTimings() const { return lastFrameTimings; }
+	const StartupTimings& getStartupTimings() const { return startupTimings; }
+	PipelineRegistryStats getPipelineStats() const { return pipelineRegistry.getStats(); }
+	std::string getDeviceName() const;
+	AllocatorStats getMemoryStats() const { return allocator.getStats(); }
+
+	// - micro benchmarks
+	// runs the named benchmark against the initialised device and writes its results into the open JSON object
+	void runMicroBenchmark(const std::string& name, JsonWriter& json);
+	VkExtent2D getExtent() const { return swapChainExtent; }
+
+	// - profiling
+	GpuProfiler& getProfiler() { return profiler; }
+	// waits for outstanding frames so their GPU zones are included, then writes a chrome://tracing JSON file
+	void writeTrace(const std::string& path);
+
+	// - headless
+	bool isHeadless() const { return settings.headless; }
+	// copy the most recently rendered image back to the host as tightly packed RGBA8
+	void readbackLastFrame(std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height);
 
 private:
 	GLFWwindow* window;
+	RendererSettings settings;
 
 	// vulkan components
 	VkInstance instance;
@@ -30,20 +156,150 @@ private:
 
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	VkQueue transferQueue;		// same as graphicsQueue when there's no transfer-only family
 	VkSwapchainKHR swapChain;
 	std::vector<VkImage> swapChainImages;
 	std::vector<VkImageView> swapChainImageViews;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
+	VkPresentModeKHR swapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
 	VkRenderPass renderPass;
 	VkPipelineLayout pipelineLayout;
-	VkPipeline graphicsPipeline;
+	// owned by pipelineRegistry
+	VkPipeline graphicsPipeline;			// depth test LESS with writes, used without a prepass
+	VkPipeline depthPrepassPipeline;		// positions only, depth writes, no color
+	VkPipeline depthEqualPipeline;			// after the prepass: depth test EQUAL, no writes
+	VkPipeline indirectPipeline;			// GPU-driven draws, transforms from the GPU scene's object buffer
+	VkPipeline instancedPipeline;			// instanced draws, transforms and materials from the instance stream
 	std::vector<VkFramebuffer> swapChainFramebuffers;
+
+	// one depth target per swap chain image, like the framebuffers: waiting for the image's last frame orders it too.
+	// Never loaded or stored, so it can live in lazily allocated memory
+	struct DepthTarget {
+		VkImage image = VK_NULL_HANDLE;
+		Allocation allocation;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+	std::vector<DepthTarget> depthTargets;
+	VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+	bool depthLazilyAllocated = false;
+	bool framebufferResized = false;
+	bool minimized = false;
+	std::vector<ViewRect> views = {ViewRect()};
+
+	// swap chain objects replaced by recreateSwapChain, destroyed once no frame in flight can still use them
+	struct RetiredSwapChain {
+		uint64_t retireFrame;				// first frame number that no longer uses these
+		VkSwapchainKHR swapChain;
+		std::vector<VkImageView> imageViews;
+		std::vector<VkFramebuffer> framebuffers;
+		std::vector<DepthTarget> depthTargets;
+		// only replaced when the surface format changes
+		std::vector<VkPipeline> pipelines;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+	};
+	std::vector<RetiredSwapChain> retiredSwapChains;
+
+	JobSystem jobs;
+
+	// declared again every frame, handles layout transitions and synchronization between passes
+	RenderGraph renderGraph;
+
+	// every buffer and image the renderer owns gets its memory from here
+	DeviceAllocator allocator;
+	BufferUploader uploader;
+	Mesh triangleMesh;
+	Mesh quadMesh;
+	std::vector<DrawItem> drawItems;
+
+	// the scene as the GPU-driven path sees it, uploaded again when sceneVersion moves past gpuSceneVersion
+	GpuScene gpuScene;
+	uint64_t sceneVersion = 1;
+	uint64_t gpuSceneVersion = 0;
+	// call after changing drawItems
+	void invalidateScene() { sceneVersion++; invalidateRecordings(); }
+	void updateGpuScene();
+
+	// instance batches of the scene, rebuilt when sceneVersion moves past batcherVersion
+	InstanceBatcher instanceBatcher;
+	uint64_t batcherVersion = 0;
+	bool usesInstancing() const { return settings.instancing && !isGpuDriven(); }
+	void updateInstanceBatches();
+
+	// bounding spheres of the scene, rebuilt when sceneVersion moves past cullerVersion. visibleDraws is what the
+	// per-draw path records while culling is on, indices into drawItems in their original order
+	FrustumCuller frustumCuller;
+	uint64_t cullerVersion = 0;
+	std::vector<uint32_t> visibleDraws;
+	std::vector<uint32_t> culledDraws;
+	bool usesFrustumCulling() const { return settings.frustumCulling && !isGpuDriven() && !usesInstancing(); }
+	void cullDraws();
+
+	// per material: its pipeline's registry id (NO_MATERIAL_PIPELINE without one), description and pushed switches, and the
+	// pipeline its draws use this frame, resolved once before recording. Null there means still compiling
+	static const uint32_t NO_MATERIAL_PIPELINE = UINT32_MAX;
+	std::vector<uint32_t> materialPipelineIds;
+	std::vector<PipelineDesc> materialPipelineDescs;
+	std::vector<MaterialConstants> materialConstants;
+	std::vector<VkPipeline> materialPipelines;
+	// what a material's draws use while its pipeline isn't there: the main pipeline if it's built for the same
+	// vertex layout, topology, layout and targets, otherwise null and the draws are skipped
+	std::vector<VkPipeline> materialFallbacks;
+	PipelineDesc mainPipelineDesc;
+	uint32_t seenPublishedPipelines = 0;
+	std::atomic<uint32_t> pendingPipelineDraws{0};
+	void requestMaterialPipeline(uint32_t material);
+	void updateMaterialPipelines();
+
+	// bumped whenever anything recorded draws depend on changes (scene, views, pipeline, extent),
+	// reused secondaries recorded at an older version are re-recorded
+	uint64_t recordVersion = 1;
+	void invalidateRecordings() { recordVersion++; }
+
+	// per-frame draw constants, bound once as a dynamic uniform buffer and selected per draw by offset
+	StreamingBuffer streamingBuffer;
+	VkDescriptorSetLayout drawSetLayout;
+	VkDescriptorPool descriptorPool;
+	VkDescriptorSet drawSet;
+
+	// in headless mode swapChainImages are renderer-owned images backed by these allocations
+	std::vector<Allocation> headlessImageAllocations;
+	uint32_t lastImageIndex = 0;
 	VkCommandPool commandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
 
-	VkSemaphore imageAvailableSemaphore;
-	VkSemaphore renderFinishedSemaphore;
+	// command pool and secondary for one chunk of the draw list in one frame slot
+	struct RecordWorker {
+		VkCommandPool pool;					// holds only commandBuffer, so resetting the pool resets just that
+		VkCommandBuffer commandBuffer;
+
+		// what the secondary was last recorded for, see recordSecondaries
+		uint64_t recordedVersion = 0;
+		uint32_t first = 0;
+		uint32_t count = 0;
+		uint32_t constantsOffset = 0;
+	};
+
+	// resources owned by one slot of the frames-in-flight ring
+	struct FrameData {
+		VkSemaphore imageAvailableSemaphore;
+		VkSemaphore renderFinishedSemaphore;
+		VkFence inFlightFence;				// signalled when the GPU has finished this slot's submission
+		VkCommandPool commandPool;			// transient, reset wholesale when the slot is recorded again
+		VkCommandBuffer commandBuffer;
+		std::vector<RecordWorker> workers;	// one per recorded chunk, only used when recording into secondaries
+	};
+	std::vector<FrameData> frames;
+	std::vector<VkFence> imagesInFlight;	// fence of the frame currently rendering to each swap chain image (or VK_NULL_HANDLE)
+	uint32_t currentFrame = 0;
+	uint64_t frameNumber = 0;
+	FrameTimings lastFrameTimings;
+	GpuProfiler profiler;
+	PipelineCache pipelineCache;
+	PipelineRegistry pipelineRegistry;		// every graphics pipeline, deduplicated by description
+	ShaderLibrary shaderLibrary;
+	StartupTimings startupTimings;
+	double pendingRecreateMs = 0.0;		// swap chain rebuilds since the last presented frame, see FrameTimings::recreateMs
 
 	/* Vulkan Functions*/
 	// - create functions
@@ -51,9 +307,34 @@ private:
 	void createLogicalDevice();
 	void createSurface();
 	void createFrameBuffers();
+	VkFramebuffer createFramebuffer(VkRenderPass compatiblePass, VkImageView view, VkImageView depthView);
+	void createDepthTargets();
+	void destroyDepthTargets(std::vector<DepthTarget>& targets);
 	void createCommandPool();
 	void createCommandBuffers();
-	void createSemaphores();
+	VkCommandPool createTransientCommandPool();
+	void createSyncObjects();
+	void createHeadlessTargets();
+	void createMeshes();
+	Mesh createMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+	void destroyMesh(Mesh& mesh);
+	void createDescriptorSetLayout();
+	void createDescriptorSets();
+	void writeDrawDescriptor();
+
+	// - record functions
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t chunkCount);
+	// starts the render pass (or dynamic rendering) the scene is drawn in, secondaries when its contents are secondary command buffers
+	void beginMainPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaries);
+	void endMainPass(VkCommandBuffer commandBuffer);
+	std::vector<VkCommandBuffer> recordSecondaries(uint32_t chunkCount, const StreamingAllocation& sceneConstants);
+	// depthOnly records the prepass, which leaves writing the draw constants to the main pass
+	void recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount, const StreamingAllocation& sceneConstants, bool depthOnly);
+	void setViewport(VkCommandBuffer commandBuffer, const ViewRect& view);
+	// one instanced draw per batch and view, the instances were written to instances
+	void recordInstancedDraws(VkCommandBuffer commandBuffer, const StreamingAllocation& instances);
+	void ensureRecordWorkers(uint32_t chunkCount);
+	void ensureStreamingCapacity();
 
 	// - Get Functions
 	void getPhysicalDevice();
@@ -65,6 +346,62 @@ private:
 
 	// -- getter functions
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
+	VkFormat chooseDepthFormat() const;
+	std::vector<const char*> getRequiredDeviceExtensions() const;
+
+	// -- micro benchmarks (MicroBenchmarks.cpp)
+	void benchmarkAllocator(JsonWriter& json);
+	void benchmarkUpload(JsonWriter& json);
+	void benchmarkStreaming(JsonWriter& json);
+	void benchmarkRecording(JsonWriter& json);
+	void benchmarkJobs(JsonWriter& json);
+	void benchmarkRenderGraph(JsonWriter& json);
+	void benchmarkRendering(JsonWriter& json);
+	void benchmarkDepthPrepass(JsonWriter& json);
+	void benchmarkGpuDriven(JsonWriter& json);
+	void benchmarkInstancing(JsonWriter& json);
+	void benchmarkCulling(JsonWriter& json);
+	void benchmarkTransforms(JsonWriter& json);
+	void benchmarkPipelines(JsonWriter& json);
+	void benchmarkAsyncPipelines(JsonWriter& json);
+	void benchmarkSpecialization(JsonWriter& json);
+
+	// what measureFrames saw. Frames go back to back and the GPU is drained before and after, so frameMs is
+	// whichever side is slower
+	struct FrameSample {
+		double frameMs = 0.0;		// wall time per measured frame
+		double recordMs = 0.0;		// median command buffer recording
+		uint32_t drawCalls = 0;		// in the last frame
+	};
+	// draws warmupFrames, then measuredFrames timed
+	void measureFrames(uint32_t warmupFrames, uint32_t measuredFrames, FrameSample& sample);
+
+	// saves the scene, the draw path toggles and the material pipelines and puts them back when it goes out of
+	// scope, so a benchmark can change whatever it measures
+	class ScopedBenchmarkState {
+	public:
+		explicit ScopedBenchmarkState(VulkanRenderer& renderer);
+		~ScopedBenchmarkState();
+		ScopedBenchmarkState(const ScopedBenchmarkState&) = delete;
+		ScopedBenchmarkState& operator=(const ScopedBenchmarkState&) = delete;
+
+	private:
+		VulkanRenderer& renderer;
+		std::vector<DrawItem> drawItems;
+		bool gpuDriven;
+		bool instancing;
+		bool depthPrepass;
+		bool frustumCulling;
+		bool asyncPipelines;
+		bool incrementalRecording;
+		uint64_t gpuSceneVersion;
+		std::vector<PipelineDesc> materialDescs;
+		std::vector<MaterialConstants> materialConstants;
+	};
+
+	// -- one-off command submission
+	VkCommandBuffer beginSingleTimeCommands();
+	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
 
 	const std::vector<const char*> validationLayers = {
@@ -75,6 +412,20 @@ private:
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
 	};
 
+	// enabled when the device has them, features relying on them check isDeviceExtensionEnabled
+	const std::vector<const char*> optionalDeviceExtensions = {
+		VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME,
+		VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+		VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+		VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,	// dynamic rendering dependencies
+		VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+		VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+	};
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+	std::set<std::string> enabledDeviceExtensions;
+	bool isDeviceExtensionEnabled(const char* extension) const { return enabledDeviceExtensions.count(extension) > 0; }
+
 #ifdef NDEBUG
 	const bool enableValidationLayers = false;
 #else
@@ -101,11 +452,14 @@ private:
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
-	void createSwapChain();
+	uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentMode);
+	void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE);
+	bool recreateSwapChain();
+	void destroyRetiredSwapChains(bool waitedIdle);
 	std::vector<VkImageView> createImageViews();
 	void createGraphicsPipeline();
-	VkShaderModule createShaderModule(const std::vector<char>& code);
 
 	// -- render passes
 	void createRenderPass();
+	VkRenderPass createMainRenderPass(VkFormat colorFormat, VkFormat depthStencilFormat);
 };
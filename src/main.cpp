@@ -1,44 +1,319 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include <iostream>
 #include <string>
+#include <fstream>
 #include <glm/ext/matrix_float4x4.hpp>
 #include "VulkanRenderer.h"
 
 GLFWwindow* window;
 VulkanRenderer vulkanRenderer;
 
+// also fires on minimize (with a zero size)
+void framebufferResizeCallback(GLFWwindow*, int, int) {
+	vulkanRenderer.notifyResized();
+}
+
+// 1/2/3 switch between the present policies while running, P toggles the depth prepass,
+// G GPU-driven drawing, I instancing and C frustum culling
+void keyCallback(GLFWwindow*, int key, int /*scancode*/, int action, int /*mods*/) {
+	if (action != GLFW_PRESS) {
+		return;
+	}
+
+	PresentPolicy policies[] = {PresentPolicy::LowLatency, PresentPolicy::Throughput, PresentPolicy::PowerSaving};
+	if (key >= GLFW_KEY_1 && key <= GLFW_KEY_3) {
+		vulkanRenderer.setPresentPolicy(policies[key - GLFW_KEY_1]);
+	} else if (key == GLFW_KEY_P) {
+		vulkanRenderer.setDepthPrepass(!vulkanRenderer.isDepthPrepassEnabled());
+		std::cout << "depth prepass: " << (vulkanRenderer.isDepthPrepassEnabled() ? "on" : "off") << std::endl;
+	} else if (key == GLFW_KEY_G) {
+		vulkanRenderer.setGpuDriven(!vulkanRenderer.isGpuDriven());
+		std::cout << "gpu-driven: " << (vulkanRenderer.isGpuDriven() ? "on" : "off (or unsupported)") << std::endl;
+	} else if (key == GLFW_KEY_I) {
+		vulkanRenderer.setInstancing(!vulkanRenderer.isInstancingEnabled());
+		std::cout << "instancing: " << (vulkanRenderer.isInstancingEnabled() ? "on" : "off") << std::endl;
+	} else if (key == GLFW_KEY_C) {
+		vulkanRenderer.setFrustumCulling(!vulkanRenderer.isFrustumCullingEnabled());
+		std::cout << "frustum culling: " << (vulkanRenderer.isFrustumCullingEnabled() ? "on" : "off") << std::endl;
+	}
+}
+
 void initWindow(std::string wName = "Test Window", const int width = 800, const int height = 600) {
 	// initialize GLFW
 	glfwInit();
 
 	// Set GLFW to NOT work with OpenGL
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 	window = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
+	glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+	glfwSetKeyCallback(window, keyCallback);
+}
+
+// write RGBA8 pixels out as a binary PPM (alpha dropped)
+void writePPM(const std::string& path, const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+		file.write(reinterpret_cast<const char*>(&pixels[i * 4]), 3);
+	}
+}
+
+// reports go to the given file, or stdout when no path was given
+std::ostream& openReport(std::ofstream& file, const std::string& path) {
+	if (path.empty()) {
+		return std::cout;
+	}
+
+	file.open(path);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+	return file;
 }
 
-int main() {
-	// Create a Window
-	initWindow("Test Window", 800, 600);
+// write the benchmark results (and the configuration they were taken with) as JSON
+void writeBenchmarkReport(const FrameBenchmark& benchmark, const PresentPolicyStats& policyStats,
+                          const RendererSettings& settings, uint32_t overdraw, const std::string& path) {
+	std::ofstream file;
+	JsonWriter json(openReport(file, path));
+	json.beginObject();
+	json.beginObject("config");
+	json.value("device", vulkanRenderer.getDeviceName());
+	json.value("headless", settings.headless);
+	json.value("frames_in_flight", vulkanRenderer.getFramesInFlight());
+	json.value("width", vulkanRenderer.getExtent().width);
+	json.value("height", vulkanRenderer.getExtent().height);
+	json.value("present_policy", presentPolicyName(vulkanRenderer.getPresentPolicy()));
+	json.value("present_mode", vulkanRenderer.getPresentModeName());
+	json.value("swapchain_images", vulkanRenderer.getSwapChainImageCount());
+	json.value("draws", vulkanRenderer.getDrawCount());
+	json.value("record_threads", settings.recordThreads);
+	json.value("job_threads", vulkanRenderer.getJobSystem().getWorkerCount());
+	json.value("incremental_recording", settings.incrementalRecording);
+	json.value("synchronization2", vulkanRenderer.getRenderGraphStats().synchronization2);
+	json.value("dynamic_rendering", vulkanRenderer.usesDynamicRendering());
+	json.value("overdraw", overdraw);
+	json.value("depth_prepass", vulkanRenderer.isDepthPrepassEnabled());
+	json.value("depth_format", static_cast<uint32_t>(vulkanRenderer.getDepthFormat()));
+	json.value("depth_lazily_allocated", vulkanRenderer.isDepthLazilyAllocated());
+	json.value("gpu_driven", vulkanRenderer.isGpuDriven());
+	json.value("instancing", vulkanRenderer.isInstancingEnabled());
+	json.value("frustum_culling", vulkanRenderer.isFrustumCullingEnabled());
+	json.value("visible_draws", vulkanRenderer.getVisibleDrawCount());
+	json.value("async_pipelines", vulkanRenderer.isAsyncPipelinesEnabled());
+	json.endObject();
+
+	// run once with an empty (or missing) --pipeline-cache file and once more to compare cold and warm start-up
+	const StartupTimings& startup = vulkanRenderer.getStartupTimings();
+	json.beginObject("startup");
+	json.value("init_ms", startup.initMs);
+	json.value("pipeline_ms", startup.pipelineMs);
+	json.value("shader_ms", startup.shaderMs);
+	json.value("shader_source", startup.shadersFromDisk ? "disk" : "embedded");
+	json.value("pipeline_cache", startup.pipelineCacheWarm ? "warm" : "cold");
+	json.value("pipeline_cache_bytes", startup.pipelineCacheBytes);
+	json.value("creation_feedback", startup.creationFeedback);
+	json.value("cache_hits", startup.cacheHits);
+	json.value("cache_misses", startup.cacheMisses);
+	json.endObject();
+
+	json.beginObject("pipelines");
+	vulkanRenderer.getPipelineStats().writeJson(json);
+	json.endObject();
+
+	json.beginObject("memory");
+	vulkanRenderer.getMemoryStats().writeJson(json);
+	json.endObject();
+
+	benchmark.writeJson(json);
+
+	// covers every frame (warmup included), split by the policy active when it was rendered
+	json.beginArray("present_policies");
+	policyStats.writeJson(json);
+	json.endArray();
+	json.endObject();
+}
+
+int main(int argc, char** argv) {
+	// read renderer settings from the command line
+	RendererSettings settings;
+	uint64_t headlessFrames = 1000;
+	uint64_t benchFrames = 0;
+	uint64_t warmupFrames = 60;
+	std::string readbackPath;
+	std::string benchOutPath;
+	std::string tracePath;
+	std::string microBenchmark;
+	uint32_t splitScreen = 1;
+	uint32_t drawCount = 0;
+	uint32_t overdraw = 1;		// layers of the --draws test scene
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--frames-in-flight" && i + 1 < argc) {
+			settings.framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+		} else if (arg == "--headless") {
+			settings.headless = true;
+		} else if (arg == "--frames" && i + 1 < argc) {
+			headlessFrames = std::stoull(argv[++i]);
+		} else if (arg == "--readback" && i + 1 < argc) {
+			readbackPath = argv[++i];
+		} else if (arg == "--bench" && i + 1 < argc) {
+			benchFrames = std::stoull(argv[++i]);
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			warmupFrames = std::stoull(argv[++i]);
+		} else if (arg == "--bench-out" && i + 1 < argc) {
+			benchOutPath = argv[++i];
+		} else if (arg == "--pipeline-cache" && i + 1 < argc) {
+			settings.pipelineCachePath = argv[++i];
+		} else if (arg == "--no-pipeline-cache") {
+			settings.pipelineCachePath.clear();
+		} else if (arg == "--present-policy" && i + 1 < argc) {
+			if (!parsePresentPolicy(argv[++i], settings.presentPolicy)) {
+				std::cerr << "unknown present policy " << argv[i] << ", expected low-latency, throughput or power-saving" << std::endl;
+				return EXIT_FAILURE;
+			}
+		} else if (arg == "--microbench" && i + 1 < argc) {
+			microBenchmark = argv[++i];
+		} else if (arg == "--split-screen" && i + 1 < argc) {
+			splitScreen = static_cast<uint32_t>(std::stoul(argv[++i]));
+		} else if (arg == "--shader-dir" && i + 1 < argc) {
+			settings.shaderDirectory = argv[++i];
+		} else if (arg == "--record-threads" && i + 1 < argc) {
+			settings.recordThreads = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		} else if (arg == "--job-threads" && i + 1 < argc) {
+			settings.jobThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+		} else if (arg == "--pin-threads") {
+			settings.pinJobThreads = true;
+		} else if (arg == "--incremental-recording") {
+			settings.incrementalRecording = true;
+		} else if (arg == "--no-sync2") {
+			settings.synchronization2 = false;
+		} else if (arg == "--dynamic-rendering") {
+			settings.dynamicRendering = true;
+		} else if (arg == "--depth-prepass") {
+			settings.depthPrepass = true;
+		} else if (arg == "--gpu-driven") {
+			settings.gpuDriven = true;
+		} else if (arg == "--instancing") {
+			settings.instancing = true;
+		} else if (arg == "--frustum-culling") {
+			settings.frustumCulling = true;
+		} else if (arg == "--async-pipelines") {
+			settings.asyncPipelines = true;
+		} else if (arg == "--skip-pending-draws") {
+			settings.skipPendingDraws = true;
+		} else if (arg == "--compile-threads" && i + 1 < argc) {
+			settings.pipelineCompileThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+		} else if (arg == "--overdraw" && i + 1 < argc) {
+			overdraw = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		} else if (arg == "--draws" && i + 1 < argc) {
+			drawCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		} else if (arg == "--trace" && i + 1 < argc) {
+			tracePath = argv[++i];
+			settings.enableProfiler = true;
+		}
+	}
+
+	// Create a Window (headless runs never touch GLFW, so they work without a display)
+	if (!settings.headless) {
+		initWindow("Test Window", 800, 600);
+	}
 
 	// Create a vulkan rendere instance
-	if (vulkanRenderer.initVulkan(window) == EXIT_FAILURE) {
+	if (vulkanRenderer.initVulkan(window, settings) == EXIT_FAILURE) {
 		return EXIT_FAILURE;
 	}
+	vulkanRenderer.setSplitScreen(splitScreen);
+	if (drawCount > 0) {
+		vulkanRenderer.setTestScene(drawCount, overdraw);
+	}
 
-	// loop until closed
-	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
-		vulkanRenderer.drawFrame();
+	// --microbench runs a single isolated benchmark (results to --bench-out or stdout) and exits
+	if (!microBenchmark.empty()) {
+		int result = EXIT_SUCCESS;
+		try {
+			std::ofstream file;
+			JsonWriter json(openReport(file, benchOutPath));
+			json.beginObject();
+			json.value("device", vulkanRenderer.getDeviceName());
+			vulkanRenderer.runMicroBenchmark(microBenchmark, json);
+			json.endObject();
+		}
+		catch (const std::runtime_error& e) {
+			printf("ERROR: %s\n", e.what());
+			result = EXIT_FAILURE;
+		}
+
+		vulkanRenderer.cleanUp();
+		if (!settings.headless) {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+		return result;
+	}
+
+	// --bench runs a warmup, then a fixed number of timed frames, and exits
+	bool benchmarking = benchFrames > 0;
+	FrameBenchmark benchmark(warmupFrames, benchFrames);
+	PresentPolicyStats policyStats;
+	PresentPolicy currentPolicy = settings.presentPolicy;
+
+	if (settings.headless) {
+		// render a fixed number of frames
+		for (uint64_t frame = 0; benchmarking ? !benchmark.isDone() : frame < headlessFrames; frame++) {
+			vulkanRenderer.drawFrame();
+			benchmark.addFrame(vulkanRenderer.getLastFrameTimings());
+		}
+
+		if (!readbackPath.empty()) {
+			std::vector<uint8_t> pixels;
+			uint32_t width, height;
+			vulkanRenderer.readbackLastFrame(pixels, width, height);
+			writePPM(readbackPath, pixels, width, height);
+		}
+	} else {
+		// loop until closed
+		while (!glfwWindowShouldClose(window) && !(benchmarking && benchmark.isDone())) {
+			glfwPollEvents();
+			if (vulkanRenderer.drawFrame()) {
+				benchmark.addFrame(vulkanRenderer.getLastFrameTimings());
+				policyStats.addFrame(presentPolicyName(vulkanRenderer.getPresentPolicy()), vulkanRenderer.getPresentModeName(),
+				                     vulkanRenderer.getSwapChainImageCount(), vulkanRenderer.getLastFrameTimings());
+
+				if (vulkanRenderer.getPresentPolicy() != currentPolicy || vulkanRenderer.getFrameIndex() == 1) {
+					currentPolicy = vulkanRenderer.getPresentPolicy();
+					std::cout << "present policy: " << presentPolicyName(currentPolicy) << " (" << vulkanRenderer.getPresentModeName()
+					          << ", " << vulkanRenderer.getSwapChainImageCount() << " images)" << std::endl;
+				}
+			} else if (vulkanRenderer.isMinimized()) {
+				// don't spin while there is nothing to render
+				glfwWaitEvents();
+			}
+		}
+	}
+
+	if (benchmarking) {
+		writeBenchmarkReport(benchmark, policyStats, settings, overdraw, benchOutPath);
+	}
+
+	if (!tracePath.empty()) {
+		vulkanRenderer.writeTrace(tracePath);
 	}
 
 	vulkanRenderer.cleanUp();
 
 	// Destroy GLFW window
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (!settings.headless) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 }